@@ -0,0 +1,67 @@
+#ifndef TI_BINDINGS_HPP
+#define TI_BINDINGS_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+extern "C" {
+#include <xkbcommon/xkbcommon.h>
+}
+
+namespace ti {
+enum binding_action {
+  BINDING_NONE,
+  /// terminate the compositor
+  BINDING_QUIT,
+  /// switch to the virtual terminal of the XF86Switch_VT_* keysym
+  BINDING_CHVT,
+  /// focus the next view, alt+tab style
+  BINDING_NEXT_VIEW,
+  /// kill the focused view's client
+  BINDING_CLOSE_VIEW,
+  /// run binding::command
+  BINDING_SPAWN,
+  /// show or hide the damage overlay
+  BINDING_DAMAGE_DEBUG,
+};
+
+struct binding {
+  ti::binding_action action = ti::BINDING_NONE;
+  std::string command;
+};
+
+/** Compositor keybindings, in a hash table keyed on (modifiers, keysym). The
+ * built-in defaults can be changed from the file named by TI_BINDINGS, or
+ * $XDG_CONFIG_HOME/theinterface/bindings, with one binding per line:
+ *
+ *     # comment
+ *     Logo+Escape quit
+ *     Logo+Return spawn foot
+ *     Alt+F4 none
+ *
+ * Modifiers are Shift, Ctrl, Alt, Logo, Mod3 and Mod5, and keysyms are named
+ * like in xkbcommon. With Shift, letters match their upper case keysym, so
+ * Logo+Shift+d and Logo+Shift+D are the same binding. Actions are quit, chvt, next-view, close-view, spawn
+ * <command>, damage-debug and none, to remove a default binding. */
+class bindings {
+public:
+  /** Returns the binding of keysym with modifiers (as in
+   * wlr_keyboard_get_modifiers), or nullptr. Caps Lock and Num Lock are
+   * ignored. */
+  const ti::binding *find(uint32_t modifiers, xkb_keysym_t keysym) const;
+
+  void add(uint32_t modifiers, xkb_keysym_t keysym,
+           const ti::binding &binding);
+  /// reads the bindings in path, returns false if it can't be read
+  bool load(const std::string &path);
+
+  /// sets up the default bindings and loads the configuration file
+  bindings();
+
+private:
+  std::unordered_map<uint64_t, ti::binding> table;
+};
+} // namespace ti
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef TI_BUDGET_HPP
+#define TI_BUDGET_HPP
+
+#include <cstdint>
+
+namespace ti {
+class desktop;
+class view;
+struct client_stats;
+struct output;
+
+/// the use a view made of its budget, see ti::commit_budget
+struct budget_state {
+  /// the refresh interval being counted, CLOCK_MONOTONIC nanoseconds
+  int64_t window_start = 0;
+  uint32_t commits = 0;
+  uint64_t damaged_pixels = 0;
+  /// the budget of the window is spent: damage is deferred and frame
+  /// callbacks held back until it ends
+  bool over = false;
+
+  /// consecutive windows over budget
+  uint32_t strikes = 0;
+  /// over budget for long enough to be logged, until a window within budget
+  bool flagged = false;
+};
+
+/** A budget of commits and damage per refresh interval of its primary
+ * output, for each view: a client with many windows, each committing once per
+ * frame, stays within budget. A view over budget keeps committing at the cost
+ * of a counter increment: its damage is deferred to the next frame, where it
+ * is damaged once, and its frame callbacks are held back until the interval
+ * ends, which slows down clients that wait for them. Views over budget for a
+ * second or more are logged, and their clients flagged in ti-top.
+ *
+ * The views of the focused client are exempt. Set with TI_COMMIT_BUDGET, see
+ * the README. */
+class commit_budget {
+public:
+  ti::desktop *desktop;
+  /// per refresh interval, 0 when the budget is off
+  uint32_t max_commits = 4;
+  /// in areas of the primary output
+  float max_damage = 2;
+
+  /** Called on every commit of a view, before damaging it. Returns false if
+   * the damage is deferred. */
+  bool commit(ti::view *view);
+  /// called at the start of a frame: damages the views with deferred damage
+  void frame();
+  /// true if view's frame callbacks are held back on output's frame
+  bool hold_frame_done(ti::view *view, ti::output *output);
+
+  commit_budget(ti::desktop *desktop);
+
+private:
+  /// views with deferred damage
+  int deferred = 0;
+
+  bool exempt(ti::view *view);
+  /// starts a new window if the current one ended by now
+  void roll(ti::budget_state *state, ti::view *view,
+            ti::client_stats *stats, int64_t now);
+};
+} // namespace ti
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef TI_CLIENTS_HPP
+#define TI_CLIENTS_HPP
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+extern "C" {
+#include <wayland-server-core.h>
+}
+
+struct wlr_surface;
+
+namespace ti {
+class desktop;
+class client_tracker;
+
+/// a total, and how much it grew in the last complete second
+struct client_counter {
+  uint64_t total = 0;
+  uint64_t per_sec = 0;
+  uint64_t second_start = 0;
+
+  void tick() {
+    per_sec = total - second_start;
+    second_start = total;
+  }
+};
+
+/// what a client costs the compositor, see ti::client_tracker
+struct client_stats {
+  ti::client_tracker *tracker;
+  struct wl_client *client;
+  struct wl_listener destroy;
+  pid_t pid;
+  uid_t uid;
+  /// from /proc/<pid>/comm
+  std::string name;
+
+  /// surface commits
+  ti::client_counter commits;
+  /// pixels of buffer damage the commits carried
+  ti::client_counter damaged_pixels;
+  /// buffers replaced before any output sampled them
+  ti::client_counter wasted_commits;
+  /// frame callbacks sent
+  ti::client_counter frame_callbacks;
+  /// commits over the budgets of the client's views, see ti::commit_budget
+  ti::client_counter throttled_commits;
+
+  /// of the buffers attached to the client's surfaces now
+  uint64_t shm_bytes = 0;
+  uint64_t texture_bytes = 0;
+
+  /// surfaces of the client, which outlive it when it disconnects
+  int surfaces = 0;
+  bool destroyed = false;
+};
+
+/// a surface, accounted to its client
+struct client_surface {
+  struct wlr_surface *wlr_surface;
+  ti::client_stats *stats;
+  struct wl_list link; // ti::client_tracker::surfaces
+  struct wl_listener commit;
+  struct wl_listener destroy;
+
+  /// the current buffer was sampled by an output
+  bool sampled = false;
+  bool has_buffer = false;
+  uint64_t shm_bytes = 0;
+  uint64_t texture_bytes = 0;
+};
+
+/** Per-client accounting, from the surfaces of every client: commits, the
+ * damage they carry, the buffer memory they hold, the frame callbacks they
+ * get, and the commits nobody saw. A commit is wasted when its buffer is
+ * replaced before any output sampled it, as reported to presentation-time:
+ * the client rendered it for nothing.
+ *
+ * The counters are plain increments; rates are computed by tick() once a
+ * second. They are published with the metrics page, ti-top shows them. */
+class client_tracker {
+public:
+  ti::desktop *desktop;
+  struct wl_listener new_surface;
+
+  std::unordered_map<struct wl_client *, ti::client_stats *> clients;
+  struct wl_list surfaces;
+
+  /// the stats of client, created on first use
+  ti::client_stats *get(struct wl_client *client);
+  /// the stats of the client of surface
+  ti::client_stats *from_surface(struct wlr_surface *surface);
+  /// an output sampled surface for a frame
+  void surface_sampled(struct wlr_surface *surface);
+  /// surface is about to be sent its frame callbacks
+  void frame_done(struct wlr_surface *surface);
+  /// ends a second of the per second rates
+  void tick();
+
+  client_tracker(ti::desktop *desktop);
+  ~client_tracker();
+};
+} // namespace ti
+
+#endif
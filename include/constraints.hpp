@@ -0,0 +1,66 @@
+#ifndef TI_CONSTRAINTS_HPP
+#define TI_CONSTRAINTS_HPP
+
+#include <cstdint>
+
+extern "C" {
+#include <wayland-server-core.h>
+}
+
+namespace ti {
+class desktop;
+class seat;
+class view;
+class pointer_constraints;
+
+/// a pointer lock or confinement requested by a client
+struct pointer_constraint {
+  ti::pointer_constraints *constraints;
+  struct wlr_pointer_constraint_v1 *wlr_constraint;
+  /// the view it was activated on, valid while it is active
+  ti::view *view = nullptr;
+
+  struct wl_listener destroy;
+};
+
+/** The relative-pointer and pointer-constraints protocols. Clients with
+ * pointer focus get the deltas of every relative motion event, accelerated
+ * and raw, as the device reported them.
+ *
+ * A constraint becomes active once its surface has keyboard focus and the
+ * cursor is inside its region. While one is active there is no hit testing
+ * and no change of focus: a locked pointer doesn't move at all and its client
+ * only gets relative motion, a confined one moves within the region and its
+ * client gets motion events directly. */
+class pointer_constraints {
+public:
+  ti::desktop *desktop;
+  struct wlr_relative_pointer_manager_v1 *relative_pointer_manager;
+  struct wlr_pointer_constraints_v1 *wlr_constraints;
+  struct wl_listener new_constraint;
+
+  /// the constraint in effect, nullptr when the pointer is free
+  ti::pointer_constraint *active = nullptr;
+  /// the focused surface has a constraint that isn't active yet
+  bool pending = false;
+  /// set during update(), which destroyed constraints mustn't run again
+  bool updating = false;
+
+  /** Called with every pointer motion of seat, before the cursor moves.
+   * Returns true if an active constraint handled it: the cursor must not be
+   * moved nor hit tested. */
+  bool motion(ti::seat *seat, uint32_t time_msec, double dx, double dy,
+              double dx_unaccel, double dy_unaccel);
+  /** Activates the constraint of the focused surface if the cursor is in its
+   * region, and deactivates any other. Called on changes of focus and when
+   * the focused view unmaps: an unmapped view has no constraint. */
+  void update(ti::seat *seat);
+  /// deactivates the active constraint, moving the cursor to its hint
+  void deactivate(ti::seat *seat);
+
+  pointer_constraints(ti::desktop *desktop);
+  ~pointer_constraints();
+};
+} // namespace ti
+
+#endif
@@ -13,6 +13,11 @@ enum cursor_mode {
  * available. */
 void handle_new_input(struct wl_listener *listener, void *data);
 
+/** These events are raised when a client creates a virtual pointer or
+ * keyboard, see TI_VIRTUAL_INPUT. They join the seat like backend devices. */
+void handle_new_virtual_pointer(struct wl_listener *listener, void *data);
+void handle_new_virtual_keyboard(struct wl_listener *listener, void *data);
+
 /** This event is forwarded by the cursor when a pointer emits a _relative_
  * pointer motion event (i.e. a delta) */
 void handle_cursor_motion(struct wl_listener *listener, void *data);
@@ -0,0 +1,99 @@
+#ifndef TI_DAMAGE_OVERLAY_HPP
+#define TI_DAMAGE_OVERLAY_HPP
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+extern "C" {
+#include <pixman.h>
+#include <wlr/util/box.h>
+}
+
+struct wlr_texture;
+
+namespace ti {
+class desktop;
+struct output;
+
+/** What the scene asked to redraw on an output: the damage accumulated for a
+ * frame, not the larger buffer damage the age of the back buffer adds, and
+ * never the damage the overlay itself causes. */
+struct damage_stats {
+  /// committed frames with damage
+  uint64_t frames = 0;
+  uint64_t damaged_pixels = 0;
+
+  /// of the last frame
+  uint32_t last_pixels = 0;
+  uint32_t last_rects = 0;
+  float last_percent = 0;
+
+  /// the last complete second
+  uint32_t fps = 0;
+  float avg_percent = 0;
+  float max_percent = 0;
+  float avg_rects = 0;
+
+  /// the second being counted, and its totals
+  int64_t second = 0;
+  uint32_t second_frames = 0;
+  uint64_t second_pixels = 0;
+  uint64_t second_rects = 0;
+  float second_max_percent = 0;
+
+  /** Counts damage as the damage of a committed frame on an output of
+   * width * height pixels. Returns true when a new second started. */
+  bool add_frame(pixman_region32_t *damage, int width, int height,
+                 int64_t now_msec);
+};
+
+/** Draws the damage of the last frames of an output over it, and a panel with
+ * its damage stats. Each frame's damage is tinted, fading out over
+ * DAMAGE_OVERLAY_FRAMES frames, and surfaces that were redrawn are outlined.
+ * Toggled with the damage-debug binding or TI_DAMAGE_DEBUG=1. */
+class damage_overlay {
+public:
+  /** To be called before wlr_output_damage_attach_render: damages where the
+   * overlay drew in the previous frames, so that it fades out. scene_damage
+   * is what the scene damaged for the frame, valid until render(). */
+  void begin_frame(pixman_region32_t *scene_damage);
+
+  /** A surface was drawn on the output in box, in output buffer coordinates.
+   * It is only outlined if the scene damaged it: surfaces redrawn beneath the
+   * fading overlay would otherwise be outlined again on every frame. */
+  void surface_rendered(const struct wlr_box &box);
+
+  /** Draws the overlay over the rendered frame, within buffer_damage.
+   * scene_damage is what the scene damaged for the frame. */
+  void render(pixman_region32_t *scene_damage,
+              pixman_region32_t *buffer_damage);
+
+  /// redraws the stats panel, after damage_stats::add_frame started a second
+  void update_panel();
+
+  damage_overlay(ti::output *output);
+  ~damage_overlay();
+
+private:
+  struct frame {
+    pixman_region32_t damage;
+    std::vector<struct wlr_box> surfaces;
+    int age = 0;
+  };
+
+  ti::output *output;
+  std::deque<frame *> frames;
+  std::vector<struct wlr_box> surfaces;
+  pixman_region32_t *scene_damage = nullptr;
+
+  struct wlr_texture *panel = nullptr;
+  struct wlr_box panel_box = {};
+  bool panel_dirty = false;
+};
+
+/// turns the damage overlay on or off on every output
+void damage_debug_toggle(ti::desktop *desktop);
+} // namespace ti
+
+#endif
@@ -3,9 +3,9 @@
 
 extern "C" {
 #include <wlr/config.h>
+#include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_foreign_toplevel_management_v1.h>
 #include <wlr/types/wlr_presentation_time.h>
-#include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_shell.h>
 }
 
@@ -15,7 +15,20 @@ extern "C" {
 
 namespace ti {
 class server;
+class bindings;
+class client_tracker;
+class commit_budget;
+class pointer_constraints;
 class seat;
+class idle;
+class keymap_cache;
+class latency_tracker;
+class launch_tracker;
+class metrics;
+class recorder;
+class replayer;
+class screencopy_manager;
+class toplevel_capture_manager;
 enum cursor_mode;
 
 class desktop {
@@ -29,6 +42,12 @@ public:
 #ifdef WLR_HAS_XWAYLAND
   struct wlr_xwayland *xwayland;
   struct wl_listener new_xwayland_surface;
+  struct wl_listener xwayland_ready;
+  /// stops Xwayland once it has had no window for a while, see
+  /// TI_XWAYLAND_IDLE_TIMEOUT
+  struct wl_event_source *xwayland_idle_timer = nullptr;
+  /// in milliseconds of ti::monotonic_now(), 0 keeps Xwayland running
+  int xwayland_idle_timeout = 0;
 #endif
 
   struct wl_list views;
@@ -41,17 +60,40 @@ public:
 
   struct wl_listener new_input;
 
+  class ti::keymap_cache *keymaps;
+  class ti::bindings *bindings;
   class ti::seat *seat;
+  class ti::idle *idle;
 
   struct wlr_output_layout *output_layout;
+  struct wl_listener output_layout_change;
   struct wl_list outputs;
   struct wl_listener new_output;
   struct wlr_presentation *presentation;
+  class ti::screencopy_manager *screencopy;
+  class ti::toplevel_capture_manager *toplevel_capture;
+  class ti::launch_tracker *launches;
+  class ti::latency_tracker *latency;
+  class ti::client_tracker *clients;
+  class ti::commit_budget *budget;
+  class ti::pointer_constraints *constraints;
+  /// created by ti::server once the display has a socket, see ti::metrics
+  class ti::metrics *metrics = nullptr;
+  /// set by TI_RECORD and TI_REPLAY, see ti::recorder and ti::replayer
+  class ti::recorder *recorder = nullptr;
+  class ti::replayer *replayer = nullptr;
+  /// the damage overlay is shown on the outputs, see ti::damage_overlay
+  bool damage_debug = false;
 
   /** This iterates over all of our surfaces and attempts to find one under the
-   *  cursor. This relies on desktop->views being ordered from top-to-bottom. */
+   *  cursor. This relies on desktop->views being ordered from top-to-bottom.
+   *  Over the decorations of a view, the view is returned with surface set to
+   *  NULL, see view::decoration_at(). */
   ti::view *view_at(double lx, double ly, struct wlr_surface **surface,
                     double *sx, double *sy);
+  /** Picks the primary output of every view again, after outputs were added,
+   * removed, moved, turned on or off, or a view entered or left fullscreen. */
+  void update_primary_outputs();
 
   desktop(ti::server *s);
   ~desktop();
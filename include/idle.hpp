@@ -0,0 +1,55 @@
+#ifndef TI_IDLE_HPP
+#define TI_IDLE_HPP
+
+#include <ctime>
+
+extern "C" {
+#include <wayland-server-core.h>
+}
+
+namespace ti {
+class desktop;
+class seat;
+
+/** Tracks user activity on the seats and turns the outputs off after
+ * TI_IDLE_TIMEOUT seconds without input. Clients can prevent this with the
+ * idle-inhibit protocol (e.g. video players). */
+class idle {
+public:
+  ti::desktop *desktop;
+
+  struct wlr_idle *wlr_idle;
+  struct wlr_idle_inhibit_manager_v1 *inhibit_manager;
+  struct wl_listener new_inhibitor;
+  struct wl_list inhibitors; // ti::idle_inhibitor::link
+
+  /// in milliseconds of ti::monotonic_now(), 0 disables idle shutdown
+  int timeout = 0;
+  struct wl_event_source *timer = nullptr;
+  timespec last_activity;
+  /// true while the outputs are off because of idleness
+  bool idle_off = false;
+
+  /** Called by every input handler. This is on the hot path of every pointer
+   * motion, so it only stores a timestamp unless the outputs are off. */
+  void notify_activity(ti::seat *seat);
+
+  /// re-evaluates the inhibitors, e.g. after one of them was destroyed
+  void update_inhibited();
+  bool inhibited();
+
+  void set_outputs_enabled(bool enabled);
+
+  idle(ti::desktop *d);
+  ~idle();
+};
+
+struct idle_inhibitor {
+  struct wl_list link;
+  ti::idle *idle;
+  struct wlr_idle_inhibitor_v1 *wlr_inhibitor;
+  struct wl_listener destroy;
+};
+} // namespace ti
+
+#endif
@@ -1,16 +1,58 @@
 #ifndef TI_KEYBOARD_HPP
 #define TI_KEYBOARD_HPP
 
+#include <unordered_map>
+
+extern "C" {
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_keyboard.h>
+}
+
 namespace ti {
 class seat;
+struct keyboard_group;
+
+/** A keyboard device. The input of physical keyboards goes through their
+ * keyboard_group; virtual keyboards have their own keymap and modifiers and
+ * are used directly, their group is nullptr. */
 struct keyboard {
   struct wl_list link;
   ti::seat *seat;
   struct wlr_input_device *device;
+  ti::keyboard_group *group;
 
+  /// virtual keyboards only
   struct wl_listener modifiers;
   struct wl_listener key;
+  struct wl_listener destroy;
+};
+
+/** A compositor-side keyboard merging the key state of all the physical
+ * keyboards with the same keymap. This is the keyboard the seat sends to
+ * clients, so typing on another device with the same keymap (e.g. a barcode
+ * scanner) doesn't make wlroots send the keymap again. The modifiers, locks
+ * and layout are those of the group's own xkb state, fed with the merged
+ * keys; the members' own states are not used. */
+struct keyboard_group {
+  struct wl_list link; // ti::seat::keyboard_groups
+  ti::seat *seat;
+  struct xkb_keymap *keymap;
+
+  struct wlr_input_device device;
+  struct wlr_keyboard keyboard;
+  /// number of member keyboards
+  int size = 0;
+  /// keycode -> number of member keyboards holding the key down
+  std::unordered_map<uint32_t, int> pressed;
+
+  struct wl_listener modifiers;
+  struct wl_listener key;
+
+  /// forwards a key event of a member, unless another member holds the key
+  void notify_key(struct wlr_event_keyboard_key *event);
+  /// releases the keys held by a member that goes away
+  void remove(ti::keyboard *keyboard);
 };
 } // namespace ti
 
-#endif
\ No newline at end of file
+#endif
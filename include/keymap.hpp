@@ -0,0 +1,45 @@
+#ifndef TI_KEYMAP_HPP
+#define TI_KEYMAP_HPP
+
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+extern "C" {
+#include <xkbcommon/xkbcommon.h>
+}
+
+namespace ti {
+/** Compiled keymaps, shared by all the keyboards with the same RMLVO names.
+ * Compiling a keymap from its names takes tens of milliseconds, so the
+ * serialized keymaps are also kept in $XDG_CACHE_HOME/theinterface/keymaps,
+ * and loaded from there on the next start. The default keymap is compiled on
+ * a thread as soon as the cache is created, while the backend comes up. */
+class keymap_cache {
+public:
+  /// the one xkb_context of the compositor
+  struct xkb_context *context;
+
+  /** Returns the keymap for names, empty fields are taken from the
+   * XKB_DEFAULT_* environment variables like xkbcommon does. The keymap is
+   * owned by the cache, take a reference to keep it. */
+  struct xkb_keymap *get(const struct xkb_rule_names &names);
+
+  keymap_cache();
+  ~keymap_cache();
+
+private:
+  /// keymap_key() -> keymap
+  std::unordered_map<std::string, struct xkb_keymap *> keymaps;
+  /// empty if there's no usable cache directory
+  std::string cache_dir;
+  /// compiles the default keymap; joined before the cache is used
+  std::thread prefetch;
+
+  struct xkb_keymap *lookup(const struct xkb_rule_names &names);
+  struct xkb_keymap *load(const std::string &key);
+  void save(const std::string &key, struct xkb_keymap *keymap);
+};
+} // namespace ti
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef TI_LATENCY_HPP
+#define TI_LATENCY_HPP
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <wayland-server-core.h>
+}
+
+struct wlr_surface;
+
+namespace ti {
+class desktop;
+class view;
+struct output;
+
+enum input_type {
+  INPUT_MOTION,
+  INPUT_BUTTON,
+  INPUT_AXIS,
+  INPUT_KEY,
+  INPUT_TYPE_COUNT,
+};
+
+/// latencies in buckets of a quarter millisecond, the last one holds the
+/// longer ones
+struct latency_histogram {
+  std::vector<uint32_t> buckets;
+  uint64_t count = 0;
+  int64_t max_usec = 0;
+
+  void add(int64_t usec);
+  void merge(const latency_histogram &other);
+  /// in milliseconds, p in [0, 1]
+  double percentile(double p) const;
+
+  latency_histogram();
+};
+
+/// a frame committed with the inputs it is the first to show
+struct latency_frame {
+  uint32_t commit_seq;
+  int64_t commit_usec;
+  /// input time of each type, 0 for none
+  int64_t input_msec[ti::INPUT_TYPE_COUNT];
+};
+
+/// the latencies of an output
+struct latency_output {
+  ti::output *output;
+  struct wl_listener present;
+  /// committed frames waiting for their present event
+  std::deque<ti::latency_frame> frames;
+  /// input to commit, and input to scanout
+  ti::latency_histogram commit[ti::INPUT_TYPE_COUNT];
+  ti::latency_histogram scanout[ti::INPUT_TYPE_COUNT];
+};
+
+/** Input-to-photon latency: how long it takes for an input event to show on
+ * an output. An input sent to a client is followed until the client commits
+ * new content, then to the next frame with damage of the output showing the
+ * client's view. An input the compositor handles itself (bindings, moving a
+ * view) is followed to the next frame with damage. The time the frame is
+ * scanned out comes from the output's present event, the one presentation
+ * feedback uses.
+ *
+ * Only the oldest input of each type waiting to be shown is followed, so the
+ * latency of a burst of motion events is that of its first event. Inputs
+ * without a visible effect are given up on after a second. */
+class latency_tracker {
+public:
+  ti::desktop *desktop;
+
+  /** An input event was handled. time_msec is the event time, surface the
+   * surface the event was sent to, nullptr if the compositor used it. */
+  void input(ti::input_type type, uint32_t time_msec,
+             struct wlr_surface *surface);
+  /// a view committed new content
+  void view_committed(ti::view *view);
+  /// output committed a frame with damage
+  void frame_committed(ti::output *output);
+  /// drops the latencies of output, which goes away
+  void output_destroyed(ti::output *output);
+
+  /// logs the percentiles per input type, and per output and input type
+  void report();
+
+  /// samples since the last report
+  uint64_t unreported = 0;
+
+  latency_tracker(ti::desktop *desktop);
+  ~latency_tracker();
+
+private:
+  struct pending_input {
+    bool active = false;
+    int64_t time_msec;
+    /// the client the input was sent to, nullptr for the compositor
+    struct wl_client *client;
+    /// true once the client committed, or right away for the compositor
+    bool committed;
+    /// where the committed content shows, nullptr for any output
+    ti::output *output;
+  };
+
+  pending_input pending[ti::INPUT_TYPE_COUNT];
+  std::unordered_map<ti::output *, ti::latency_output *> outputs;
+  struct wl_event_source *report_timer;
+
+  ti::latency_output *get_output(ti::output *output);
+  /// gives up on the inputs waiting longer than LATENCY_GIVE_UP_MSEC
+  void expire_pending(int64_t now_msec);
+};
+} // namespace ti
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef TI_LAUNCH_HPP
+#define TI_LAUNCH_HPP
+
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <wayland-server-core.h>
+}
+
+namespace ti {
+class desktop;
+class view;
+
+/// a program started by the compositor that hasn't shown a window yet
+struct pending_launch {
+  pid_t pid;
+  std::string command;
+  /// given to the program as DESKTOP_STARTUP_ID
+  std::string startup_id;
+  struct timespec start;
+  /// set when the client announced startup_id through gtk_shell1
+  struct wl_client *client = nullptr;
+};
+
+/// launch times of one app id, in milliseconds
+struct launch_stats {
+  unsigned count = 0;
+  int64_t last = 0, min = 0, max = 0, total = 0;
+};
+
+/** Measures how long programs take from being spawned to mapping their first
+ * window. A window is matched with its launch by the pid of its client (or
+ * one of its parents), the _NET_WM_PID of X11 windows, or the startup id GTK
+ * applications send through gtk_shell1. */
+class launch_tracker {
+public:
+  ti::desktop *desktop;
+  struct wl_global *gtk_shell;
+
+  std::vector<ti::pending_launch> pending;
+  /// app id -> launch times
+  std::unordered_map<std::string, ti::launch_stats> stats;
+  /// launch times of all app ids
+  ti::launch_stats all;
+
+  /// median of the last launch times, 0 without any
+  int64_t recent_median() const;
+
+  /// ti::spawn()s command and starts timing it
+  pid_t spawn(const std::string &command);
+  /// called on every map, completes the launch the view belongs to
+  void view_mapped(ti::view *view);
+  /// called when a client sends gtk_shell1.set_startup_id
+  void set_startup_id(struct wl_client *client, const char *startup_id);
+
+  launch_tracker(ti::desktop *d);
+  ~launch_tracker();
+
+private:
+  unsigned next_startup_id = 0;
+  /// a view mapped before its client sent its startup id
+  struct early_map {
+    struct wl_client *client;
+    std::string app_id;
+    struct timespec when;
+  };
+  std::vector<early_map> early_maps;
+  /// the last launch times, oldest first
+  std::vector<int64_t> recent;
+
+  void complete(size_t index, const std::string &app_id,
+                const struct timespec &when, const char *matched_by);
+  void expire(const struct timespec &now);
+};
+} // namespace ti
+
+#endif
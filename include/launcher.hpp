@@ -0,0 +1,22 @@
+#ifndef TI_LAUNCHER_HPP
+#define TI_LAUNCHER_HPP
+
+#include <string>
+#include <sys/types.h>
+
+namespace ti {
+/** Forks the launcher, a helper process that starts every program the
+ * compositor runs. It is forked before the compositor opens any device or
+ * socket, so it stays small: starting a program from it costs the same
+ * whatever the compositor's size, and no compositor fd leaks into the
+ * programs. The launcher also reaps them. Call this first thing in main. */
+void launcher_start();
+
+/** Runs command with /bin/sh -c through the launcher, in a new session and
+ * with the compositor's current WAYLAND_DISPLAY and DISPLAY. startup_id is
+ * passed as DESKTOP_STARTUP_ID. Returns the pid of the program, or -1.
+ * Without a launcher, the program is spawned and reaped by the compositor. */
+pid_t spawn(const std::string &command, const std::string &startup_id = "");
+} // namespace ti
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef TI_LOG_HPP
+#define TI_LOG_HPP
+
+extern "C" {
+#include <wlr/util/log.h>
+}
+
+namespace ti {
+/** Makes wlr_log cheap enough to leave the debug log on. A log call only
+ * formats its message into a slot of a ring buffer; a thread writes the
+ * records out to TI_LOG_FILE (a path, or "journal" for the systemd journal),
+ * or to stderr. A call never blocks: a message is dropped (and counted) when
+ * the ring is full, or when its call site already logged 100 messages in the
+ * current second.
+ *
+ * The ring is mapped from $XDG_RUNTIME_DIR/theinterface.ring, so the last
+ * records outlive a crash. The ring of the previous run is kept as
+ * theinterface.ring.old, see log_dump(). */
+void log_init(enum wlr_log_importance verbosity);
+
+/// prints the records of a ring file to stdout, oldest first
+bool log_dump(const char *path);
+} // namespace ti
+
+#endif
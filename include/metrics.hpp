@@ -0,0 +1,169 @@
+#ifndef TI_METRICS_HPP
+#define TI_METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+
+struct wl_event_source;
+
+/* The layout of the metrics page is shared with ti-top, which may be built
+ * from another version: anything changing it bumps TI_METRICS_VERSION. */
+#define TI_METRICS_MAGIC 0x74696d74
+#define TI_METRICS_VERSION 4
+#define TI_METRICS_OUTPUTS 8
+/// the clients damaging the most are published
+#define TI_METRICS_CLIENTS 32
+#define TI_METRICS_NAME 32
+
+namespace ti {
+class desktop;
+struct output;
+
+struct metrics_output {
+  char name[TI_METRICS_NAME];
+  int32_t width, height;
+  uint32_t refresh_mhz;
+  /// committed frames
+  uint64_t frames;
+  /// from the frame event to the commit returning: what a frame costs the
+  /// compositor
+  uint32_t frame_usec;
+  uint32_t frame_usec_avg;
+  /// the longest of the last second
+  uint32_t frame_usec_max;
+  /// between the last two commits
+  uint32_t interval_usec;
+
+  /// see ti::damage_stats
+  uint64_t damaged_pixels;
+  uint32_t damage_fps;
+  float damage_last_percent;
+  float damage_avg_percent;
+  float damage_max_percent;
+  float damage_avg_rects;
+};
+
+/// see ti::client_stats
+struct metrics_client {
+  int32_t pid;
+  uint32_t uid;
+  char name[TI_METRICS_NAME];
+  uint64_t commits;
+  uint32_t commits_per_sec;
+  uint32_t wasted_commits_per_sec;
+  uint64_t wasted_commits;
+  uint64_t damaged_pixels_per_sec;
+  uint64_t frame_callbacks_per_sec;
+  uint64_t shm_bytes;
+  uint64_t texture_bytes;
+  /// commits over the client's budget, see ti::commit_budget
+  uint32_t throttled_commits_per_sec;
+  /// over budget for a while
+  uint32_t flagged;
+};
+
+struct metrics_data {
+  /// CLOCK_MONOTONIC microseconds of the last update, and of the start
+  int64_t updated_usec;
+  int64_t start_usec;
+
+  uint32_t views;
+  uint32_t mapped_views;
+  uint32_t connected_clients;
+
+  /// from spawn to first map, see ti::launch_tracker
+  uint32_t launches;
+  uint32_t launch_last_msec;
+  uint32_t launch_p50_msec;
+  uint32_t launch_max_msec;
+
+  /// C++ allocations of the compositor; the C libraries' aren't counted
+  uint64_t allocations;
+  uint64_t deallocations;
+  uint32_t allocations_per_sec;
+
+  /// time spent dispatching events rather than waiting for them
+  uint64_t loop_busy_usec;
+  uint64_t loop_dispatches;
+  float loop_busy_percent;
+  uint32_t loop_dispatches_per_sec;
+
+  uint32_t output_count;
+  ti::metrics_output outputs[TI_METRICS_OUTPUTS];
+  /// by damaged_pixels_per_sec, then commits_per_sec, highest first
+  uint32_t client_count;
+  ti::metrics_client clients[TI_METRICS_CLIENTS];
+};
+
+/** The metrics page. data is valid when sequence is even and didn't change
+ * while it was copied (a seqlock): the compositor makes sequence odd, stores
+ * the new values and makes it even again, without ever waiting for readers.
+ */
+struct metrics_page {
+  uint32_t magic;
+  uint32_t version;
+  /// sizeof(metrics_data)
+  uint32_t size;
+  int32_t pid;
+  alignas(64) std::atomic<uint32_t> sequence;
+  alignas(64) ti::metrics_data data;
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "the sequence is shared between processes");
+
+/// $XDG_RUNTIME_DIR/theinterface-<display>.metrics, empty without a runtime
+/// directory
+inline std::string metrics_path(const char *display) {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir == nullptr || display == nullptr) {
+    return "";
+  }
+  return std::string(runtime_dir) + "/theinterface-" + display + ".metrics";
+}
+
+/** Publishes performance data of the running compositor in a shared memory
+ * page (a file in $XDG_RUNTIME_DIR, which is a tmpfs), for ti-top and other
+ * readers. Output metrics are stored once per frame of each output, the rest
+ * once a second; readers map the page read-only and can't slow the
+ * compositor down. */
+class metrics {
+public:
+  ti::desktop *desktop;
+
+  /// output committed a frame, its frame event came at start_usec
+  void output_frame(ti::output *output, int64_t start_usec);
+  /// frees the slot of output, which goes away
+  void output_destroyed(ti::output *output);
+  /// republishes the per second values, from a timer
+  void update();
+
+  metrics(ti::desktop *desktop, const char *display);
+  ~metrics();
+
+private:
+  struct output_slot {
+    int index;
+    int64_t last_commit_usec = 0;
+    uint32_t second_max_usec = 0;
+  };
+
+  ti::metrics_page *page = nullptr;
+  std::string path;
+  struct wl_event_source *timer;
+  std::unordered_map<ti::output *, output_slot> outputs;
+
+  /// the counters at the last update
+  uint64_t last_allocations = 0;
+  uint64_t last_loop_busy_usec = 0;
+  uint64_t last_loop_dispatches = 0;
+  int64_t last_update_usec = 0;
+
+  void begin_write();
+  void end_write();
+};
+} // namespace ti
+
+#endif
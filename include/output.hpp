@@ -1,10 +1,14 @@
 #ifndef TI_OUTPUT_HPP
 #define TI_OUTPUT_HPP
 
+#include <string>
+
 extern "C" {
 #include <wlr/types/wlr_output_damage.h>
 }
 
+#include "damage_overlay.hpp"
+
 namespace ti {
 class desktop;
 class view;
@@ -31,8 +35,28 @@ struct output {
   ti::desktop *desktop;
   struct wlr_output *wlr_output;
   struct wl_listener frame;
+  struct wl_listener destroy;
 
   struct wlr_output_damage *damage;
+  /// what the scene damaged, see ti::damage_stats
+  ti::damage_stats damage_stats;
+  /// set while the damage overlay is on
+  ti::damage_overlay *damage_overlay = nullptr;
+
+  /// when set, this is the only view rendered on the output
+  ti::view *fullscreen_view = nullptr;
+
+  /// turned off by ti::idle, to be turned on again on user activity
+  bool idle_off = false;
+
+  /// name of the output this one mirrors (see TI_MIRROR), empty if none.
+  /// Mirrors aren't part of the output layout
+  std::string mirror_of;
+  /// the output named by mirror_of, once it exists
+  ti::output *mirror_source = nullptr;
+  /// on outputs that have mirrors: copy of the last frame, bottom-up like the
+  /// framebuffer it comes from
+  struct wlr_texture *mirror_texture = nullptr;
 
   void get_decoration_box(ti::view &view, struct wlr_box &box);
   void damage_partial_view(ti::view *view);
@@ -41,6 +65,10 @@ struct output {
                              ti_surface_iterator_func_t iterator,
                              void *user_data);
   void damage_whole_view(ti::view *view);
+
+  /** Turns the output on or off. A disabled output gets no frames, so it
+   * neither accumulates damage nor sends frame callbacks to its surfaces. */
+  void set_enabled(bool enabled);
 };
 } // namespace ti
 
@@ -50,6 +78,9 @@ void handle_new_output(struct wl_listener *listener, void *data);
 
 void output_damage_whole_view(ti::view *view, ti::output *output);
 
+/// returns the ti::output wrapping wlr_output, or nullptr
+ti::output *output_from_wlr_output(struct wlr_output *wlr_output);
+
 void scale_box(struct wlr_box *box, float scale);
 
 #endif
\ No newline at end of file
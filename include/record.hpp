@@ -0,0 +1,215 @@
+#ifndef TI_RECORD_HPP
+#define TI_RECORD_HPP
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_pointer.h>
+}
+
+struct wlr_surface;
+struct wlr_input_device;
+
+#define TI_RECORD_MAGIC 0x63726974
+#define TI_RECORD_VERSION 1
+
+namespace ti {
+class desktop;
+struct client_stats;
+struct output;
+
+/* A recording is a header followed by records. Each record starts with a
+ * record_header, its time is the time since the previous record, which makes
+ * a monotonic timeline in microseconds. Payloads are packed in the native
+ * byte order: recordings are replayed on the machine, or at least the
+ * architecture, they were made on. */
+enum record_type : uint8_t {
+  /// pauses longer than a record_header holds, payload: uint64_t usec
+  RECORD_PAUSE,
+  /// the cursor position when the recording started: double x, y
+  RECORD_CURSOR,
+  /// record_output
+  RECORD_OUTPUT,
+  /// record_motion, as seen by handle_cursor_motion
+  RECORD_MOTION,
+  /// record_motion, x and y from 0 to 1
+  RECORD_MOTION_ABSOLUTE,
+  /// record_button
+  RECORD_BUTTON,
+  /// record_axis
+  RECORD_AXIS,
+  /// no payload
+  RECORD_POINTER_FRAME,
+  /// record_key, as seen by the keyboard group
+  RECORD_KEY,
+  /// record_frame: an output committed a frame
+  RECORD_FRAME,
+  /// record_commit: a surface committed a buffer
+  RECORD_COMMIT,
+};
+
+struct record_file_header {
+  uint32_t magic;
+  uint32_t version;
+  /// CLOCK_REALTIME seconds of the start, for people reading it
+  int64_t started;
+};
+
+struct record_header {
+  uint8_t type;
+  uint8_t size;
+  uint16_t reserved;
+  uint32_t delta_usec;
+};
+
+struct record_output {
+  uint8_t index;
+  int32_t width, height;
+  int32_t refresh;
+  char name[24];
+} __attribute__((packed));
+
+struct record_motion {
+  uint32_t time_msec;
+  double x, y;
+} __attribute__((packed));
+
+struct record_button {
+  uint32_t time_msec;
+  uint32_t button;
+  uint32_t state;
+};
+
+struct record_axis {
+  uint32_t time_msec;
+  uint8_t orientation;
+  uint8_t source;
+  int32_t delta_discrete;
+  double delta;
+} __attribute__((packed));
+
+struct record_key {
+  uint32_t time_msec;
+  uint32_t keycode;
+  uint32_t state;
+};
+
+struct record_frame {
+  uint8_t output;
+  /// from the frame event to the commit
+  uint32_t frame_usec;
+} __attribute__((packed));
+
+struct record_commit {
+  int32_t pid;
+  /// the wl_surface's object id within its client
+  uint32_t surface;
+  int32_t width, height;
+  /// of the pixels of shm buffers, 0 for buffers the compositor can't read
+  uint64_t hash;
+} __attribute__((packed));
+
+/** Records the input reaching the cursor and keyboard handlers, output frames
+ * and surface commits to a file, see TI_RECORD. Records are buffered and
+ * written out when the buffer fills up and once a second. */
+class recorder {
+public:
+  ti::desktop *desktop;
+
+  void motion(struct wlr_event_pointer_motion *event);
+  void motion_absolute(struct wlr_event_pointer_motion_absolute *event);
+  void button(struct wlr_event_pointer_button *event);
+  void axis(struct wlr_event_pointer_axis *event);
+  void pointer_frame();
+  void key(struct wlr_event_keyboard_key *event);
+  /// output committed a frame, its frame event came at start_usec
+  void frame(ti::output *output, int64_t start_usec);
+  /// output goes away, a new one at the same address gets a new index
+  void output_destroyed(ti::output *output);
+  /// surface of the client of stats committed a buffer
+  void commit(struct wlr_surface *surface, ti::client_stats *stats);
+
+  /// writes the buffered records out
+  void flush();
+
+  recorder(ti::desktop *desktop, const char *path);
+  ~recorder();
+
+private:
+  int fd;
+  std::vector<uint8_t> buffer;
+  int64_t last_usec;
+  struct wl_event_source *flush_timer;
+  std::vector<ti::output *> outputs;
+
+  void add(ti::record_type type, const void *payload, size_t size);
+};
+
+/** Replays the input and output frames of a recording on the headless
+ * backend, see TI_REPLAY. Input events and frames are played from the
+ * records in their recorded order, on a virtual clock that advances by the
+ * delta of each record: event times and frame done times are taken from it,
+ * and frames of the backend's own timer are ignored, so that the compositor
+ * sees the same sequence on every replay. The wall clock only paces the
+ * records, on the ti::monotonic_now() clock so TI_CLOCK_SPEED replays faster.
+ * Clients are not part of a recording, what they draw in between is up to
+ * them. Once the recording ends, the frames of both runs are logged and the
+ * compositor exits. */
+class replayer {
+public:
+  ti::desktop *desktop;
+
+  /// sets up the backend for a replay, before it is created
+  static void prepare();
+
+  /// false if the recording couldn't be read
+  bool load(const char *path);
+  /// creates the outputs and devices of the recording and starts playing
+  void start();
+  /// plays the records that are due, from a timer
+  void play();
+  /// counts a frame of the replay
+  void frame() { ++replay_frames; }
+  /// whether a frame event of output was played from the recording
+  bool owns_frame(ti::output *output);
+  /// the virtual clock, on the ti::monotonic_now() timeline
+  timespec now();
+  /// its frames in the recording are skipped
+  void output_destroyed(ti::output *output);
+
+  replayer(ti::desktop *desktop);
+  ~replayer();
+
+private:
+  std::vector<uint8_t> data;
+  size_t position = 0;
+  /// on the recording's timeline
+  int64_t record_usec = 0;
+  /// monotonic_now() when the replay started, in msec
+  int64_t start_msec = 0;
+
+  struct wlr_backend *headless = nullptr;
+  /// the outputs of the recording, by their record_output index
+  std::vector<struct wlr_output *> outputs;
+  /// the output a frame is being played on
+  struct wlr_output *frame_output = nullptr;
+  struct wlr_input_device *keyboard = nullptr;
+  struct wl_event_source *timer = nullptr;
+
+  uint64_t events = 0;
+  uint64_t record_frames = 0, replay_frames = 0;
+
+  uint32_t event_time();
+  void dispatch(const ti::record_header &header, const uint8_t *payload);
+};
+
+/// prints a recording as text, one record per line
+bool record_print(const char *path);
+} // namespace ti
+
+#endif
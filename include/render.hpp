@@ -1,7 +1,13 @@
 #ifndef TI_RENDER_HPP
 #define TI_RENDER_HPP
 
+extern "C" {
+#include <pixman.h>
+#include <wayland-server-protocol.h>
+}
+
 struct wlr_output;
+struct wlr_renderer;
 
 namespace ti {
 
@@ -12,10 +18,19 @@ class view;
 struct render_data {
   pixman_region32_t *damage;
   float alpha;
+  /// view currently being rendered, set by view::render
+  ti::view *view;
 };
 } // namespace ti
 
 void render_surface(struct wlr_surface *surface, int sx, int sy, void *data);
+
+/** Reads the rectangles of region from the currently bound framebuffer into a
+ * wl_shm buffer. A pixel at (x, y) lands at (x - dx, y - dy) in the buffer.
+ * Regions with many rectangles are read back as their extents. */
+bool read_region_to_shm(struct wlr_renderer *renderer,
+                        struct wl_resource *buffer, enum wl_shm_format format,
+                        int stride, pixman_region32_t *region, int dx, int dy);
 void scissor_output(struct wlr_output *wlr_output, pixman_box32_t *rect);
 void render_surface_iterator(ti::output *output, struct wlr_surface *surface,
                              struct wlr_box *_box, float rotation, void *_data);
@@ -0,0 +1,78 @@
+#ifndef TI_SCREENCOPY_HPP
+#define TI_SCREENCOPY_HPP
+
+#include <ctime>
+
+extern "C" {
+#include <pixman.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+#include <wlr/util/box.h>
+}
+
+namespace ti {
+class desktop;
+class screencopy_manager;
+struct output;
+
+/// A capture of (a region of) an output, see wlr-screencopy-unstable-v1
+struct screencopy_frame {
+  struct wl_list link; // ti::screencopy_manager::frames
+  struct wl_resource *resource;
+  ti::screencopy_manager *manager;
+  ti::output *output;
+
+  /// captured region, in buffer coordinates
+  struct wlr_box box;
+  enum wl_shm_format format;
+  int stride;
+
+  /// the client buffer, set by copy and copy_with_damage
+  struct wl_resource *buffer = nullptr;
+  struct wl_listener buffer_destroy;
+  bool with_damage = false;
+};
+
+/** What a wl_buffer that was copied into already holds. As long as a client
+ * copies the same region of the same output into it, only the damage
+ * accumulated since its last copy has to be read back. Clients cycling
+ * through several buffers, or capturing several outputs, get the state of
+ * each buffer. */
+struct screencopy_buffer {
+  struct wl_list link; // ti::screencopy_manager::buffers
+  struct wl_resource *resource;
+
+  /// where its content came from, output is nullptr until the first copy
+  ti::output *output = nullptr;
+  struct wlr_box box;
+  struct wl_listener destroy;
+
+  /// output damage since the last copy, in buffer coordinates
+  pixman_region32_t damage;
+
+  /// whether it holds box of output, so that a damage copy is enough
+  bool holds(ti::output *output, const struct wlr_box &box);
+};
+
+class screencopy_manager {
+public:
+  ti::desktop *desktop;
+  struct wl_global *global;
+
+  struct wl_list frames;  // ti::screencopy_frame::link
+  struct wl_list buffers; // ti::screencopy_buffer::link
+
+  /** Called by output_frame right after composition, while the rendered
+   * buffer is still bound. Copies the damaged parts of the frame into the
+   * buffers of the pending frames. frame_damage is in buffer coordinates. */
+  void output_rendered(ti::output *output, pixman_region32_t *frame_damage,
+                       const timespec *when);
+  /// fails the frames of output, and forgets what buffers hold of it
+  void output_destroyed(ti::output *output);
+
+  screencopy_manager(ti::desktop *d);
+  ~screencopy_manager();
+};
+} // namespace ti
+
+#endif
@@ -11,17 +11,23 @@ public:
   class ti::desktop *desktop;
   struct wlr_seat *wlr_seat;
   struct wl_list keyboards;
+  /// ti::keyboard_group::link, one per keymap
+  struct wl_list keyboard_groups;
 
   struct wlr_cursor *cursor;
-  struct wlr_xcursor_manager *cursor_mgr;
-#ifdef WLR_HAS_XWAYLAND
-  struct wlr_xcursor *xcursor;
-  struct wlr_xcursor_manager *xwayland_xcursor_manager;
-#endif
+  /// the theme cursor last set with set_cursor(), nullptr if a client set the
+  /// image or it has to be set again
+  const char *cursor_image = nullptr;
   enum ti::cursor_mode cursor_mode;
 
   struct wl_listener request_cursor;
 
+  /// nullptr unless TI_VIRTUAL_INPUT is set
+  struct wlr_virtual_pointer_manager_v1 *virtual_pointer = nullptr;
+  struct wlr_virtual_keyboard_manager_v1 *virtual_keyboard = nullptr;
+  struct wl_listener new_virtual_pointer;
+  struct wl_listener new_virtual_keyboard;
+
   struct wl_listener cursor_motion;
   struct wl_listener cursor_motion_absolute;
   struct wl_listener cursor_button;
@@ -37,6 +43,11 @@ public:
   int grab_width, grab_height;
   int resize_edges;
 
+  /** Shows the cursor name of the theme, at the scale of each output. Does
+   * nothing if it is already shown. */
+  void set_cursor(const char *name);
+
+  /** Gives Xwayland its default cursor. */
   void setup_xwayland_cursor(wlr_xwayland *xwayland);
 
   /** NOTE: this function only deals with keyboard focus. */
@@ -44,12 +55,20 @@ public:
 
   void new_keyboard(struct wlr_input_device *device);
 
+  /** A keyboard of the virtual keyboard protocol, with the keymap and
+   * modifiers its client sends. It isn't merged into a keyboard group. */
+  void new_virtual_keyboard(struct wlr_input_device *device);
+
   /** We don't do anything special with pointers. All of our pointer handling
    * is proxied through wlr_cursor. On another compositor, you might take this
    * opportunity to do libinput configuration on the device to set
    * acceleration, etc. */
   void new_pointer(struct wlr_input_device *device);
 
+  /** Lets the wlr_seat know what our capabilities are, which is communicated
+   * to the clients. */
+  void update_capabilities();
+
   seat(ti::desktop *d);
   ~seat();
 };
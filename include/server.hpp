@@ -1,6 +1,8 @@
 #ifndef TI_SERVER_HPP
 #define TI_SERVER_HPP
 
+#include <cstdint>
+
 extern "C" {
 #include <wlr/backend.h>
 #include <wlr/types/wlr_data_device.h>
@@ -19,8 +21,20 @@ public:
 
   struct wlr_data_device_manager *data_device_manager;
 
+  /// time spent dispatching events, rather than waiting for them
+  uint64_t loop_busy_usec = 0;
+  uint64_t loop_dispatches = 0;
+
+  /** Runs the event loop like wl_display_run, timing the dispatches. Returns
+   * after terminate(). */
+  void run();
+  void terminate();
+
   server();
   ~server();
+
+private:
+  bool running = false;
 };
 } // namespace ti
 
@@ -0,0 +1,29 @@
+#ifndef TI_STARTUP_HPP
+#define TI_STARTUP_HPP
+
+#include <cstdint>
+
+namespace ti {
+/** Times a phase of startup, from its construction to its destruction.
+ * Phases nest, and may run on other threads than the main one. Nothing is
+ * recorded once the first frame is shown. */
+class startup_phase {
+public:
+  explicit startup_phase(const char *name);
+  ~startup_phase();
+
+  startup_phase(const startup_phase &) = delete;
+  startup_phase &operator=(const startup_phase &) = delete;
+
+private:
+  const char *name;
+  int64_t start;
+};
+
+/** To be called after each output commit. The first call logs the startup
+ * timeline and the time to first frame, and writes them to TI_STARTUP_TRACE
+ * in the Trace Event Format (chrome://tracing, Perfetto). */
+void startup_first_frame();
+} // namespace ti
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef TI_TITLEBAR_HPP
+#define TI_TITLEBAR_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <wayland-server-core.h>
+}
+
+struct wlr_renderer;
+struct wlr_texture;
+
+namespace ti {
+class view;
+
+/** The title text of a view's server-side titlebar, rasterized by cairo into
+ * a texture. A texture is kept per output scale and only rasterized again
+ * when the title, width, scale or activation changes, never per frame. Title
+ * changes are rate-limited: a client retitling many times a second (e.g. a
+ * terminal showing the running command) is shown its latest title at most
+ * every TITLEBAR_TITLE_INTERVAL_MSEC. */
+class titlebar {
+public:
+  ti::view *view;
+
+  /** The texture of the title at this width and scale, rasterized if the
+   * cached one doesn't match. Sizes are in layout coordinates. */
+  struct wlr_texture *texture(struct wlr_renderer *renderer, int width,
+                              float scale, bool activated);
+  /// called on title changes, damages the titlebar when it is shown
+  void set_title(const std::string &title);
+
+  /// the color of the titlebar and the border around the view
+  static void background(bool activated, float alpha, float color[4]);
+
+  titlebar(ti::view *view, const std::string &title);
+  ~titlebar();
+
+private:
+  struct entry {
+    std::string title;
+    int width;
+    float scale;
+    bool activated;
+    struct wlr_texture *texture;
+  };
+  /// one entry per scale the view was rendered at
+  std::vector<entry> cache;
+
+  /// the title shown, behind the view's while rate-limited
+  std::string shown_title;
+  std::string pending_title;
+  int64_t last_title_msec = 0;
+  struct wl_event_source *title_timer = nullptr;
+
+  void show_title(const std::string &title);
+  static int handle_title_timer(void *data);
+};
+} // namespace ti
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef TI_TOPLEVEL_CAPTURE_HPP
+#define TI_TOPLEVEL_CAPTURE_HPP
+
+#include <GLES2/gl2.h>
+
+extern "C" {
+#include <pixman.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+#include <wlr/util/box.h>
+}
+
+struct wlr_surface;
+
+namespace ti {
+class desktop;
+class view;
+class toplevel_capture_manager;
+
+/// A capture of a single view, see ti-toplevel-capture-unstable-v1
+struct toplevel_capture_frame {
+  struct wl_list link; // ti::toplevel_capture_manager::frames
+  struct wl_resource *resource;
+  ti::toplevel_capture_manager *manager;
+  ti::view *view;
+
+  /// bounding box of the view's surfaces, in view-local coordinates
+  struct wlr_box box;
+  enum wl_shm_format format;
+  int stride;
+
+  /// the client buffer, set by copy and copy_with_damage
+  struct wl_resource *buffer = nullptr;
+  struct wl_listener buffer_destroy;
+  bool with_damage = false;
+};
+
+/** Per client and view: the offscreen framebuffer the view is rendered into
+ * before it is read back. */
+struct toplevel_capture_session {
+  struct wl_list link; // ti::toplevel_capture_manager::sessions
+  struct wl_client *client;
+  ti::view *view;
+  struct wl_listener client_destroy;
+
+  GLuint fbo = 0, rbo = 0;
+  int fb_width = 0, fb_height = 0;
+};
+
+/** What a wl_buffer that was copied into already holds. As long as a client
+ * copies the same view with the same bounding box into it, only the damage
+ * the view committed since its last copy has to be rendered and read back.
+ * Clients cycling through several buffers get the state of each buffer. */
+struct toplevel_capture_buffer {
+  struct wl_list link; // ti::toplevel_capture_manager::buffers
+  struct wl_resource *resource;
+
+  /// where its content came from, view is nullptr until the first copy
+  ti::view *view = nullptr;
+  struct wlr_box box;
+  struct wl_listener destroy;
+
+  /// committed damage since the last copy, in view-local coordinates
+  pixman_region32_t damage;
+
+  /// whether it holds box of view, so that a damage copy is enough
+  bool holds(ti::view *view, const struct wlr_box &box);
+};
+
+class toplevel_capture_manager {
+public:
+  ti::desktop *desktop;
+  struct wl_global *global;
+
+  struct wl_list frames;   // ti::toplevel_capture_frame::link
+  struct wl_list sessions; // ti::toplevel_capture_session::link
+  struct wl_list buffers;  // ti::toplevel_capture_buffer::link
+
+  /** Called on every surface commit, by ti::client_tracker: if the surface
+   * is part of a captured view, e.g. its toplevel, a subsurface or a popup,
+   * collects its damage and completes the frames that were waiting for it.
+   * Returns right away if nobody captures anything. */
+  void surface_committed(struct wlr_surface *surface);
+  void view_destroyed(ti::view *view);
+
+  toplevel_capture_manager(ti::desktop *d);
+  ~toplevel_capture_manager();
+};
+} // namespace ti
+
+#endif
@@ -23,4 +23,19 @@ inline int safe_kill(pid_t __pid, int __sig) {
 }
 
 void fps_counter(const timespec &now);
+
+namespace ti {
+/** CLOCK_MONOTONIC, unless TI_CLOCK_SPEED is set: then the clock starts at the
+ * first call and runs that many times faster than real time, so that long
+ * timeouts (e.g. idle) can be exercised on the headless backend in seconds. */
+timespec monotonic_now();
+
+/// converts a duration of the monotonic_now() clock to real milliseconds, to
+/// be used with event loop timers
+int real_msec(int msec);
+} // namespace ti
+
+inline int64_t timespec_to_msec(const timespec &ts) {
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 #endif
\ No newline at end of file
@@ -11,6 +11,7 @@ extern "C" {
 #include <wlr/types/wlr_surface.h>
 }
 
+#include "budget.hpp"
 #include "cursor.hpp"
 
 namespace ti {
@@ -23,6 +24,7 @@ enum view_type {
 
 struct render_data;
 class desktop;
+class titlebar;
 
 /// view interface
 class view {
@@ -31,6 +33,8 @@ public:
   bool mapped = false, was_ever_mapped = false;
   unsigned border_width, titlebar_height;
   bool decorated = false;
+  /// the title text of decorated views
+  ti::titlebar *titlebar = nullptr;
 
   struct wlr_box box {};
   float rotation = 0.0;
@@ -38,6 +42,15 @@ public:
 
   bool maximized = false;
   struct output *fullscreen_output = nullptr;
+  /// geometry to restore when leaving fullscreen
+  struct wlr_box saved_box {};
+
+  /// the output that drives this view's frame callbacks and presentation
+  /// feedback. See update_primary_output()
+  struct output *primary_output = nullptr;
+  /// a commit over the view's budget wasn't damaged, see ti::commit_budget
+  bool damage_deferred = false;
+  ti::budget_state budget;
 
   std::string title = "(nil)";
   pid_t pid;
@@ -57,11 +70,12 @@ public:
   struct wl_listener destroy;
   struct wl_listener request_move;
   struct wl_listener request_resize;
+  struct wl_listener request_fullscreen;
   struct wl_listener new_subsurface;
 
   struct wl_listener surface_commit;
 
-  struct wlr_foreign_toplevel_handle_v1 *toplevel_handle;
+  struct wlr_foreign_toplevel_handle_v1 *toplevel_handle = nullptr;
   struct wl_listener toplevel_handle_request_maximize;
   struct wl_listener toplevel_handle_request_activate;
   struct wl_listener toplevel_handle_request_fullscreen;
@@ -73,21 +87,46 @@ public:
   void get_box(wlr_box &box);
   void get_deco_box(wlr_box &box);
   virtual std::string get_title() = 0;
+  /// xdg app id, or X11 window class
+  virtual std::string get_app_id() = 0;
 
   virtual void for_each_surface(wlr_surface_iterator_func_t iterator,
                                 void *user_data) = 0;
   void damage_whole();
   void damage_partial();
   void update_position(int __x, int __y);
+
+  /** Picks the output with the largest visible area of the view, using the
+   * highest refresh rate as a tie-breaker. The current primary output is only
+   * replaced when another output shows strictly more of the view, so a window
+   * sitting on an output boundary doesn't flip back and forth. Called when
+   * the view maps, unmaps, moves or is resized, and for every view by
+   * desktop::update_primary_outputs(); output_frame only reads the result. */
+  void update_primary_output();
   void render_decorations(ti::output *output, ti::render_data *rdata);
   void render(ti::output *output, ti::render_data *data);
   virtual void activate() = 0;
   virtual void deactivate() = 0;
 
+  /** Makes the view cover the whole output, or restores its previous geometry.
+   * If wlr_output is NULL, the output under the center of the view is used. */
+  void set_fullscreen(bool fullscreen, struct wlr_output *wlr_output);
+
+  void create_toplevel_handle();
+  void destroy_toplevel_handle();
+
   /** This function sets up an interactive move or resize operation, where the
    * compositor stops propegating pointer events to clients and instead consumes
-   * them itself, to move or resize windows. */
-  void begin_interactive(ti::cursor_mode mode, unsigned edges);
+   * them itself, to move or resize windows. Requests of clients are denied
+   * unless they have pointer focus, from_client is false for the compositor's
+   * own decorations. */
+  void begin_interactive(ti::cursor_mode mode, unsigned edges,
+                         bool from_client = true);
+
+  /** Tests if the server-side decorations are under lx and ly (in output
+   * Layout Coordinates). If so, edges is set to the wlr_edges to resize from
+   * when it is the border, or to 0 when it is the titlebar. */
+  bool decoration_at(double lx, double ly, unsigned *edges);
 
   /*
    * XDG toplevels may have nested surfaces, such as popup windows for context
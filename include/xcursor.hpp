@@ -0,0 +1,72 @@
+#ifndef TI_XCURSOR_HPP
+#define TI_XCURSOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ti {
+/// one image of a cursor, pointing into the memory-mapped theme file
+struct cursor_image {
+  uint32_t width, height;
+  uint32_t hotspot_x, hotspot_y;
+  uint32_t delay;
+  /// premultiplied ARGB8888, width * 4 bytes per row
+  const uint8_t *pixels;
+};
+
+/** The Xcursor theme of the compositor (XCURSOR_THEME and XCURSOR_SIZE),
+ * shared by all seats and Xwayland. The environment is read when the theme
+ * is created, so that it can be used from a thread. Nothing else is read
+ * until a cursor is first needed; then only the file of that cursor is
+ * mapped, and the image closest to the wanted size is used straight from the
+ * mapping. Cursors the theme doesn't have are shown as its left_ptr, or as a
+ * built-in arrow if there is no theme at all. */
+class cursor_theme {
+public:
+  /// the process-wide theme
+  static ti::cursor_theme &get();
+
+  /** Returns the image of cursor name for outputs with the given scale, or
+   * the left_ptr image if the theme has no such cursor. */
+  const ti::cursor_image *image(const std::string &name, float scale);
+
+  cursor_theme(const cursor_theme &) = delete;
+  cursor_theme &operator=(const cursor_theme &) = delete;
+
+private:
+  struct cursor_file {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    /// nominal size -> first image of that size
+    std::unordered_map<uint32_t, ti::cursor_image> images;
+  };
+
+  std::string theme_name;
+  unsigned size;
+  /// XCURSOR_PATH or the default search path
+  std::vector<std::string> search_dirs;
+  /// cursors directories of the theme and the themes it inherits, resolved
+  /// on first use
+  std::vector<std::string> dirs;
+  bool dirs_resolved = false;
+  /// cursor name -> mapped file, nullptr if the theme doesn't have it
+  std::unordered_map<std::string, cursor_file *> files;
+
+  struct builtin_cursor {
+    std::vector<uint32_t> pixels;
+    ti::cursor_image image;
+  };
+  /// scale factor -> the built-in left_ptr at that factor
+  std::unordered_map<uint32_t, builtin_cursor> builtin;
+
+  cursor_theme();
+  ~cursor_theme();
+  void resolve_dirs(const std::string &theme, int depth);
+  cursor_file *load(const std::string &name);
+  const ti::cursor_image *builtin_image(uint32_t wanted);
+};
+} // namespace ti
+
+#endif
@@ -15,6 +15,7 @@ public:
   struct wl_listener set_app_id;
 
   std::string get_title() override;
+  std::string get_app_id() override;
   void for_each_surface(wlr_surface_iterator_func_t iterator,
                         void *user_data) override;
   void activate() override;
@@ -25,6 +25,7 @@ public:
   struct wl_listener request_configure;
 
   std::string get_title() override;
+  std::string get_app_id() override;
   void for_each_surface(wlr_surface_iterator_func_t iterator,
                         void *user_data) override;
   void activate() override;
@@ -35,6 +36,10 @@ public:
 };
 } // namespace ti
 
+/** Sets up Xwayland lazily: DISPLAY is reserved right away, but the X server
+ * only starts when the first X11 client connects. */
+void xwayland_init(ti::desktop *desktop);
+
 /** Called when the surface is destroyed and should never be shown again. */
 void handle_xwayland_surface_destroy(struct wl_listener *listener, void *data);
 
@@ -0,0 +1,185 @@
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/util/log.h>
+}
+
+#include "bindings.hpp"
+
+/// locks don't change what a binding means
+static const uint32_t IGNORED_MODIFIERS = WLR_MODIFIER_CAPS | WLR_MODIFIER_MOD2;
+
+static const struct {
+  uint32_t modifiers;
+  xkb_keysym_t keysym;
+  ti::binding_action action;
+} default_bindings[] = {
+    {WLR_MODIFIER_LOGO, XKB_KEY_Escape, ti::BINDING_QUIT},
+    {WLR_MODIFIER_ALT, XKB_KEY_Tab, ti::BINDING_NEXT_VIEW},
+    {WLR_MODIFIER_ALT, XKB_KEY_F4, ti::BINDING_CLOSE_VIEW},
+    {WLR_MODIFIER_LOGO | WLR_MODIFIER_SHIFT, XKB_KEY_D,
+     ti::BINDING_DAMAGE_DEBUG},
+};
+
+static const struct {
+  const char *name;
+  uint32_t modifier;
+} modifier_names[] = {
+    {"Shift", WLR_MODIFIER_SHIFT}, {"Ctrl", WLR_MODIFIER_CTRL},
+    {"Alt", WLR_MODIFIER_ALT},     {"Mod3", WLR_MODIFIER_MOD3},
+    {"Logo", WLR_MODIFIER_LOGO},   {"Super", WLR_MODIFIER_LOGO},
+    {"Mod5", WLR_MODIFIER_MOD5},
+};
+
+static const struct {
+  const char *name;
+  ti::binding_action action;
+} action_names[] = {
+    {"none", ti::BINDING_NONE},
+    {"quit", ti::BINDING_QUIT},
+    {"chvt", ti::BINDING_CHVT},
+    {"next-view", ti::BINDING_NEXT_VIEW},
+    {"close-view", ti::BINDING_CLOSE_VIEW},
+    {"spawn", ti::BINDING_SPAWN},
+    {"damage-debug", ti::BINDING_DAMAGE_DEBUG},
+};
+
+static uint64_t binding_key(uint32_t modifiers, xkb_keysym_t keysym) {
+  return (uint64_t)(modifiers & ~IGNORED_MODIFIERS) << 32 | keysym;
+}
+
+const ti::binding *ti::bindings::find(uint32_t modifiers,
+                                      xkb_keysym_t keysym) const {
+  auto it = table.find(binding_key(modifiers, keysym));
+  return it != table.end() ? &it->second : nullptr;
+}
+
+void ti::bindings::add(uint32_t modifiers, xkb_keysym_t keysym,
+                       const ti::binding &binding) {
+  if (binding.action == ti::BINDING_NONE) {
+    table.erase(binding_key(modifiers, keysym));
+  } else {
+    table[binding_key(modifiers, keysym)] = binding;
+  }
+}
+
+/// parses "Mod+Mod+keysym", returns false if it isn't valid
+static bool parse_combo(const std::string &combo, uint32_t *modifiers,
+                        xkb_keysym_t *keysym) {
+  *modifiers = 0;
+  std::istringstream parts(combo);
+  std::string part;
+  std::string last;
+  while (std::getline(parts, part, '+')) {
+    if (!last.empty()) {
+      bool found = false;
+      for (auto &mod : modifier_names) {
+        if (last == mod.name) {
+          *modifiers |= mod.modifier;
+          found = true;
+        }
+      }
+      if (!found) {
+        return false;
+      }
+    }
+    last = part;
+  }
+
+  *keysym = xkb_keysym_from_name(last.c_str(), XKB_KEYSYM_NO_FLAGS);
+  if (*keysym == XKB_KEY_NoSymbol) {
+    *keysym = xkb_keysym_from_name(last.c_str(), XKB_KEYSYM_CASE_INSENSITIVE);
+  }
+  // with Shift held, the keyboard reports the shifted keysym: D, not d
+  if (*modifiers & WLR_MODIFIER_SHIFT) {
+    *keysym = xkb_keysym_to_upper(*keysym);
+  }
+  return *keysym != XKB_KEY_NoSymbol;
+}
+
+bool ti::bindings::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+
+  std::string line;
+  for (int lineno = 1; std::getline(file, line); ++lineno) {
+    std::istringstream words(line);
+    std::string combo, action;
+    if (!(words >> combo) || combo[0] == '#') {
+      continue;
+    }
+    words >> action;
+
+    uint32_t modifiers;
+    xkb_keysym_t keysym;
+    if (!parse_combo(combo, &modifiers, &keysym)) {
+      wlr_log(WLR_ERROR, "%s:%d: invalid key %s", path.c_str(), lineno,
+              combo.c_str());
+      continue;
+    }
+
+    ti::binding binding;
+    bool found = false;
+    for (auto &name : action_names) {
+      if (action == name.name) {
+        binding.action = name.action;
+        found = true;
+      }
+    }
+    if (!found) {
+      wlr_log(WLR_ERROR, "%s:%d: unknown action '%s'", path.c_str(), lineno,
+              action.c_str());
+      continue;
+    }
+    if (binding.action == ti::BINDING_SPAWN) {
+      std::getline(words >> std::ws, binding.command);
+      if (binding.command.empty()) {
+        wlr_log(WLR_ERROR, "%s:%d: spawn without a command", path.c_str(),
+                lineno);
+        continue;
+      }
+    }
+
+    add(modifiers, keysym, binding);
+  }
+  return true;
+}
+
+ti::bindings::bindings() {
+  for (auto &def : default_bindings) {
+    ti::binding binding;
+    binding.action = def.action;
+    add(def.modifiers, def.keysym, binding);
+  }
+  /* These are specially mapped keys, each of them composed by
+   * CTRL+ALT+fnkey1..12 */
+  for (xkb_keysym_t keysym = XKB_KEY_XF86Switch_VT_1;
+       keysym <= XKB_KEY_XF86Switch_VT_12; ++keysym) {
+    ti::binding binding;
+    binding.action = ti::BINDING_CHVT;
+    add(WLR_MODIFIER_ALT | WLR_MODIFIER_CTRL, keysym, binding);
+  }
+
+  std::string path;
+  const char *env = getenv("TI_BINDINGS");
+  const char *xdg_config = getenv("XDG_CONFIG_HOME");
+  const char *home = getenv("HOME");
+  if (env != nullptr) {
+    path = env;
+  } else if (xdg_config != nullptr && *xdg_config != '\0') {
+    path = std::string(xdg_config) + "/theinterface/bindings";
+  } else if (home != nullptr) {
+    path = std::string(home) + "/.config/theinterface/bindings";
+  }
+
+  if (!path.empty() && load(path)) {
+    wlr_log(WLR_INFO, "Loaded keybindings from %s", path.c_str());
+  } else if (env != nullptr) {
+    wlr_log(WLR_ERROR, "Can't read keybindings from %s", env);
+  }
+}
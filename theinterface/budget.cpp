@@ -0,0 +1,184 @@
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+extern "C" {
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+}
+
+#include "clients.hpp"
+#include "desktop.hpp"
+#include "output.hpp"
+#include "seat.hpp"
+#include "view.hpp"
+#include "xwayland.hpp"
+
+#include "budget.hpp"
+
+/// refresh intervals over budget in a row before a view is flagged
+#define BUDGET_FLAG_STRIKES 60
+#define BUDGET_DEFAULT_INTERVAL_NSEC (1000000000 / 60)
+
+static int64_t now_nsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int64_t refresh_interval(ti::view *view) {
+  ti::output *output = view->primary_output;
+  int32_t refresh = output != nullptr ? output->wlr_output->refresh : 0;
+  return refresh > 0 ? 1000000000000 / refresh : BUDGET_DEFAULT_INTERVAL_NSEC;
+}
+
+static std::string describe(ti::view *view, ti::client_stats *stats) {
+#ifdef WLR_HAS_XWAYLAND
+  if (view->type == ti::XWAYLAND_VIEW) {
+    return "X11 window \"" + view->title + "\"";
+  }
+#endif
+  return "\"" + view->title + "\" of " + stats->name + " (pid " +
+         std::to_string(stats->pid) + ")";
+}
+
+ti::commit_budget::commit_budget(ti::desktop *desktop) {
+  this->desktop = desktop;
+  // "commits[,damage]"
+  const char *env = getenv("TI_COMMIT_BUDGET");
+  if (env != nullptr) {
+    char *end;
+    max_commits = strtoul(env, &end, 10);
+    if (*end == ',') {
+      max_damage = strtof(end + 1, nullptr);
+    }
+  }
+  if (max_commits == 0) {
+    wlr_log(WLR_INFO, "Commit budget off");
+  }
+}
+
+bool ti::commit_budget::exempt(ti::view *view) {
+  ti::view *focused = desktop->seat->focused_view;
+  if (focused == nullptr || focused->surface == nullptr) {
+    return false;
+  }
+  if (focused == view) {
+    return true;
+  }
+#ifdef WLR_HAS_XWAYLAND
+  if (view->type == ti::XWAYLAND_VIEW) {
+    return false;
+  }
+#endif
+  return wl_resource_get_client(focused->surface->resource) ==
+         wl_resource_get_client(view->surface->resource);
+}
+
+void ti::commit_budget::roll(ti::budget_state *state, ti::view *view,
+                             ti::client_stats *stats, int64_t now) {
+  if (now - state->window_start < refresh_interval(view)) {
+    return;
+  }
+  if (state->over && !exempt(view)) {
+    ++state->strikes;
+    if (!state->flagged && state->strikes >= BUDGET_FLAG_STRIKES) {
+      state->flagged = true;
+      wlr_log(WLR_INFO,
+              "%s is over its commit budget for %u refresh intervals in a "
+              "row, the last with %u commits",
+              describe(view, stats).c_str(), state->strikes, state->commits);
+    }
+  } else if (state->commits > 0) {
+    if (state->flagged) {
+      wlr_log(WLR_INFO, "%s is within its commit budget again",
+              describe(view, stats).c_str());
+    }
+    state->strikes = 0;
+    state->flagged = false;
+  }
+  state->window_start = now;
+  state->commits = 0;
+  state->damaged_pixels = 0;
+  state->over = false;
+}
+
+bool ti::commit_budget::commit(ti::view *view) {
+  if (max_commits == 0 || view->surface == nullptr) {
+    return true;
+  }
+  ti::client_stats *stats = desktop->clients->from_surface(view->surface);
+  if (stats == nullptr) {
+    return true;
+  }
+  ti::budget_state *state = &view->budget;
+  roll(state, view, stats, now_nsec());
+
+  ++state->commits;
+  // the bounding box: this is about the cost of damage, not its exact area
+  pixman_box32_t *extents =
+      pixman_region32_extents(&view->surface->buffer_damage);
+  state->damaged_pixels +=
+      (uint64_t)(extents->x2 - extents->x1) * (extents->y2 - extents->y1);
+  if (!state->over) {
+    ti::output *output = view->primary_output;
+    uint64_t area = output != nullptr ? (uint64_t)output->wlr_output->width *
+                                            output->wlr_output->height
+                                      : 1920 * 1080;
+    state->over = state->commits > max_commits ||
+                  state->damaged_pixels > max_damage * area;
+  }
+  if (!state->over || exempt(view)) {
+    return true;
+  }
+
+  ++stats->throttled_commits.total;
+  if (!view->damage_deferred) {
+    view->damage_deferred = true;
+    ++deferred;
+    ti::output *output;
+    wl_list_for_each(output, &desktop->outputs, link) {
+      if (view->primary_output == nullptr || view->primary_output == output) {
+        wlr_output_schedule_frame(output->wlr_output);
+      }
+    }
+  }
+  return false;
+}
+
+void ti::commit_budget::frame() {
+  if (deferred == 0) {
+    return;
+  }
+  ti::view *view;
+  wl_list_for_each(view, &desktop->views, link) {
+    if (view->damage_deferred) {
+      view->damage_deferred = false;
+      if (view->mapped) {
+        view->damage_whole();
+      }
+    }
+  }
+  deferred = 0;
+}
+
+bool ti::commit_budget::hold_frame_done(ti::view *view, ti::output *output) {
+  if (max_commits == 0 || view->surface == nullptr) {
+    return false;
+  }
+  ti::client_stats *stats = desktop->clients->from_surface(view->surface);
+  if (stats == nullptr) {
+    return false;
+  }
+  ti::budget_state *state = &view->budget;
+  if (!state->over) {
+    return false;
+  }
+  roll(state, view, stats, now_nsec());
+  if (!state->over || exempt(view)) {
+    return false;
+  }
+  // held until a frame after the window ends
+  wlr_output_schedule_frame(output->wlr_output);
+  return true;
+}
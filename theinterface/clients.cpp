@@ -0,0 +1,232 @@
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_xdg_shell.h>
+}
+
+#include "desktop.hpp"
+#include "record.hpp"
+#include "toplevel_capture.hpp"
+#include "xwayland.hpp"
+
+#include "clients.hpp"
+
+static void release_stats(ti::client_stats *stats) {
+  if (stats->destroyed && stats->surfaces == 0) {
+    delete stats;
+  }
+}
+
+static void handle_client_destroy(struct wl_listener *listener, void *data) {
+  ti::client_stats *stats = wl_container_of(listener, stats, destroy);
+  wl_list_remove(&stats->destroy.link);
+  // the pointer can be reused by the next client
+  stats->tracker->clients.erase(stats->client);
+  // the client's surfaces are destroyed after this
+  stats->destroyed = true;
+  release_stats(stats);
+}
+
+static uint64_t region_pixels(pixman_region32_t *region) {
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+  uint64_t pixels = 0;
+  for (int i = 0; i < nrects; ++i) {
+    pixels +=
+        (uint64_t)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+  }
+  return pixels;
+}
+
+/** Whether surface is part of a view: a toplevel, a popup or a subsurface.
+ * Cursor and drag icon surfaces aren't sampled like those, the hardware
+ * cursor plane shows them without any output rendering them. */
+static bool is_view_surface(struct wlr_surface *surface) {
+  if (wlr_surface_is_xdg_surface(surface) ||
+      wlr_surface_is_subsurface(surface)) {
+    return true;
+  }
+#ifdef WLR_HAS_XWAYLAND
+  if (wlr_surface_is_xwayland_surface(surface)) {
+    return true;
+  }
+#endif
+  return false;
+}
+
+static void handle_surface_commit(struct wl_listener *listener, void *data) {
+  ti::client_surface *surface = wl_container_of(listener, surface, commit);
+  ti::client_stats *stats = surface->stats;
+  struct wlr_surface *wlr_surface = surface->wlr_surface;
+  ++stats->commits.total;
+  // any surface of a view, not only its toplevel, can change a capture
+  stats->tracker->desktop->toplevel_capture->surface_committed(wlr_surface);
+  if (!(wlr_surface->current.committed & WLR_SURFACE_STATE_BUFFER)) {
+    return;
+  }
+  stats->damaged_pixels.total += region_pixels(&wlr_surface->buffer_damage);
+  if (surface->has_buffer && !surface->sampled &&
+      is_view_surface(wlr_surface)) {
+    ++stats->wasted_commits.total;
+  }
+  surface->sampled = false;
+
+  // the sizes only change with the buffer
+  uint64_t shm_bytes = 0, texture_bytes = 0;
+  struct wlr_buffer *buffer = wlr_surface->buffer;
+  surface->has_buffer = buffer != nullptr;
+  if (buffer != nullptr && buffer->resource != nullptr) {
+    struct wl_shm_buffer *shm = wl_shm_buffer_get(buffer->resource);
+    if (shm != nullptr) {
+      shm_bytes = (uint64_t)wl_shm_buffer_get_stride(shm) *
+                  wl_shm_buffer_get_height(shm);
+    }
+  }
+  if (buffer != nullptr && buffer->texture != nullptr) {
+    int width, height;
+    wlr_texture_get_size(buffer->texture, &width, &height);
+    // textures are 32 bit per pixel, whatever the format of the buffer
+    texture_bytes = (uint64_t)width * height * 4;
+  }
+  stats->shm_bytes += shm_bytes - surface->shm_bytes;
+  stats->texture_bytes += texture_bytes - surface->texture_bytes;
+  surface->shm_bytes = shm_bytes;
+  surface->texture_bytes = texture_bytes;
+
+  ti::recorder *recorder = stats->tracker->desktop->recorder;
+  if (recorder != nullptr) {
+    recorder->commit(wlr_surface, stats);
+  }
+}
+
+static void handle_surface_destroy(struct wl_listener *listener, void *data) {
+  ti::client_surface *surface = wl_container_of(listener, surface, destroy);
+  wl_list_remove(&surface->commit.link);
+  wl_list_remove(&surface->destroy.link);
+  wl_list_remove(&surface->link);
+  surface->stats->shm_bytes -= surface->shm_bytes;
+  surface->stats->texture_bytes -= surface->texture_bytes;
+  --surface->stats->surfaces;
+  release_stats(surface->stats);
+  delete surface;
+}
+
+/// the client_surface of surface, found through its destroy listener
+static ti::client_surface *client_surface_from(struct wlr_surface *surface) {
+  struct wl_listener *listener =
+      wl_signal_get(&surface->events.destroy, handle_surface_destroy);
+  if (listener == nullptr) {
+    return nullptr;
+  }
+  ti::client_surface *client_surface =
+      wl_container_of(listener, client_surface, destroy);
+  return client_surface;
+}
+
+static void handle_new_surface(struct wl_listener *listener, void *data) {
+  ti::client_tracker *tracker =
+      wl_container_of(listener, tracker, new_surface);
+  auto *wlr_surface = reinterpret_cast<struct wlr_surface *>(data);
+
+  auto *surface = new ti::client_surface;
+  surface->wlr_surface = wlr_surface;
+  surface->stats =
+      tracker->get(wl_resource_get_client(wlr_surface->resource));
+  ++surface->stats->surfaces;
+  wl_list_insert(&tracker->surfaces, &surface->link);
+  surface->commit.notify = handle_surface_commit;
+  wl_signal_add(&wlr_surface->events.commit, &surface->commit);
+  surface->destroy.notify = handle_surface_destroy;
+  wl_signal_add(&wlr_surface->events.destroy, &surface->destroy);
+}
+
+ti::client_tracker::client_tracker(ti::desktop *desktop) {
+  this->desktop = desktop;
+  wl_list_init(&surfaces);
+  new_surface.notify = handle_new_surface;
+  wl_signal_add(&desktop->compositor->events.new_surface, &new_surface);
+}
+
+ti::client_tracker::~client_tracker() {
+  wl_list_remove(&new_surface.link);
+  ti::client_surface *surface, *tmp;
+  wl_list_for_each_safe(surface, tmp, &surfaces, link) {
+    wl_list_remove(&surface->commit.link);
+    wl_list_remove(&surface->destroy.link);
+    --surface->stats->surfaces;
+    release_stats(surface->stats);
+    delete surface;
+  }
+  for (auto &entry : clients) {
+    wl_list_remove(&entry.second->destroy.link);
+    delete entry.second;
+  }
+}
+
+ti::client_stats *ti::client_tracker::get(struct wl_client *client) {
+  auto it = clients.find(client);
+  if (it != clients.end()) {
+    return it->second;
+  }
+
+  auto *stats = new ti::client_stats;
+  stats->tracker = this;
+  stats->client = client;
+  gid_t gid;
+  wl_client_get_credentials(client, &stats->pid, &stats->uid, &gid);
+
+  char path[64], name[64] = "";
+  snprintf(path, sizeof(path), "/proc/%d/comm", stats->pid);
+  if (FILE *comm = fopen(path, "re")) {
+    if (fgets(name, sizeof(name), comm) != nullptr) {
+      name[strcspn(name, "\n")] = '\0';
+    }
+    fclose(comm);
+  }
+  stats->name = name;
+
+  stats->destroy.notify = handle_client_destroy;
+  wl_client_add_destroy_listener(client, &stats->destroy);
+  clients[client] = stats;
+  return stats;
+}
+
+ti::client_stats *
+ti::client_tracker::from_surface(struct wlr_surface *surface) {
+  ti::client_surface *client_surface = client_surface_from(surface);
+  return client_surface != nullptr ? client_surface->stats : nullptr;
+}
+
+void ti::client_tracker::surface_sampled(struct wlr_surface *surface) {
+  ti::client_surface *client_surface = client_surface_from(surface);
+  if (client_surface != nullptr) {
+    client_surface->sampled = true;
+  }
+}
+
+void ti::client_tracker::frame_done(struct wlr_surface *surface) {
+  if (wl_list_empty(&surface->current.frame_callback_list)) {
+    return;
+  }
+  ti::client_surface *client_surface = client_surface_from(surface);
+  if (client_surface != nullptr) {
+    client_surface->stats->frame_callbacks.total +=
+        wl_list_length(&surface->current.frame_callback_list);
+  }
+}
+
+void ti::client_tracker::tick() {
+  for (auto &entry : clients) {
+    ti::client_stats *stats = entry.second;
+    stats->commits.tick();
+    stats->damaged_pixels.tick();
+    stats->wasted_commits.tick();
+    stats->frame_callbacks.tick();
+    stats->throttled_commits.tick();
+  }
+}
@@ -0,0 +1,149 @@
+#include <cmath>
+
+extern "C" {
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_pointer_constraints_v1.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/region.h>
+}
+
+#include "desktop.hpp"
+#include "seat.hpp"
+#include "server.hpp"
+#include "view.hpp"
+
+#include "constraints.hpp"
+
+static void handle_constraint_destroy(struct wl_listener *listener,
+                                      void *data) {
+  ti::pointer_constraint *constraint =
+      wl_container_of(listener, constraint, destroy);
+  ti::pointer_constraints *constraints = constraint->constraints;
+  if (constraints->active == constraint) {
+    constraints->active = nullptr;
+  }
+  wl_list_remove(&constraint->destroy.link);
+  constraint->wlr_constraint->data = nullptr;
+  delete constraint;
+  /* A oneshot constraint is destroyed while update() deactivates it, which
+   * then goes on with the constraint to activate: running it again here
+   * would send the activation twice. */
+  if (!constraints->updating) {
+    constraints->update(constraints->desktop->seat);
+  }
+}
+
+static void handle_new_constraint(struct wl_listener *listener, void *data) {
+  ti::pointer_constraints *constraints =
+      wl_container_of(listener, constraints, new_constraint);
+  auto *wlr_constraint =
+      reinterpret_cast<struct wlr_pointer_constraint_v1 *>(data);
+
+  auto *constraint = new ti::pointer_constraint;
+  constraint->constraints = constraints;
+  constraint->wlr_constraint = wlr_constraint;
+  wlr_constraint->data = constraint;
+  constraint->destroy.notify = handle_constraint_destroy;
+  wl_signal_add(&wlr_constraint->events.destroy, &constraint->destroy);
+
+  constraints->update(constraints->desktop->seat);
+}
+
+ti::pointer_constraints::pointer_constraints(ti::desktop *desktop) {
+  this->desktop = desktop;
+  struct wl_display *display = desktop->server->display;
+  relative_pointer_manager = wlr_relative_pointer_manager_v1_create(display);
+  wlr_constraints = wlr_pointer_constraints_v1_create(display);
+  new_constraint.notify = handle_new_constraint;
+  wl_signal_add(&wlr_constraints->events.new_constraint, &new_constraint);
+}
+
+ti::pointer_constraints::~pointer_constraints() {
+  wl_list_remove(&new_constraint.link);
+}
+
+bool ti::pointer_constraints::motion(ti::seat *seat, uint32_t time_msec,
+                                     double dx, double dy, double dx_unaccel,
+                                     double dy_unaccel) {
+  if (seat->cursor_mode != ti::CURSOR_PASSTHROUGH) {
+    return false;
+  }
+  wlr_relative_pointer_manager_v1_send_relative_motion(
+      relative_pointer_manager, seat->wlr_seat, (uint64_t)time_msec * 1000,
+      dx, dy, dx_unaccel, dy_unaccel);
+  if (active == nullptr) {
+    return false;
+  }
+
+  struct wlr_pointer_constraint_v1 *wlr_constraint = active->wlr_constraint;
+  if (wlr_constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED) {
+    return true;
+  }
+  double sx = seat->cursor->x - active->view->box.x;
+  double sy = seat->cursor->y - active->view->box.y;
+  double confined_x, confined_y;
+  if (wlr_region_confine(&wlr_constraint->region, sx, sy, sx + dx, sy + dy,
+                         &confined_x, &confined_y)) {
+    wlr_cursor_move(seat->cursor, nullptr, confined_x - sx, confined_y - sy);
+    wlr_seat_pointer_notify_motion(seat->wlr_seat, time_msec, confined_x,
+                                   confined_y);
+  }
+  return true;
+}
+
+void ti::pointer_constraints::update(ti::seat *seat) {
+  ti::view *view = seat->focused_view;
+  struct wlr_pointer_constraint_v1 *wlr_constraint =
+      view != nullptr && view->mapped && view->surface != nullptr
+          ? wlr_pointer_constraints_v1_constraint_for_surface(
+                wlr_constraints, view->surface, seat->wlr_seat)
+          : nullptr;
+  auto *constraint =
+      wlr_constraint != nullptr
+          ? reinterpret_cast<ti::pointer_constraint *>(wlr_constraint->data)
+          : nullptr;
+  pending = false;
+  if (constraint == active) {
+    return;
+  }
+  if (active != nullptr) {
+    updating = true;
+    deactivate(seat);
+    updating = false;
+  }
+  if (constraint == nullptr) {
+    return;
+  }
+
+  double sx = seat->cursor->x - view->box.x;
+  double sy = seat->cursor->y - view->box.y;
+  if (!pixman_region32_contains_point(&wlr_constraint->region, floor(sx),
+                                      floor(sy), nullptr)) {
+    // checked again as the cursor moves
+    pending = true;
+    return;
+  }
+  constraint->view = view;
+  active = constraint;
+  wlr_seat_pointer_notify_enter(seat->wlr_seat, view->surface, sx, sy);
+  wlr_pointer_constraint_v1_send_activated(wlr_constraint);
+}
+
+void ti::pointer_constraints::deactivate(ti::seat *seat) {
+  ti::pointer_constraint *constraint = active;
+  struct wlr_pointer_constraint_v1 *wlr_constraint =
+      constraint->wlr_constraint;
+  // a oneshot constraint is destroyed by the deactivation
+  active = nullptr;
+  if (wlr_constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED &&
+      (wlr_constraint->current.committed &
+       WLR_POINTER_CONSTRAINT_V1_STATE_CURSOR_HINT)) {
+    wlr_cursor_warp(seat->cursor, nullptr,
+                    constraint->view->box.x +
+                        wlr_constraint->current.cursor_hint.x,
+                    constraint->view->box.y +
+                        wlr_constraint->current.cursor_hint.y);
+  }
+  wlr_pointer_constraint_v1_send_deactivated(wlr_constraint);
+}
@@ -1,10 +1,18 @@
+#include <linux/input-event-codes.h>
+
 extern "C" {
-#include <wlr/types/wlr_xcursor_manager.h>
+#include <wlr/types/wlr_virtual_keyboard_v1.h>
+#include <wlr/types/wlr_virtual_pointer_v1.h>
 #include <wlr/util/log.h>
+#include <wlr/xcursor.h>
 }
 
+#include "constraints.hpp"
 #include "desktop.hpp"
+#include "idle.hpp"
 #include "keyboard.hpp"
+#include "latency.hpp"
+#include "record.hpp"
 #include "seat.hpp"
 #include "server.hpp"
 #include "xdg_shell.hpp"
@@ -33,14 +41,30 @@ void handle_new_input(struct wl_listener *listener, void *data) {
   default:
     break;
   }
-  /* We need to let the wlr_seat know what our capabilities are, which is
-   * communiciated to the client. In TinyWL we always have a cursor, even if
-   * there are no pointer devices, so we always include that capability. */
-  unsigned caps = WL_SEAT_CAPABILITY_POINTER;
-  if (!wl_list_empty(&desktop->seat->keyboards)) {
-    caps |= WL_SEAT_CAPABILITY_KEYBOARD;
+  seat->update_capabilities();
+}
+
+void handle_new_virtual_pointer(struct wl_listener *listener, void *data) {
+  ti::seat *seat = wl_container_of(listener, seat, new_virtual_pointer);
+  auto *event =
+      reinterpret_cast<struct wlr_virtual_pointer_v1_new_pointer_event *>(
+          data);
+  struct wlr_input_device *device = &event->new_pointer->input_device;
+  wlr_log(WLR_DEBUG, "New virtual pointer");
+  seat->new_pointer(device);
+  if (event->suggested_output != nullptr) {
+    wlr_cursor_map_input_to_output(seat->cursor, device,
+                                   event->suggested_output);
   }
-  wlr_seat_set_capabilities(desktop->seat->wlr_seat, caps);
+  seat->update_capabilities();
+}
+
+void handle_new_virtual_keyboard(struct wl_listener *listener, void *data) {
+  ti::seat *seat = wl_container_of(listener, seat, new_virtual_keyboard);
+  auto *keyboard = reinterpret_cast<struct wlr_virtual_keyboard_v1 *>(data);
+  wlr_log(WLR_DEBUG, "New virtual keyboard");
+  seat->new_virtual_keyboard(&keyboard->input_device);
+  seat->update_capabilities();
 }
 
 /* Move the grabbed view to the new position. */
@@ -49,6 +73,7 @@ static void process_cursor_move(ti::seat *seat, unsigned time) {
   seat->grabbed_view->box.x = seat->cursor->x - seat->grab_x;
   seat->grabbed_view->box.y = seat->cursor->y - seat->grab_y;
   seat->grabbed_view->damage_whole();
+  seat->grabbed_view->update_primary_output();
 }
 
 /** Resizing the grabbed view can be a little bit complicated, because we
@@ -104,6 +129,7 @@ static void process_cursor_resize(ti::seat *seat, unsigned time) {
   }
   }
   view->damage_whole();
+  view->update_primary_output();
 }
 
 static void process_cursor_motion(ti::seat *seat, unsigned time) {
@@ -125,12 +151,22 @@ static void process_cursor_motion(ti::seat *seat, unsigned time) {
     /* If there's no view under the cursor, set the cursor image to a
      * default. This is what makes the cursor image appear when you move it
      * around the screen, not over any views. */
-    wlr_xcursor_manager_set_cursor_image(seat->cursor_mgr, "left_ptr",
-                                         seat->cursor);
+    seat->set_cursor("left_ptr");
+  } else if (!surface) {
+    // over the decorations: the border shows where a drag resizes from
+    unsigned edges = WLR_EDGE_NONE;
+    view->decoration_at(seat->cursor->x, seat->cursor->y, &edges);
+    seat->set_cursor(edges != WLR_EDGE_NONE
+                         ? wlr_xcursor_get_resize_name((enum wlr_edges)edges)
+                         : "left_ptr");
   }
   if (surface) {
     bool focus_changed =
         seat->wlr_seat->pointer_state.focused_surface != surface;
+    if (focus_changed || seat->desktop->constraints->pending) {
+      // may activate a constraint of the surface entered
+      seat->desktop->constraints->update(seat);
+    }
     /*
      * "Enter" the surface if necessary. This lets the client know that the
      * cursor has entered one of its surfaces.
@@ -152,33 +188,82 @@ static void process_cursor_motion(ti::seat *seat, unsigned time) {
   }
 }
 
+/** Follows a pointer event for the latency stats: to the client with pointer
+ * focus, or to the compositor while it moves or resizes a view. Motion over
+ * no surface only moves the cursor, which takes no frame. */
+static void track_pointer_latency(ti::seat *seat, ti::input_type type,
+                                  uint32_t time_msec) {
+  struct wlr_surface *surface = seat->wlr_seat->pointer_state.focused_surface;
+  if (seat->cursor_mode != ti::CURSOR_PASSTHROUGH) {
+    surface = nullptr;
+  } else if (surface == nullptr && type == ti::INPUT_MOTION) {
+    return;
+  }
+  seat->desktop->latency->input(type, time_msec, surface);
+}
+
 void handle_cursor_motion(struct wl_listener *listener, void *data) {
   ti::seat *seat = wl_container_of(listener, seat, cursor_motion);
+  seat->desktop->idle->notify_activity(seat);
   struct wlr_event_pointer_motion *event =
       (struct wlr_event_pointer_motion *)data;
+  if (seat->desktop->recorder != nullptr) {
+    seat->desktop->recorder->motion(event);
+  }
   /* The cursor doesn't move unless we tell it to. The cursor automatically
    * handles constraining the motion to the output layout, as well as any
    * special configuration applied for the specific input device which
    * generated the event. You can pass NULL for the device if you want to move
    * the cursor around without any input. */
+  if (seat->desktop->constraints->motion(seat, event->time_msec,
+                                         event->delta_x, event->delta_y,
+                                         event->unaccel_dx,
+                                         event->unaccel_dy)) {
+    track_pointer_latency(seat, ti::INPUT_MOTION, event->time_msec);
+    return;
+  }
   wlr_cursor_move(seat->cursor, event->device, event->delta_x, event->delta_y);
   process_cursor_motion(seat, event->time_msec);
+  track_pointer_latency(seat, ti::INPUT_MOTION, event->time_msec);
 }
 
 void handle_cursor_motion_absolute(struct wl_listener *listener, void *data) {
   ti::seat *seat = wl_container_of(listener, seat, cursor_motion_absolute);
+  seat->desktop->idle->notify_activity(seat);
   struct wlr_event_pointer_motion_absolute *event =
       (struct wlr_event_pointer_motion_absolute *)data;
-  wlr_cursor_warp_absolute(seat->cursor, event->device, event->x, event->y);
+  if (seat->desktop->recorder != nullptr) {
+    seat->desktop->recorder->motion_absolute(event);
+  }
+  double lx, ly;
+  wlr_cursor_absolute_to_layout_coords(seat->cursor, event->device, event->x,
+                                       event->y, &lx, &ly);
+  double dx = lx - seat->cursor->x, dy = ly - seat->cursor->y;
+  if (seat->desktop->constraints->motion(seat, event->time_msec, dx, dy, dx,
+                                         dy)) {
+    track_pointer_latency(seat, ti::INPUT_MOTION, event->time_msec);
+    return;
+  }
+  wlr_cursor_warp_closest(seat->cursor, event->device, lx, ly);
   process_cursor_motion(seat, event->time_msec);
+  track_pointer_latency(seat, ti::INPUT_MOTION, event->time_msec);
 }
 
 void handle_cursor_button(struct wl_listener *listener, void *data) {
   ti::seat *seat = wl_container_of(listener, seat, cursor_button);
+  seat->desktop->idle->notify_activity(seat);
   auto *event = reinterpret_cast<struct wlr_event_pointer_button *>(data);
+  if (seat->desktop->recorder != nullptr) {
+    seat->desktop->recorder->button(event);
+  }
   /* Notify the client with pointer focus that a button press has occurred */
   wlr_seat_pointer_notify_button(seat->wlr_seat, event->time_msec,
                                  event->button, event->state);
+  track_pointer_latency(seat, ti::INPUT_BUTTON, event->time_msec);
+  if (seat->desktop->constraints->active != nullptr) {
+    // the focus stays with the constrained surface
+    return;
+  }
   double sx, sy;
   struct wlr_surface *surface = NULL;
   ti::view *view = seat->desktop->view_at(seat->cursor->x, seat->cursor->y,
@@ -193,20 +278,37 @@ void handle_cursor_button(struct wl_listener *listener, void *data) {
     }
     // focus view when you click on it
     seat->focus(view);
+    /* Dragging the decorations starts right away, without waiting for a
+     * request of the client. */
+    unsigned edges;
+    if (surface == NULL && event->button == BTN_LEFT &&
+        view->decoration_at(seat->cursor->x, seat->cursor->y, &edges)) {
+      view->begin_interactive(edges != WLR_EDGE_NONE ? ti::CURSOR_RESIZE
+                                                     : ti::CURSOR_MOVE,
+                              edges, false);
+    }
   }
 }
 
 void handle_cursor_axis(struct wl_listener *listener, void *data) {
   ti::seat *seat = wl_container_of(listener, seat, cursor_axis);
+  seat->desktop->idle->notify_activity(seat);
   struct wlr_event_pointer_axis *event = (struct wlr_event_pointer_axis *)data;
+  if (seat->desktop->recorder != nullptr) {
+    seat->desktop->recorder->axis(event);
+  }
   /* Notify the client with pointer focus of the axis event. */
   wlr_seat_pointer_notify_axis(seat->wlr_seat, event->time_msec,
                                event->orientation, event->delta,
                                event->delta_discrete, event->source);
+  track_pointer_latency(seat, ti::INPUT_AXIS, event->time_msec);
 }
 
 void handle_cursor_frame(struct wl_listener *listener, void *data) {
   ti::seat *seat = wl_container_of(listener, seat, cursor_frame);
+  if (seat->desktop->recorder != nullptr) {
+    seat->desktop->recorder->pointer_frame();
+  }
   /* Notify the client with pointer focus of the frame event. */
   wlr_seat_pointer_notify_frame(seat->wlr_seat);
 }
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cairo.h>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
+#include <wlr/util/log.h>
+#define static
+#include <wlr/render/wlr_renderer.h>
+#undef static
+}
+
+#include "desktop.hpp"
+#include "output.hpp"
+#include "render.hpp"
+#include "server.hpp"
+
+#include "damage_overlay.hpp"
+
+/// a frame's damage stays visible for this many frames
+#define DAMAGE_OVERLAY_FRAMES 4
+#define DAMAGE_OVERLAY_OUTLINE 2
+/// in logical pixels
+#define DAMAGE_OVERLAY_PANEL_WIDTH 340
+#define DAMAGE_OVERLAY_PANEL_HEIGHT 58
+#define DAMAGE_OVERLAY_PANEL_MARGIN 8
+
+bool ti::damage_stats::add_frame(pixman_region32_t *damage, int width,
+                                 int height, int64_t now_msec) {
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+  uint64_t pixels = 0;
+  for (int i = 0; i < nrects; ++i) {
+    pixels +=
+        (uint64_t)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+  }
+  uint64_t area = std::max(1, width * height);
+  // frames without any are the overlay fading out, or a buffer swap
+  if (pixels == 0) {
+    return false;
+  }
+
+  ++frames;
+  damaged_pixels += pixels;
+  last_pixels = pixels;
+  last_rects = nrects;
+  last_percent = 100.0f * pixels / area;
+
+  bool new_second = now_msec / 1000 != second;
+  if (new_second) {
+    fps = second_frames;
+    avg_percent =
+        second_frames ? 100.0f * second_pixels / (area * second_frames) : 0;
+    max_percent = second_max_percent;
+    avg_rects = second_frames ? (float)second_rects / second_frames : 0;
+
+    second = now_msec / 1000;
+    second_frames = 0;
+    second_pixels = 0;
+    second_rects = 0;
+    second_max_percent = 0;
+  }
+  ++second_frames;
+  second_pixels += pixels;
+  second_rects += nrects;
+  second_max_percent = std::max(second_max_percent, last_percent);
+  return new_second;
+}
+
+ti::damage_overlay::damage_overlay(ti::output *output) {
+  this->output = output;
+  update_panel();
+}
+
+ti::damage_overlay::~damage_overlay() {
+  for (frame *f : frames) {
+    pixman_region32_fini(&f->damage);
+    delete f;
+  }
+  if (panel != nullptr) {
+    wlr_texture_destroy(panel);
+  }
+}
+
+/// the four edges of an outline around box
+static void outline_edges(const struct wlr_box &box, struct wlr_box edges[4]) {
+  int w = DAMAGE_OVERLAY_OUTLINE;
+  edges[0] = {box.x, box.y, box.width, w};
+  edges[1] = {box.x, box.y + box.height - w, box.width, w};
+  edges[2] = {box.x, box.y, w, box.height};
+  edges[3] = {box.x + box.width - w, box.y, w, box.height};
+}
+
+void ti::damage_overlay::begin_frame(pixman_region32_t *scene_damage) {
+  this->scene_damage = scene_damage;
+  struct wlr_output_damage *damage = output->damage;
+  for (frame *f : frames) {
+    wlr_output_damage_add(damage, &f->damage);
+    // only the outlines, the surfaces inside them didn't change
+    for (struct wlr_box &box : f->surfaces) {
+      struct wlr_box edges[4];
+      outline_edges(box, edges);
+      for (struct wlr_box &edge : edges) {
+        wlr_output_damage_add_box(damage, &edge);
+      }
+    }
+    ++f->age;
+  }
+  while (!frames.empty() && frames.front()->age >= DAMAGE_OVERLAY_FRAMES) {
+    pixman_region32_fini(&frames.front()->damage);
+    delete frames.front();
+    frames.pop_front();
+  }
+  if (panel_dirty) {
+    wlr_output_damage_add_box(damage, &panel_box);
+    panel_dirty = false;
+  }
+}
+
+void ti::damage_overlay::surface_rendered(const struct wlr_box &box) {
+  pixman_box32_t rect = {box.x, box.y, box.x + box.width, box.y + box.height};
+  if (scene_damage != nullptr &&
+      pixman_region32_contains_rectangle(scene_damage, &rect) ==
+          PIXMAN_REGION_OUT) {
+    return;
+  }
+  surfaces.push_back(box);
+}
+
+/// fills the part of box inside clip
+static void render_clipped_rect(struct wlr_renderer *renderer,
+                                struct wlr_output *wlr_output,
+                                const struct wlr_box &box, const float color[4],
+                                pixman_region32_t *clip) {
+  pixman_region32_t region;
+  pixman_region32_init_rect(&region, box.x, box.y, box.width, box.height);
+  pixman_region32_intersect(&region, &region, clip);
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+  for (int i = 0; i < nrects; ++i) {
+    struct wlr_box rect = {
+        .x = rects[i].x1,
+        .y = rects[i].y1,
+        .width = rects[i].x2 - rects[i].x1,
+        .height = rects[i].y2 - rects[i].y1,
+    };
+    wlr_render_rect(renderer, &rect, color, wlr_output->transform_matrix);
+  }
+  pixman_region32_fini(&region);
+}
+
+void ti::damage_overlay::render(pixman_region32_t *scene_damage,
+                                pixman_region32_t *buffer_damage) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = output->desktop->server->renderer;
+
+  auto *current = new frame;
+  pixman_region32_init(&current->damage);
+  pixman_region32_copy(&current->damage, scene_damage);
+  current->surfaces.swap(surfaces);
+  frames.push_back(current);
+  this->scene_damage = nullptr;
+
+  wlr_renderer_scissor(renderer, NULL);
+  int nrects;
+  for (frame *f : frames) {
+    // colors are premultiplied
+    float fade =
+        (float)(DAMAGE_OVERLAY_FRAMES - f->age) / DAMAGE_OVERLAY_FRAMES;
+    float tint[4] = {0.4f * fade, 0, 0.2f * fade, 0.4f * fade};
+    float outline[4] = {0, 0.8f * fade, 0, 0.8f * fade};
+
+    pixman_box32_t *rects = pixman_region32_rectangles(&f->damage, &nrects);
+    for (int i = 0; i < nrects; ++i) {
+      struct wlr_box box = {
+          .x = rects[i].x1,
+          .y = rects[i].y1,
+          .width = rects[i].x2 - rects[i].x1,
+          .height = rects[i].y2 - rects[i].y1,
+      };
+      render_clipped_rect(renderer, wlr_output, box, tint, buffer_damage);
+    }
+
+    for (struct wlr_box &box : f->surfaces) {
+      struct wlr_box edges[4];
+      outline_edges(box, edges);
+      for (struct wlr_box &edge : edges) {
+        render_clipped_rect(renderer, wlr_output, edge, outline, buffer_damage);
+      }
+    }
+  }
+
+  if (panel == nullptr) {
+    return;
+  }
+  pixman_region32_t region;
+  pixman_region32_init_rect(&region, panel_box.x, panel_box.y,
+                            panel_box.width, panel_box.height);
+  pixman_region32_intersect(&region, &region, buffer_damage);
+  pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+  for (int i = 0; i < nrects; ++i) {
+    scissor_output(wlr_output, &rects[i]);
+    wlr_render_texture(renderer, panel, wlr_output->transform_matrix,
+                       panel_box.x, panel_box.y, 1.0);
+  }
+  wlr_renderer_scissor(renderer, NULL);
+  pixman_region32_fini(&region);
+}
+
+void ti::damage_overlay::update_panel() {
+  struct wlr_output *wlr_output = output->wlr_output;
+  const ti::damage_stats &stats = output->damage_stats;
+  float scale = wlr_output->scale;
+  int width = DAMAGE_OVERLAY_PANEL_WIDTH * scale;
+  int height = DAMAGE_OVERLAY_PANEL_HEIGHT * scale;
+
+  cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *cairo = cairo_create(surface);
+  cairo_scale(cairo, scale, scale);
+  cairo_set_source_rgba(cairo, 0, 0, 0, 0.75);
+  cairo_paint(cairo);
+
+  char lines[3][96];
+  snprintf(lines[0], sizeof(lines[0]), "%s damage", wlr_output->name);
+  snprintf(lines[1], sizeof(lines[1]), "last frame  %5.1f%%  %u px  %u rects",
+           stats.last_percent, stats.last_pixels, stats.last_rects);
+  snprintf(lines[2], sizeof(lines[2]),
+           "last second %3u fps  avg %5.1f%%  max %5.1f%%  %.1f rects",
+           stats.fps, stats.avg_percent, stats.max_percent, stats.avg_rects);
+
+  cairo_select_font_face(cairo, "monospace", CAIRO_FONT_SLANT_NORMAL,
+                         CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cairo, 11);
+  cairo_set_source_rgba(cairo, 1, 1, 1, 1);
+  for (int i = 0; i < 3; ++i) {
+    cairo_move_to(cairo, 6, 16 + i * 16);
+    cairo_show_text(cairo, lines[i]);
+  }
+  cairo_destroy(cairo);
+  cairo_surface_flush(surface);
+
+  if (panel != nullptr) {
+    wlr_texture_destroy(panel);
+  }
+  // cairo's ARGB32 is premultiplied and native-endian, like ARGB8888
+  panel = wlr_texture_from_pixels(
+      output->desktop->server->renderer, WL_SHM_FORMAT_ARGB8888,
+      cairo_image_surface_get_stride(surface), width, height,
+      cairo_image_surface_get_data(surface));
+  cairo_surface_destroy(surface);
+
+  int margin = DAMAGE_OVERLAY_PANEL_MARGIN * scale;
+  panel_box = {margin, margin, width, height};
+  // damaged by begin_frame, after the scene damage is taken
+  panel_dirty = true;
+  wlr_output_schedule_frame(wlr_output);
+}
+
+void ti::damage_debug_toggle(ti::desktop *desktop) {
+  ti::output *output;
+  wl_list_for_each(output, &desktop->outputs, link) {
+    if (output->damage_overlay != nullptr) {
+      delete output->damage_overlay;
+      output->damage_overlay = nullptr;
+    } else {
+      output->damage_overlay = new ti::damage_overlay(output);
+    }
+    wlr_output_damage_add_whole(output->damage);
+  }
+  desktop->damage_debug = !desktop->damage_debug;
+  wlr_log(WLR_INFO, "Damage overlay %s", desktop->damage_debug ? "on" : "off");
+}
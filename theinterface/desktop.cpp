@@ -1,7 +1,27 @@
+#include <cstdlib>
+
+extern "C" {
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_output_layout.h>
+}
+
+#include "bindings.hpp"
+#include "budget.hpp"
+#include "clients.hpp"
+#include "constraints.hpp"
 #include "cursor.hpp"
+#include "idle.hpp"
+#include "keymap.hpp"
+#include "latency.hpp"
+#include "launch.hpp"
+#include "metrics.hpp"
 #include "output.hpp"
+#include "record.hpp"
+#include "screencopy.hpp"
 #include "seat.hpp"
 #include "server.hpp"
+#include "startup.hpp"
+#include "toplevel_capture.hpp"
 #include "xdg_shell.hpp"
 #include "xwayland.hpp"
 
@@ -10,18 +30,49 @@
 ti::view *ti::desktop::view_at(double lx, double ly,
                                struct wlr_surface **surface, double *sx,
                                double *sy) {
+  // a fullscreen view hides everything else on its output
+  ti::output *output = output_from_wlr_output(
+      wlr_output_layout_output_at(this->output_layout, lx, ly));
+  if (output != nullptr && output->fullscreen_view != nullptr) {
+    ti::view *fullscreen = output->fullscreen_view;
+    return fullscreen->at(lx, ly, surface, sx, sy) ? fullscreen : NULL;
+  }
+
   ti::view *view;
   wl_list_for_each(view, &this->wem_views, wem_link) {
     if (view->at(lx, ly, surface, sx, sy)) {
       return view;
     }
+    if (view->decoration_at(lx, ly, nullptr)) {
+      *surface = NULL;
+      return view;
+    }
   }
   return NULL;
 }
 
+void ti::desktop::update_primary_outputs() {
+  ti::view *view;
+  wl_list_for_each(view, &this->views, link) {
+    view->update_primary_output();
+  }
+}
+
+/** Raised when outputs are added to or removed from the layout, or when one
+ * moves or changes its mode, scale or transform. */
+static void handle_output_layout_change(struct wl_listener *listener,
+                                        void *data) {
+  ti::desktop *desktop =
+      wl_container_of(listener, desktop, output_layout_change);
+  desktop->update_primary_outputs();
+}
+
 ti::desktop::desktop(ti::server *s) {
   this->server = s;
 
+  // first: it starts compiling the default keymap on a thread
+  this->keymaps = new ti::keymap_cache();
+
   /* Set up our list of views and the xdg-shell. The xdg-shell is a Wayland
    * protocol which is used for application windows. For more detail on
    * shells, refer to my article:
@@ -43,6 +94,9 @@ ti::desktop::desktop(ti::server *s) {
   /* Creates an output layout, which a wlroots utility for working with an
    * arrangement of screens in a physical layout. */
   this->output_layout = wlr_output_layout_create();
+  this->output_layout_change.notify = handle_output_layout_change;
+  wl_signal_add(&this->output_layout->events.change,
+                &this->output_layout_change);
 
   /* This creates some hands-off wlroots interfaces. The compositor is
    * necessary for clients to allocate surfaces and the data device manager
@@ -54,7 +108,11 @@ ti::desktop::desktop(ti::server *s) {
   this->new_xdg_surface.notify = handle_new_xdg_surface;
   wl_signal_add(&this->xdg_shell->events.new_surface, &this->new_xdg_surface);
 
-  this->seat = new ti::seat(this);
+  this->bindings = new ti::bindings();
+  {
+    ti::startup_phase phase("seat");
+    this->seat = new ti::seat(this);
+  }
 
   this->new_input.notify = handle_new_input;
   wl_signal_add(&this->server->backend->events.new_input, &this->new_input);
@@ -63,25 +121,61 @@ ti::desktop::desktop(ti::server *s) {
       wlr_foreign_toplevel_manager_v1_create(server->display);
 
 #ifdef WLR_HAS_XWAYLAND
-  this->xwayland =
-      wlr_xwayland_create(server->display, this->compositor, false);
-  this->new_xwayland_surface.notify = handle_new_xwayland_surface;
-  wl_signal_add(&this->xwayland->events.new_surface,
-                &this->new_xwayland_surface);
-  setenv("DISPLAY", this->xwayland->display_name, true);
-
-  this->seat->setup_xwayland_cursor(this->xwayland);
-
-  wlr_xwayland_set_seat(this->xwayland, this->seat->wlr_seat);
+  {
+    ti::startup_phase phase("xwayland");
+    xwayland_init(this);
+  }
 #endif
 
   this->presentation =
       wlr_presentation_create(server->display, server->backend);
+
+  this->idle = new ti::idle(this);
+  this->screencopy = new ti::screencopy_manager(this);
+  this->toplevel_capture = new ti::toplevel_capture_manager(this);
+  this->launches = new ti::launch_tracker(this);
+  this->latency = new ti::latency_tracker(this);
+  this->clients = new ti::client_tracker(this);
+  this->budget = new ti::commit_budget(this);
+  this->constraints = new ti::pointer_constraints(this);
+
+  const char *damage_debug = getenv("TI_DAMAGE_DEBUG");
+  this->damage_debug = damage_debug != nullptr && atoi(damage_debug) == 1;
 }
 
 ti::desktop::~desktop() {
+  wl_list_remove(&this->output_layout_change.link);
+  // the backend destroys the outputs later, with the display
+  ti::output *output, *tmp;
+  wl_list_for_each_safe(output, tmp, &this->outputs, link) {
+    wl_list_remove(&output->frame.link);
+    wl_list_remove(&output->destroy.link);
+    wl_list_remove(&output->link);
+    output->wlr_output->data = nullptr;
+    if (output->mirror_texture != nullptr) {
+      wlr_texture_destroy(output->mirror_texture);
+    }
+    delete output->damage_overlay;
+    delete output;
+  }
+  delete this->replayer;
+  delete this->recorder;
+  delete this->metrics;
+  delete this->constraints;
+  delete this->budget;
+  delete this->clients;
+  delete this->latency;
+  delete this->launches;
+  delete this->toplevel_capture;
+  delete this->screencopy;
+  delete this->idle;
   delete this->seat;
+  delete this->keymaps;
+  delete this->bindings;
 #ifdef WLR_HAS_XWAYLAND
+  if (this->xwayland_idle_timer) {
+    wl_event_source_remove(this->xwayland_idle_timer);
+  }
   wlr_xwayland_destroy(this->xwayland);
 #endif
 }
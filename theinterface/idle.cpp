@@ -0,0 +1,145 @@
+#include <cstdlib>
+
+extern "C" {
+#include <wlr/types/wlr_idle.h>
+#include <wlr/types/wlr_idle_inhibit_v1.h>
+#include <wlr/util/log.h>
+}
+
+#include "desktop.hpp"
+#include "output.hpp"
+#include "seat.hpp"
+#include "server.hpp"
+#include "util.hpp"
+
+#include "idle.hpp"
+
+static int idle_timer_handler(void *data) {
+  auto *idle = reinterpret_cast<ti::idle *>(data);
+  if (idle->idle_off) {
+    return 0;
+  }
+
+  int elapsed = timespec_to_msec(ti::monotonic_now()) -
+                timespec_to_msec(idle->last_activity);
+  if (elapsed < idle->timeout) {
+    // there was activity since the timer was armed, check again when the
+    // remaining time has passed
+    wl_event_source_timer_update(idle->timer,
+                                 ti::real_msec(idle->timeout - elapsed));
+    return 0;
+  }
+
+  if (idle->inhibited()) {
+    wl_event_source_timer_update(idle->timer, ti::real_msec(idle->timeout));
+    return 0;
+  }
+
+  wlr_log(WLR_INFO, "No input for %d seconds, turning outputs off",
+          idle->timeout / 1000);
+  idle->set_outputs_enabled(false);
+  idle->idle_off = true;
+  return 0;
+}
+
+void ti::idle::notify_activity(ti::seat *seat) {
+  last_activity = ti::monotonic_now();
+  wlr_idle_notify_activity(wlr_idle, seat->wlr_seat);
+
+  if (idle_off) {
+    idle_off = false;
+    set_outputs_enabled(true);
+    wl_event_source_timer_update(timer, ti::real_msec(timeout));
+  }
+}
+
+void ti::idle::set_outputs_enabled(bool enabled) {
+  ti::output *output;
+  wl_list_for_each(output, &desktop->outputs, link) {
+    if (enabled && !output->idle_off) {
+      // switched off by something else, leave it alone
+      continue;
+    }
+    if (!enabled && !output->wlr_output->enabled) {
+      continue;
+    }
+    output->idle_off = !enabled;
+    output->set_enabled(enabled);
+  }
+}
+
+bool ti::idle::inhibited() {
+  ti::idle_inhibitor *inhibitor;
+  wl_list_for_each(inhibitor, &inhibitors, link) {
+    // an inhibitor only counts while its surface is actually shown
+    if (wlr_surface_has_buffer(inhibitor->wlr_inhibitor->surface)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ti::idle::update_inhibited() {
+  /* The idle protocol timeouts of clients (e.g. screen lockers) must not fire
+   * either while something inhibits idleness. Visibility isn't known yet when
+   * an inhibitor is created, so any inhibitor counts here. */
+  wlr_idle_set_enabled(wlr_idle, NULL, wl_list_empty(&inhibitors));
+}
+
+static void handle_inhibitor_destroy(struct wl_listener *listener,
+                                     void *data) {
+  ti::idle_inhibitor *inhibitor = wl_container_of(listener, inhibitor, destroy);
+  ti::idle *idle = inhibitor->idle;
+  wl_list_remove(&inhibitor->link);
+  wl_list_remove(&inhibitor->destroy.link);
+  delete inhibitor;
+  idle->update_inhibited();
+}
+
+/** Raised when a client (e.g. a video player) asks that the outputs stay on
+ * while one of its surfaces is visible. */
+static void handle_new_inhibitor(struct wl_listener *listener, void *data) {
+  ti::idle *idle = wl_container_of(listener, idle, new_inhibitor);
+  auto *wlr_inhibitor = reinterpret_cast<struct wlr_idle_inhibitor_v1 *>(data);
+
+  ti::idle_inhibitor *inhibitor = new ti::idle_inhibitor{};
+  inhibitor->idle = idle;
+  inhibitor->wlr_inhibitor = wlr_inhibitor;
+  inhibitor->destroy.notify = handle_inhibitor_destroy;
+  wl_signal_add(&wlr_inhibitor->events.destroy, &inhibitor->destroy);
+  wl_list_insert(&idle->inhibitors, &inhibitor->link);
+
+  idle->update_inhibited();
+}
+
+ti::idle::idle(ti::desktop *d) {
+  this->desktop = d;
+  struct wl_display *display = desktop->server->display;
+
+  this->wlr_idle = wlr_idle_create(display);
+
+  wl_list_init(&this->inhibitors);
+  this->inhibit_manager = wlr_idle_inhibit_v1_create(display);
+  this->new_inhibitor.notify = handle_new_inhibitor;
+  wl_signal_add(&this->inhibit_manager->events.new_inhibitor,
+                &this->new_inhibitor);
+
+  this->last_activity = ti::monotonic_now();
+  const char *timeout_env = getenv("TI_IDLE_TIMEOUT");
+  if (timeout_env) {
+    this->timeout = atoi(timeout_env) * 1000;
+  }
+  if (this->timeout > 0) {
+    struct wl_event_loop *loop = wl_display_get_event_loop(display);
+    this->timer = wl_event_loop_add_timer(loop, idle_timer_handler, this);
+    wl_event_source_timer_update(this->timer, ti::real_msec(this->timeout));
+    wlr_log(WLR_INFO, "Outputs will be turned off after %d seconds of idle",
+            this->timeout / 1000);
+  }
+}
+
+ti::idle::~idle() {
+  if (this->timer) {
+    wl_event_source_remove(this->timer);
+  }
+}
@@ -1,12 +1,22 @@
 #include <csignal>
+#include <ctime>
 
 extern "C" {
 #include <wlr/backend/multi.h>
+#include <wlr/interfaces/wlr_input_device.h>
+#include <wlr/interfaces/wlr_keyboard.h>
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/util/log.h>
 }
 
+#include "bindings.hpp"
+#include "damage_overlay.hpp"
 #include "desktop.hpp"
+#include "idle.hpp"
+#include "keymap.hpp"
+#include "latency.hpp"
+#include "launch.hpp"
+#include "record.hpp"
 #include "seat.hpp"
 #include "server.hpp"
 #include "util.hpp"
@@ -16,19 +26,33 @@ extern "C" {
 
 /** This event is raised when a modifier key, such as shift or alt, is
  * pressed. We simply communicate this to the client. */
-static void handle_keyboard_modifiers(struct wl_listener *listener,
-                                      void *data) {
-  ti::keyboard *keyboard = wl_container_of(listener, keyboard, modifiers);
+static void process_modifiers(ti::seat *seat,
+                              struct wlr_input_device *device) {
+  seat->desktop->idle->notify_activity(seat);
   /*
    * A seat can only have one keyboard, but this is a limitation of the
    * Wayland protocol - not wlroots. We assign all connected keyboards to the
    * same seat. You can swap out the underlying wlr_keyboard like this and
-   * wlr_seat handles this transparently.
+   * wlr_seat handles this transparently. Only switching between groups, i.e.
+   * keymaps, makes wlroots send a keymap to the client.
    */
-  wlr_seat_set_keyboard(keyboard->seat->wlr_seat, keyboard->device);
+  wlr_seat_set_keyboard(seat->wlr_seat, device);
   /* Send modifiers to the client. */
-  wlr_seat_keyboard_notify_modifiers(keyboard->seat->wlr_seat,
-                                     &keyboard->device->keyboard->modifiers);
+  wlr_seat_keyboard_notify_modifiers(seat->wlr_seat,
+                                     &device->keyboard->modifiers);
+}
+
+static void handle_keyboard_modifiers(struct wl_listener *listener,
+                                      void *data) {
+  ti::keyboard_group *group = wl_container_of(listener, group, modifiers);
+  process_modifiers(group->seat, &group->device);
+}
+
+/// virtual keyboards: the modifiers their client sets
+static void handle_virtual_modifiers(struct wl_listener *listener,
+                                     void *data) {
+  ti::keyboard *keyboard = wl_container_of(listener, keyboard, modifiers);
+  process_modifiers(keyboard->seat, keyboard->device);
 }
 
 /// Change virtual terminal to the one specified by keysym called by using
@@ -76,79 +100,77 @@ static bool ti_alt_f4(ti::seat *seat, unsigned keysym) {
   return safe_kill(current_view->pid, SIGKILL);
 }
 
+/// runs a compositor keybinding, returns true if the key was consumed
+static bool run_binding(ti::seat *seat, const ti::binding &binding,
+                        xkb_keysym_t keysym) {
+  ti::server *server = seat->desktop->server;
+  switch (binding.action) {
+  case ti::BINDING_QUIT:
+    // this will make ti::server::run return
+    server->terminate();
+    return true;
+  case ti::BINDING_CHVT:
+    if (keysym >= XKB_KEY_XF86Switch_VT_1 &&
+        keysym <= XKB_KEY_XF86Switch_VT_12) {
+      ti_chvt(server, keysym);
+    }
+    return true;
+  case ti::BINDING_NEXT_VIEW:
+    ti_alt_tab(seat, keysym);
+    return true;
+  case ti::BINDING_CLOSE_VIEW:
+    if (!wl_list_empty(&seat->desktop->wem_views)) {
+      ti_alt_f4(seat, keysym);
+    }
+    return true;
+  case ti::BINDING_SPAWN:
+    seat->desktop->launches->spawn(binding.command);
+    return true;
+  case ti::BINDING_DAMAGE_DEBUG:
+    ti::damage_debug_toggle(seat->desktop);
+    return true;
+  case ti::BINDING_NONE:
+    break;
+  }
+  return false;
+}
+
 /*
  * Here we handle compositor keybindings. This is when the compositor is
  * processing keys, rather than passing them on to the client for its own
- * processing.
+ * processing. Most keys aren't bound, and cost one hash lookup.
  */
 static bool handle_keybinding(ti::seat *seat, const xkb_keysym_t *syms,
                               unsigned modifiers, size_t syms_len) {
-  ti::server *server = seat->desktop->server;
-  xkb_keysym_t keysym;
-  switch (modifiers) {
-  case WLR_MODIFIER_LOGO: {
-    for (size_t i = 0; i < syms_len; ++i) {
-      keysym = syms[i];
-      switch (keysym) {
-      case XKB_KEY_Escape: {
-        // this will terminate wl_display_run, causing it to return
-        wl_display_terminate(server->display);
-        return true;
-      }
-      }
+  for (size_t i = 0; i < syms_len; ++i) {
+    const ti::binding *binding =
+        seat->desktop->bindings->find(modifiers, syms[i]);
+    if (binding != nullptr) {
+      return run_binding(seat, *binding, syms[i]);
     }
-    break;
-  }
-  case (WLR_MODIFIER_ALT | WLR_MODIFIER_CTRL): {
-    for (size_t i = 0; i < syms_len; ++i) {
-      keysym = syms[i];
-      switch (keysym) {
-      /* These are specially mapped keys, each of them composed by
-       * CTRL+ALT+fnkey1..12*/
-      case XKB_KEY_XF86Switch_VT_1 ... XKB_KEY_XF86Switch_VT_12: {
-        ti_chvt(server, keysym);
-        return true;
-      }
-      }
-    }
-    break;
-  }
-  case WLR_MODIFIER_ALT: {
-    for (size_t i = 0; i < syms_len; ++i) {
-      keysym = syms[i];
-      switch (keysym) {
-      case XKB_KEY_Tab: {
-        ti_alt_tab(seat, keysym);
-        return true;
-      }
-      case XKB_KEY_F4: {
-        ti_alt_f4(seat, keysym);
-        return true;
-      }
-      }
-    }
-    break;
-  }
   }
   return false;
 }
 
-static void keyboard_handle_key(struct wl_listener *listener, void *data) {
-  /* This event is raised when a key is pressed or released. */
-  ti::keyboard *keyboard = wl_container_of(listener, keyboard, key);
-  ti::seat *seat = keyboard->seat;
-  auto *event = reinterpret_cast<struct wlr_event_keyboard_key *>(data);
-
-  /* Translate libinput keycode -> xkbcommon */
-  unsigned keycode = event->keycode + 8;
-  /* Get a list of keysyms based on the keymap for this keyboard */
-  const xkb_keysym_t *syms;
-  int nsyms = xkb_state_key_get_syms(keyboard->device->keyboard->xkb_state,
-                                     keycode, &syms);
+/* This is called when a key is pressed or released. */
+static void process_key(ti::seat *seat, struct wlr_input_device *device,
+                        struct wlr_event_keyboard_key *event) {
+  struct wlr_keyboard *wlr_keyboard = device->keyboard;
+  seat->desktop->idle->notify_activity(seat);
+  if (seat->desktop->recorder != nullptr) {
+    seat->desktop->recorder->key(event);
+  }
 
   bool handled = false;
-  unsigned modifiers = wlr_keyboard_get_modifiers(keyboard->device->keyboard);
-  if (event->state == WLR_KEY_PRESSED) {
+  // a virtual keyboard has no xkb state until its client sends a keymap
+  if (event->state == WLR_KEY_PRESSED && wlr_keyboard->xkb_state != nullptr) {
+    /* Translate libinput keycode -> xkbcommon */
+    unsigned keycode = event->keycode + 8;
+    /* Get a list of keysyms based on the keymap for this keyboard */
+    const xkb_keysym_t *syms;
+    int nsyms =
+        xkb_state_key_get_syms(wlr_keyboard->xkb_state, keycode, &syms);
+    unsigned modifiers = wlr_keyboard_get_modifiers(wlr_keyboard);
     /* If a key was _pressed_, we attempt to
      * process it as a compositor keybinding. */
     handled = handle_keybinding(seat, syms, modifiers, nsyms);
@@ -156,37 +178,217 @@ static void keyboard_handle_key(struct wl_listener *listener, void *data) {
 
   if (!handled) {
     /* Otherwise, we pass it along to the client. */
-    wlr_seat_set_keyboard(seat->wlr_seat, keyboard->device);
+    wlr_seat_set_keyboard(seat->wlr_seat, device);
     wlr_seat_keyboard_notify_key(seat->wlr_seat, event->time_msec,
                                  event->keycode, event->state);
   }
+  seat->desktop->latency->input(
+      ti::INPUT_KEY, event->time_msec,
+      handled ? nullptr : seat->wlr_seat->keyboard_state.focused_surface);
+}
+
+static void keyboard_handle_key(struct wl_listener *listener, void *data) {
+  ti::keyboard_group *group = wl_container_of(listener, group, key);
+  auto *event = reinterpret_cast<struct wlr_event_keyboard_key *>(data);
+  process_key(group->seat, &group->device, event);
+}
+
+/// virtual keyboards: keys in the keymap their client sent
+static void handle_virtual_key(struct wl_listener *listener, void *data) {
+  ti::keyboard *keyboard = wl_container_of(listener, keyboard, key);
+  auto *event = reinterpret_cast<struct wlr_event_keyboard_key *>(data);
+  process_key(keyboard->seat, keyboard->device, event);
+}
+
+void ti::keyboard_group::notify_key(struct wlr_event_keyboard_key *event) {
+  int &count = pressed[event->keycode];
+  if (event->state == WLR_KEY_PRESSED) {
+    if (count++ > 0) {
+      return;
+    }
+  } else {
+    if (count == 0 || --count > 0) {
+      return;
+    }
+    pressed.erase(event->keycode);
+  }
+  wlr_keyboard_notify_key(&keyboard, event);
+}
+
+void ti::keyboard_group::remove(ti::keyboard *member) {
+  struct wlr_keyboard *wlr_keyboard = member->device->keyboard;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (size_t i = 0; i < wlr_keyboard->num_keycodes; ++i) {
+    struct wlr_event_keyboard_key event = {
+        .time_msec = (uint32_t)timespec_to_msec(now),
+        .keycode = wlr_keyboard->keycodes[i],
+        .update_state = true,
+        .state = WLR_KEY_RELEASED,
+    };
+    notify_key(&event);
+  }
+  --size;
+}
+
+/// member keyboard -> group: key presses
+static void handle_member_key(struct wl_listener *listener, void *data) {
+  ti::keyboard *keyboard = wl_container_of(listener, keyboard, key);
+  auto *event = reinterpret_cast<struct wlr_event_keyboard_key *>(data);
+  keyboard->group->notify_key(event);
+}
+
+static void group_keyboard_destroy(struct wlr_keyboard *wlr_keyboard) {
+  // part of ti::keyboard_group
+}
+
+/// caps lock etc. are shown on every member keyboard
+static void group_keyboard_led_update(struct wlr_keyboard *wlr_keyboard,
+                                      uint32_t leds) {
+  ti::keyboard_group *group = wl_container_of(wlr_keyboard, group, keyboard);
+  ti::keyboard *keyboard;
+  wl_list_for_each(keyboard, &group->seat->keyboards, link) {
+    if (keyboard->group == group) {
+      wlr_keyboard_led_update(keyboard->device->keyboard, leds);
+    }
+  }
+}
+
+static const struct wlr_keyboard_impl group_keyboard_impl = {
+    .destroy = group_keyboard_destroy,
+    .led_update = group_keyboard_led_update,
+};
+
+static void group_device_destroy(struct wlr_input_device *device) {
+  // part of ti::keyboard_group
+}
+
+static const struct wlr_input_device_impl group_device_impl = {
+    .destroy = group_device_destroy,
+};
+
+/// returns the group of the keyboards with this keymap, creating it if needed
+static ti::keyboard_group *get_keyboard_group(ti::seat *seat,
+                                              struct xkb_keymap *keymap) {
+  ti::keyboard_group *group;
+  wl_list_for_each(group, &seat->keyboard_groups, link) {
+    if (group->keymap == keymap) {
+      return group;
+    }
+  }
+
+  group = new ti::keyboard_group{};
+  group->seat = seat;
+  group->keymap = keymap;
+  wlr_input_device_init(&group->device, WLR_INPUT_DEVICE_KEYBOARD,
+                        &group_device_impl, "theinterface merged keyboard", 0,
+                        0);
+  wlr_keyboard_init(&group->keyboard, &group_keyboard_impl);
+  group->device.keyboard = &group->keyboard;
+  wlr_keyboard_set_keymap(&group->keyboard, keymap);
+  wlr_keyboard_set_repeat_info(&group->keyboard, 25, 600);
+
+  group->modifiers.notify = handle_keyboard_modifiers;
+  wl_signal_add(&group->keyboard.events.modifiers, &group->modifiers);
+  group->key.notify = keyboard_handle_key;
+  wl_signal_add(&group->keyboard.events.key, &group->key);
+
+  wl_list_insert(&seat->keyboard_groups, &group->link);
+  return group;
+}
+
+static void handle_keyboard_destroy(struct wl_listener *listener,
+                                    void *data) {
+  ti::keyboard *keyboard = wl_container_of(listener, keyboard, destroy);
+  ti::keyboard_group *group = keyboard->group;
+  ti::seat *seat = keyboard->seat;
+
+  if (group != nullptr) {
+    group->remove(keyboard);
+  } else {
+    wl_list_remove(&keyboard->modifiers.link);
+  }
+  wl_list_remove(&keyboard->key.link);
+  wl_list_remove(&keyboard->destroy.link);
+  wl_list_remove(&keyboard->link);
+  delete keyboard;
+
+  if (group == nullptr) {
+    // the seat drops a destroyed keyboard, hand it a physical one again
+    if (wlr_seat_get_keyboard(seat->wlr_seat) == nullptr &&
+        !wl_list_empty(&seat->keyboard_groups)) {
+      ti::keyboard_group *first =
+          wl_container_of(seat->keyboard_groups.next, first, link);
+      wlr_seat_set_keyboard(seat->wlr_seat, &first->device);
+    }
+  } else if (group->size == 0) {
+    wl_list_remove(&group->modifiers.link);
+    wl_list_remove(&group->key.link);
+    wl_list_remove(&group->link);
+    // this also makes the seat drop the keyboard if it is the current one
+    wlr_input_device_destroy(&group->device);
+    delete group;
+  }
+
+  if (wl_list_empty(&seat->keyboards)) {
+    wlr_seat_set_capabilities(seat->wlr_seat,
+                              seat->wlr_seat->capabilities &
+                                  ~WL_SEAT_CAPABILITY_KEYBOARD);
+  }
 }
 
 void ti::seat::new_keyboard(struct wlr_input_device *device) {
+  /* We need to prepare an XKB keymap and assign it to the keyboard. This
+   * assumes the defaults (e.g. layout = "us"). Keyboards with the same names
+   * share one compiled keymap. */
+  struct xkb_rule_names rules = {};
+  struct xkb_keymap *keymap = desktop->keymaps->get(rules);
+  if (keymap == nullptr) {
+    wlr_log(WLR_ERROR, "No keymap for keyboard %s", device->name);
+    return;
+  }
+
   ti::keyboard *keyboard = new ti::keyboard{};
   keyboard->seat = this;
   keyboard->device = device;
 
-  /* We need to prepare an XKB keymap and assign it to the keyboard. This
-   * assumes the defaults (e.g. layout = "us"). */
-  struct xkb_rule_names rules = {};
-  struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-  struct xkb_keymap *keymap =
-      xkb_map_new_from_names(context, &rules, XKB_KEYMAP_COMPILE_NO_FLAGS);
-
   wlr_keyboard_set_keymap(device->keyboard, keymap);
-  xkb_keymap_unref(keymap);
-  xkb_context_unref(context);
   wlr_keyboard_set_repeat_info(device->keyboard, 25, 600);
 
-  /* Here we set up listeners for keyboard events. */
-  keyboard->modifiers.notify = handle_keyboard_modifiers;
-  wl_signal_add(&device->keyboard->events.modifiers, &keyboard->modifiers);
-  keyboard->key.notify = keyboard_handle_key;
+  keyboard->group = get_keyboard_group(this, keymap);
+  keyboard->group->size++;
+
+  /* Here we set up listeners for keyboard events. The keys are merged into
+   * the group, whose xkb state derives the modifiers, locks and layout from
+   * them: a member's own lock state is not copied over, it would be stale
+   * for every member but the one that toggled it. */
+  keyboard->key.notify = handle_member_key;
   wl_signal_add(&device->keyboard->events.key, &keyboard->key);
+  keyboard->destroy.notify = handle_keyboard_destroy;
+  wl_signal_add(&device->events.destroy, &keyboard->destroy);
 
-  wlr_seat_set_keyboard(this->wlr_seat, device);
+  wlr_seat_set_keyboard(this->wlr_seat, &keyboard->group->device);
 
   /* And add the keyboard to our list of keyboards */
   wl_list_insert(&this->keyboards, &keyboard->link);
 }
+
+void ti::seat::new_virtual_keyboard(struct wlr_input_device *device) {
+  ti::keyboard *keyboard = new ti::keyboard{};
+  keyboard->seat = this;
+  keyboard->device = device;
+  keyboard->group = nullptr;
+
+  /* Its client uploads the keymap and may set any modifiers, e.g. to type
+   * keysyms missing from the default keymap, so its events are used as they
+   * are instead of being merged into a group. */
+  keyboard->modifiers.notify = handle_virtual_modifiers;
+  wl_signal_add(&device->keyboard->events.modifiers, &keyboard->modifiers);
+  keyboard->key.notify = handle_virtual_key;
+  wl_signal_add(&device->keyboard->events.key, &keyboard->key);
+  keyboard->destroy.notify = handle_keyboard_destroy;
+  wl_signal_add(&device->events.destroy, &keyboard->destroy);
+
+  wl_list_insert(&this->keyboards, &keyboard->link);
+}
@@ -0,0 +1,224 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <sys/stat.h>
+
+extern "C" {
+#include <wlr/util/log.h>
+}
+
+#include "startup.hpp"
+
+#include "keymap.hpp"
+
+/// field, or the XKB_DEFAULT_* variable xkbcommon would use, or its default
+static std::string name_or_default(const char *field, const char *env,
+                                   const char *fallback) {
+  if (field != nullptr && *field != '\0') {
+    return field;
+  }
+  const char *value = getenv(env);
+  if (value != nullptr && *value != '\0') {
+    return value;
+  }
+  return fallback;
+}
+
+/// the parts of an xkb data directory a keymap is compiled from
+static const char *const xkb_data_dirs[] = {"rules",  "keycodes", "types",
+                                            "compat", "symbols"};
+
+/** A hash of the modification times of the data xkbcommon compiles keymaps
+ * from, in every include path (e.g. ~/.config/xkb before the system's): the
+ * rules file, and the directories, whose times change as files are added,
+ * removed, or replaced by a package update. */
+static size_t xkb_data_hash(struct xkb_context *context,
+                            const std::string &rules) {
+  std::ostringstream times;
+  auto add_mtime = [&times](const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+      times << ' ' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec;
+    } else {
+      times << " -";
+    }
+  };
+  for (unsigned i = 0; i < xkb_context_num_include_paths(context); ++i) {
+    std::string path = xkb_context_include_path_get(context, i);
+    times << path;
+    add_mtime(path + "/rules/" + rules);
+    for (const char *dir : xkb_data_dirs) {
+      add_mtime(path + "/" + dir);
+    }
+    times << '\n';
+  }
+  return std::hash<std::string>{}(times.str());
+}
+
+/** The cache key of a keymap: its complete RMLVO names, and a hash of the
+ * modification times of the xkb data, so that updating xkeyboard-config or
+ * the user's own xkb files invalidates the serialized keymaps. */
+static std::string keymap_key(struct xkb_context *context,
+                              const struct xkb_rule_names &names) {
+  std::string rules =
+      name_or_default(names.rules, "XKB_DEFAULT_RULES", "evdev");
+  std::ostringstream key;
+  key << "rules=" << rules << " model="
+      << name_or_default(names.model, "XKB_DEFAULT_MODEL", "pc105")
+      << " layout="
+      << name_or_default(names.layout, "XKB_DEFAULT_LAYOUT", "us")
+      << " variant="
+      << name_or_default(names.variant, "XKB_DEFAULT_VARIANT", "")
+      << " options="
+      << name_or_default(names.options, "XKB_DEFAULT_OPTIONS", "");
+
+  key << " data=" << std::hex << xkb_data_hash(context, rules);
+  return key.str();
+}
+
+static bool make_dir(const std::string &path) {
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+ti::keymap_cache::keymap_cache() {
+  this->context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+
+  std::string base;
+  const char *xdg_cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg_cache != nullptr && *xdg_cache != '\0') {
+    base = xdg_cache;
+  } else if (home != nullptr) {
+    base = std::string(home) + "/.cache";
+  }
+
+  std::string dir = base + "/theinterface";
+  if (base.empty()) {
+    // no cache, keymaps are compiled every time
+  } else if (make_dir(base) && make_dir(dir) && make_dir(dir + "/keymaps")) {
+    this->cache_dir = dir + "/keymaps";
+  } else {
+    wlr_log(WLR_ERROR, "Can't create the keymap cache in %s", dir.c_str());
+  }
+
+  /* The keyboards found when the backend starts want the default keymap.
+   * The main thread sets environment variables meanwhile, so the thread
+   * mustn't read any: its names are resolved here, which leaves neither
+   * keymap_key nor xkbcommon a default to look up. */
+  std::string rules = name_or_default(nullptr, "XKB_DEFAULT_RULES", "evdev");
+  std::string model = name_or_default(nullptr, "XKB_DEFAULT_MODEL", "pc105");
+  std::string layout = name_or_default(nullptr, "XKB_DEFAULT_LAYOUT", "us");
+  std::string variant = name_or_default(nullptr, "XKB_DEFAULT_VARIANT", "");
+  std::string options = name_or_default(nullptr, "XKB_DEFAULT_OPTIONS", "");
+  this->prefetch = std::thread([this, rules, model, layout, variant, options] {
+    ti::startup_phase phase("keymap");
+    struct xkb_rule_names names = {
+        .rules = rules.c_str(),
+        .model = model.c_str(),
+        .layout = layout.c_str(),
+        .variant = variant.c_str(),
+        .options = options.c_str(),
+    };
+    lookup(names);
+  });
+}
+
+ti::keymap_cache::~keymap_cache() {
+  if (prefetch.joinable()) {
+    prefetch.join();
+  }
+  for (auto &entry : keymaps) {
+    xkb_keymap_unref(entry.second);
+  }
+  xkb_context_unref(this->context);
+}
+
+static std::string keymap_path(const std::string &dir,
+                               const std::string &key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016zx.xkb", std::hash<std::string>{}(key));
+  return dir + "/" + name;
+}
+
+/** Loads a serialized keymap. The first line of the file is the key it was
+ * compiled for, the rest is the output of xkb_keymap_get_as_string. */
+struct xkb_keymap *ti::keymap_cache::load(const std::string &key) {
+  if (cache_dir.empty()) {
+    return nullptr;
+  }
+
+  std::ifstream file(keymap_path(cache_dir, key));
+  std::string line;
+  if (!file || !std::getline(file, line) || line != key) {
+    return nullptr;
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+
+  return xkb_keymap_new_from_string(context, contents.str().c_str(),
+                                    XKB_KEYMAP_FORMAT_TEXT_V1,
+                                    XKB_KEYMAP_COMPILE_NO_FLAGS);
+}
+
+void ti::keymap_cache::save(const std::string &key,
+                            struct xkb_keymap *keymap) {
+  if (cache_dir.empty()) {
+    return;
+  }
+
+  char *string = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+  if (string == nullptr) {
+    return;
+  }
+
+  // written aside and renamed, so a crash never leaves a truncated keymap
+  std::string path = keymap_path(cache_dir, key);
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    file << key << '\n' << string;
+  }
+  free(string);
+
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    wlr_log_errno(WLR_ERROR, "Can't save keymap to %s", path.c_str());
+    remove(tmp_path.c_str());
+  }
+}
+
+struct xkb_keymap *ti::keymap_cache::get(const struct xkb_rule_names &names) {
+  if (prefetch.joinable()) {
+    prefetch.join();
+  }
+  return lookup(names);
+}
+
+struct xkb_keymap *
+ti::keymap_cache::lookup(const struct xkb_rule_names &names) {
+  std::string key = keymap_key(context, names);
+
+  auto it = keymaps.find(key);
+  if (it != keymaps.end()) {
+    return it->second;
+  }
+
+  struct xkb_keymap *keymap = load(key);
+  if (keymap != nullptr) {
+    wlr_log(WLR_DEBUG, "Loaded cached keymap %s", key.c_str());
+  } else {
+    keymap =
+        xkb_keymap_new_from_names(context, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (keymap == nullptr) {
+      wlr_log(WLR_ERROR, "Failed to compile keymap %s", key.c_str());
+      return nullptr;
+    }
+    wlr_log(WLR_DEBUG, "Compiled keymap %s", key.c_str());
+    save(key, keymap);
+  }
+
+  keymaps[key] = keymap;
+  return keymap;
+}
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <ctime>
+
+extern "C" {
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+}
+
+#include "desktop.hpp"
+#include "output.hpp"
+#include "server.hpp"
+#include "view.hpp"
+
+#include "latency.hpp"
+
+#define LATENCY_BUCKET_USEC 250
+/// up to 250 ms
+#define LATENCY_BUCKETS 1000
+/// an input not shown after this long had no visible effect
+#define LATENCY_GIVE_UP_MSEC 1000
+#define LATENCY_REPORT_INTERVAL_MSEC 60000
+
+static const char *input_type_names[] = {"motion", "button", "axis", "key"};
+
+static int64_t now_usec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+ti::latency_histogram::latency_histogram() : buckets(LATENCY_BUCKETS, 0) {}
+
+void ti::latency_histogram::add(int64_t usec) {
+  int64_t bucket = std::clamp<int64_t>(usec / LATENCY_BUCKET_USEC, 0,
+                                       LATENCY_BUCKETS - 1);
+  ++buckets[bucket];
+  ++count;
+  max_usec = std::max(max_usec, usec);
+}
+
+void ti::latency_histogram::merge(const ti::latency_histogram &other) {
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    buckets[i] += other.buckets[i];
+  }
+  count += other.count;
+  max_usec = std::max(max_usec, other.max_usec);
+}
+
+double ti::latency_histogram::percentile(double p) const {
+  uint64_t rank = p * count;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen > rank) {
+      // the upper end of the bucket
+      return (i + 1) * LATENCY_BUCKET_USEC / 1000.0;
+    }
+  }
+  return max_usec / 1000.0;
+}
+
+/// the present event of an output: the scanout time of a committed frame
+static void handle_present(struct wl_listener *listener, void *data) {
+  ti::latency_output *lo = wl_container_of(listener, lo, present);
+  auto *event = reinterpret_cast<struct wlr_output_event_present *>(data);
+  ti::latency_tracker *tracker = lo->output->desktop->latency;
+
+  // frames replaced before they were scanned out have no present event
+  while (!lo->frames.empty() &&
+         (int32_t)(lo->frames.front().commit_seq - event->commit_seq) < 0) {
+    lo->frames.pop_front();
+  }
+  if (lo->frames.empty() ||
+      lo->frames.front().commit_seq != event->commit_seq) {
+    return;
+  }
+
+  ti::latency_frame frame = lo->frames.front();
+  lo->frames.pop_front();
+  int64_t scanout_usec = event->when != nullptr
+                             ? (int64_t)event->when->tv_sec * 1000000 +
+                                   event->when->tv_nsec / 1000
+                             : now_usec();
+  for (int type = 0; type < ti::INPUT_TYPE_COUNT; ++type) {
+    if (frame.input_msec[type] == 0) {
+      continue;
+    }
+    int64_t input_usec = frame.input_msec[type] * 1000;
+    lo->commit[type].add(frame.commit_usec - input_usec);
+    lo->scanout[type].add(scanout_usec - input_usec);
+    ++tracker->unreported;
+  }
+}
+
+static int handle_report_timer(void *data) {
+  auto *tracker = reinterpret_cast<ti::latency_tracker *>(data);
+  tracker->report();
+  return 0;
+}
+
+ti::latency_tracker::latency_tracker(ti::desktop *desktop) {
+  this->desktop = desktop;
+  struct wl_event_loop *loop =
+      wl_display_get_event_loop(desktop->server->display);
+  this->report_timer =
+      wl_event_loop_add_timer(loop, handle_report_timer, this);
+  wl_event_source_timer_update(report_timer, LATENCY_REPORT_INTERVAL_MSEC);
+}
+
+ti::latency_tracker::~latency_tracker() {
+  report();
+  wl_event_source_remove(report_timer);
+  for (auto &entry : outputs) {
+    wl_list_remove(&entry.second->present.link);
+    delete entry.second;
+  }
+}
+
+ti::latency_output *ti::latency_tracker::get_output(ti::output *output) {
+  auto it = outputs.find(output);
+  if (it != outputs.end()) {
+    return it->second;
+  }
+  auto *lo = new ti::latency_output;
+  lo->output = output;
+  lo->present.notify = handle_present;
+  wl_signal_add(&output->wlr_output->events.present, &lo->present);
+  outputs[output] = lo;
+  return lo;
+}
+
+void ti::latency_tracker::output_destroyed(ti::output *output) {
+  for (pending_input &p : pending) {
+    if (p.output == output) {
+      p.active = false;
+    }
+  }
+  auto it = outputs.find(output);
+  if (it != outputs.end()) {
+    wl_list_remove(&it->second->present.link);
+    delete it->second;
+    outputs.erase(it);
+  }
+}
+
+void ti::latency_tracker::expire_pending(int64_t now_msec) {
+  for (pending_input &p : pending) {
+    if (p.active && now_msec - p.time_msec >= LATENCY_GIVE_UP_MSEC) {
+      p.active = false;
+    }
+  }
+}
+
+void ti::latency_tracker::input(ti::input_type type, uint32_t time_msec,
+                                struct wlr_surface *surface) {
+  // event times are 32 bit milliseconds of CLOCK_MONOTONIC
+  int64_t now_msec = now_usec() / 1000;
+  int64_t input_msec = now_msec - (uint32_t)((uint32_t)now_msec - time_msec);
+
+  expire_pending(now_msec);
+  pending_input &p = pending[type];
+  if (p.active) {
+    // the older input is still on its way
+    return;
+  }
+  p.active = true;
+  p.time_msec = input_msec;
+  p.client = surface ? wl_resource_get_client(surface->resource) : nullptr;
+  p.committed = surface == nullptr;
+  p.output = nullptr;
+}
+
+void ti::latency_tracker::view_committed(ti::view *view) {
+  if (view->surface == nullptr ||
+      !pixman_region32_not_empty(&view->surface->buffer_damage)) {
+    return;
+  }
+  expire_pending(now_usec() / 1000);
+  struct wl_client *client = wl_resource_get_client(view->surface->resource);
+  for (pending_input &p : pending) {
+    if (p.active && !p.committed && p.client == client) {
+      p.committed = true;
+      p.output = view->primary_output;
+    }
+  }
+}
+
+void ti::latency_tracker::frame_committed(ti::output *output) {
+  int64_t commit_usec = now_usec();
+  expire_pending(commit_usec / 1000);
+  ti::latency_frame frame = {};
+  bool any = false;
+  for (int type = 0; type < ti::INPUT_TYPE_COUNT; ++type) {
+    pending_input &p = pending[type];
+    if (p.active && p.committed &&
+        (p.output == nullptr || p.output == output)) {
+      // 0 means no input, an input at 0 is lost
+      frame.input_msec[type] = p.time_msec;
+      p.active = false;
+      any = true;
+    }
+  }
+  if (!any) {
+    return;
+  }
+
+  frame.commit_seq = output->wlr_output->commit_seq;
+  frame.commit_usec = commit_usec;
+  get_output(output)->frames.push_back(frame);
+}
+
+void ti::latency_tracker::report() {
+  wl_event_source_timer_update(report_timer, LATENCY_REPORT_INTERVAL_MSEC);
+  if (unreported == 0) {
+    return;
+  }
+  unreported = 0;
+
+  for (int type = 0; type < ti::INPUT_TYPE_COUNT; ++type) {
+    ti::latency_histogram commit, scanout;
+    for (auto &entry : outputs) {
+      commit.merge(entry.second->commit[type]);
+      scanout.merge(entry.second->scanout[type]);
+    }
+    if (scanout.count == 0) {
+      continue;
+    }
+    wlr_log(WLR_INFO,
+            "Latency of %s: p50 %.2f p90 %.2f p99 %.2f max %.2f ms to scanout, "
+            "p50 %.2f ms to commit (%lu inputs)",
+            input_type_names[type], scanout.percentile(0.5),
+            scanout.percentile(0.9), scanout.percentile(0.99),
+            scanout.max_usec / 1000.0, commit.percentile(0.5),
+            (unsigned long)scanout.count);
+
+    for (auto &entry : outputs) {
+      const ti::latency_histogram &h = entry.second->scanout[type];
+      if (h.count == 0 || outputs.size() == 1) {
+        continue;
+      }
+      wlr_log(WLR_INFO,
+              "  on %s: p50 %.2f p90 %.2f p99 %.2f ms to scanout (%lu inputs)",
+              entry.first->wlr_output->name, h.percentile(0.5),
+              h.percentile(0.9), h.percentile(0.99), (unsigned long)h.count);
+    }
+  }
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+extern "C" {
+#include <wlr/util/log.h>
+}
+
+#include "gtk-shell-protocol.h"
+
+#include "desktop.hpp"
+#include "launcher.hpp"
+#include "server.hpp"
+#include "util.hpp"
+#include "view.hpp"
+
+#include "launch.hpp"
+
+#define GTK_SHELL_VERSION 2
+
+/// programs that haven't shown a window after this long are forgotten
+#define LAUNCH_TIMEOUT_SEC 60
+
+/// how far up the process tree a window's pid is looked up
+#define LAUNCH_MAX_PARENTS 16
+
+/// at most this many maps wait for a startup id
+#define LAUNCH_MAX_EARLY_MAPS 16
+
+/// the median launch time is that of this many last launches
+#define LAUNCH_RECENT 64
+
+static int64_t msec_between(const struct timespec &from,
+                            const struct timespec &to) {
+  return timespec_to_msec(to) - timespec_to_msec(from);
+}
+
+/// parent pid from /proc, or 0
+static pid_t get_parent_pid(pid_t pid) {
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return 0;
+  }
+
+  // "pid (comm) state ppid ...", where comm can contain anything
+  char buffer[512];
+  size_t size = fread(buffer, 1, sizeof(buffer) - 1, file);
+  fclose(file);
+  buffer[size] = '\0';
+
+  pid_t ppid = 0;
+  const char *comm_end = strrchr(buffer, ')');
+  if (comm_end == nullptr || sscanf(comm_end + 1, " %*c %d", &ppid) != 1) {
+    return 0;
+  }
+  return ppid;
+}
+
+pid_t ti::launch_tracker::spawn(const std::string &command) {
+  ti::pending_launch launch;
+  clock_gettime(CLOCK_MONOTONIC, &launch.start);
+  launch.command = command;
+  launch.startup_id = "theinterface-" + std::to_string(getpid()) + "-" +
+                      std::to_string(next_startup_id++) + "_TIME0";
+
+  launch.pid = ti::spawn(command, launch.startup_id);
+  if (launch.pid > 0) {
+    expire(launch.start);
+    pending.push_back(launch);
+  }
+  return launch.pid;
+}
+
+void ti::launch_tracker::expire(const struct timespec &now) {
+  auto too_old = [&now](const struct timespec &when) {
+    return msec_between(when, now) > LAUNCH_TIMEOUT_SEC * 1000;
+  };
+  pending.erase(std::remove_if(pending.begin(), pending.end(),
+                               [&](const ti::pending_launch &launch) {
+                                 return too_old(launch.start);
+                               }),
+                pending.end());
+  early_maps.erase(std::remove_if(early_maps.begin(), early_maps.end(),
+                                  [&](const early_map &map) {
+                                    return too_old(map.when);
+                                  }),
+                   early_maps.end());
+}
+
+void ti::launch_tracker::complete(size_t index, const std::string &app_id,
+                                  const struct timespec &when,
+                                  const char *matched_by) {
+  ti::pending_launch &launch = pending[index];
+  int64_t msec = msec_between(launch.start, when);
+
+  for (ti::launch_stats *s : {&stats[app_id], &all}) {
+    s->min = s->count == 0 ? msec : std::min(s->min, msec);
+    s->max = std::max(s->max, msec);
+    s->last = msec;
+    s->total += msec;
+    s->count++;
+  }
+  if (recent.size() >= LAUNCH_RECENT) {
+    recent.erase(recent.begin());
+  }
+  recent.push_back(msec);
+
+  wlr_log(WLR_INFO,
+          "Launch: %s (%s) mapped after %" PRId64 " ms, matched by %s",
+          app_id.c_str(), launch.command.c_str(), msec, matched_by);
+  pending.erase(pending.begin() + index);
+}
+
+int64_t ti::launch_tracker::recent_median() const {
+  if (recent.empty()) {
+    return 0;
+  }
+  std::vector<int64_t> sorted = recent;
+  auto middle = sorted.begin() + sorted.size() / 2;
+  std::nth_element(sorted.begin(), middle, sorted.end());
+  return *middle;
+}
+
+void ti::launch_tracker::view_mapped(ti::view *view) {
+  if (pending.empty()) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  expire(now);
+  std::string app_id = view->get_app_id();
+
+  // the program itself, or a child of the shell it was started with
+  pid_t pid = view->pid;
+  for (int depth = 0; pid > 1 && depth < LAUNCH_MAX_PARENTS; ++depth) {
+    for (size_t i = 0; i < pending.size(); ++i) {
+      if (pending[i].pid == pid) {
+        complete(i, app_id, now, "pid");
+        return;
+      }
+    }
+    pid = get_parent_pid(pid);
+  }
+
+  struct wl_client *client = wl_resource_get_client(view->surface->resource);
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (pending[i].client == client) {
+      complete(i, app_id, now, "startup id");
+      return;
+    }
+  }
+
+  // e.g. a D-Bus activated program: it may still send its startup id
+  if (early_maps.size() >= LAUNCH_MAX_EARLY_MAPS) {
+    early_maps.erase(early_maps.begin());
+  }
+  early_maps.push_back({client, app_id, now});
+}
+
+void ti::launch_tracker::set_startup_id(struct wl_client *client,
+                                        const char *startup_id) {
+  if (startup_id == nullptr) {
+    return;
+  }
+
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (pending[i].startup_id != startup_id) {
+      continue;
+    }
+    // GTK sends the startup id once its first window is shown
+    for (auto map = early_maps.begin(); map != early_maps.end(); ++map) {
+      if (map->client == client) {
+        early_map early = *map;
+        early_maps.erase(map);
+        complete(i, early.app_id, early.when, "startup id");
+        return;
+      }
+    }
+    pending[i].client = client;
+    return;
+  }
+}
+
+static void gtk_surface_handle_set_dbus_properties(
+    struct wl_client *client, struct wl_resource *resource,
+    const char *application_id, const char *app_menu_path,
+    const char *menubar_path, const char *window_object_path,
+    const char *application_object_path, const char *unique_bus_name) {}
+
+static void gtk_surface_handle_set_modal(struct wl_client *client,
+                                         struct wl_resource *resource) {}
+
+static void gtk_surface_handle_unset_modal(struct wl_client *client,
+                                           struct wl_resource *resource) {}
+
+static void gtk_surface_handle_present(struct wl_client *client,
+                                       struct wl_resource *resource,
+                                       uint32_t time) {}
+
+/// gtk_surface1 is only there so that GTK accepts our gtk_shell1
+static const struct gtk_surface1_interface gtk_surface_impl = {
+    .set_dbus_properties = gtk_surface_handle_set_dbus_properties,
+    .set_modal = gtk_surface_handle_set_modal,
+    .unset_modal = gtk_surface_handle_unset_modal,
+    .present = gtk_surface_handle_present,
+};
+
+static void gtk_shell_handle_get_gtk_surface(struct wl_client *client,
+                                             struct wl_resource *resource,
+                                             uint32_t id,
+                                             struct wl_resource *surface) {
+  struct wl_resource *gtk_surface =
+      wl_resource_create(client, &gtk_surface1_interface,
+                         wl_resource_get_version(resource), id);
+  if (gtk_surface == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(gtk_surface, &gtk_surface_impl, NULL, NULL);
+}
+
+static void gtk_shell_handle_set_startup_id(struct wl_client *client,
+                                            struct wl_resource *resource,
+                                            const char *startup_id) {
+  auto *tracker = reinterpret_cast<ti::launch_tracker *>(
+      wl_resource_get_user_data(resource));
+  tracker->set_startup_id(client, startup_id);
+}
+
+static void gtk_shell_handle_system_bell(struct wl_client *client,
+                                         struct wl_resource *resource,
+                                         struct wl_resource *surface) {}
+
+static const struct gtk_shell1_interface gtk_shell_impl = {
+    .get_gtk_surface = gtk_shell_handle_get_gtk_surface,
+    .set_startup_id = gtk_shell_handle_set_startup_id,
+    .system_bell = gtk_shell_handle_system_bell,
+};
+
+static void gtk_shell_bind(struct wl_client *client, void *data,
+                           uint32_t version, uint32_t id) {
+  struct wl_resource *resource =
+      wl_resource_create(client, &gtk_shell1_interface, version, id);
+  if (resource == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(resource, &gtk_shell_impl, data, NULL);
+}
+
+ti::launch_tracker::launch_tracker(ti::desktop *d) {
+  this->desktop = d;
+  this->gtk_shell =
+      wl_global_create(desktop->server->display, &gtk_shell1_interface,
+                       GTK_SHELL_VERSION, this, gtk_shell_bind);
+}
+
+ti::launch_tracker::~launch_tracker() {
+  for (auto &entry : stats) {
+    const ti::launch_stats &app = entry.second;
+    wlr_log(WLR_INFO,
+            "Launch times of %s: %u launches, min %" PRId64 " ms, mean %" PRId64
+            " ms, max %" PRId64 " ms",
+            entry.first.c_str(), app.count, app.min, app.total / app.count,
+            app.max);
+  }
+  wl_global_destroy(this->gtk_shell);
+}
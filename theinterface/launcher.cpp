@@ -0,0 +1,254 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include <wlr/util/log.h>
+}
+
+#include "launcher.hpp"
+
+extern char **environ;
+
+/// the compositor's end of the launcher socket, -1 without a launcher
+static int launcher_fd = -1;
+
+/// a request is the command, then the forwarded variables, each terminated by
+/// a NUL. Unset variables are sent without '='
+#define LAUNCHER_MAX_REQUEST 16384
+
+/// set by the compositor after the launcher started, so sent with each request
+static const char *forwarded_env[] = {"WAYLAND_DISPLAY", "DISPLAY"};
+
+/// programs started without the launcher that may still need reaping
+#define LAUNCHER_MAX_UNREAPED 64
+
+/** The pids of the programs started without the launcher, 0 for free slots.
+ * Only these are reaped: waiting for any child would take the children of
+ * wlroots, e.g. Xwayland's, from under it. */
+static volatile pid_t unreaped[LAUNCHER_MAX_UNREAPED];
+
+/// reaps the programs started without the launcher that exited
+static void reap_unreaped() {
+  for (volatile pid_t &pid : unreaped) {
+    pid_t p = pid;
+    if (p > 0 && waitpid(p, nullptr, WNOHANG) == p) {
+      pid = 0;
+    }
+  }
+}
+
+static void handle_sigchld(int signal) {
+  int saved_errno = errno;
+  reap_unreaped();
+  errno = saved_errno;
+}
+
+/// true if the "NAME=value" entry sets the variable of "NAME[=value]"
+static bool same_variable(const char *entry, const char *var) {
+  size_t len = strcspn(var, "=");
+  return strncmp(entry, var, len) == 0 && entry[len] == '=';
+}
+
+/** posix_spawn()s /bin/sh -c command in a new session, with signals back to
+ * their defaults. overrides replace the matching variables of environ. */
+static pid_t spawn_shell(const char *command,
+                         const std::vector<const char *> &overrides) {
+  std::vector<char *> env;
+  for (char **entry = environ; *entry != nullptr; ++entry) {
+    bool overridden = false;
+    for (const char *var : overrides) {
+      overridden = overridden || same_variable(*entry, var);
+    }
+    if (!overridden) {
+      env.push_back(*entry);
+    }
+  }
+  for (const char *var : overrides) {
+    if (strchr(var, '=') != nullptr) {
+      env.push_back(const_cast<char *>(var));
+    }
+  }
+  env.push_back(nullptr);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t mask, defaults;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGCHLD);
+  sigaddset(&defaults, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_SETSID
+  flags |= POSIX_SPAWN_SETSID;
+#else
+  flags |= POSIX_SPAWN_SETPGROUP;
+#endif
+  posix_spawnattr_setflags(&attr, flags);
+
+  char *argv[] = {const_cast<char *>("/bin/sh"), const_cast<char *>("-c"),
+                  const_cast<char *>(command), nullptr};
+  pid_t pid;
+  int err = posix_spawn(&pid, "/bin/sh", nullptr, &attr, argv, env.data());
+  posix_spawnattr_destroy(&attr);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+/// in the launcher: closes everything but stdio and the socket
+static void close_other_fds(int keep) {
+  DIR *dir = opendir("/proc/self/fd");
+  if (dir == nullptr) {
+    return;
+  }
+  std::vector<int> fds;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    // "." and ".." parse as 0
+    int fd = atoi(entry->d_name);
+    if (fd > STDERR_FILENO && fd != keep && fd != dirfd(dir)) {
+      fds.push_back(fd);
+    }
+  }
+  closedir(dir);
+  for (int fd : fds) {
+    close(fd);
+  }
+}
+
+/// the launcher process: answers each request with the pid it spawned
+[[noreturn]] static void launcher_run(int fd) {
+  prctl(PR_SET_NAME, "ti-launcher");
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  close_other_fds(fd);
+  // the kernel reaps children of a process ignoring SIGCHLD
+  signal(SIGCHLD, SIG_IGN);
+
+  std::vector<char> request(LAUNCHER_MAX_REQUEST + 1);
+  for (;;) {
+    ssize_t size = recv(fd, request.data(), LAUNCHER_MAX_REQUEST, 0);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    if (size <= 0) {
+      // the compositor is gone
+      break;
+    }
+    request[size] = '\0';
+
+    const char *command = request.data();
+    std::vector<const char *> overrides;
+    for (const char *p = command + strlen(command) + 1;
+         p < request.data() + size; p += strlen(p) + 1) {
+      overrides.push_back(p);
+    }
+
+    pid_t pid = spawn_shell(command, overrides);
+    if (send(fd, &pid, sizeof(pid), MSG_NOSIGNAL) < 0) {
+      break;
+    }
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+void ti::launcher_start() {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+    wlr_log_errno(WLR_ERROR, "Can't create the launcher socket");
+    return;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    wlr_log_errno(WLR_ERROR, "Can't fork the launcher");
+    close(fds[0]);
+    close(fds[1]);
+    return;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    launcher_run(fds[1]);
+  }
+
+  close(fds[1]);
+  launcher_fd = fds[0];
+}
+
+pid_t ti::spawn(const std::string &command, const std::string &startup_id) {
+  std::string request = command;
+  request.push_back('\0');
+  for (const char *name : forwarded_env) {
+    request += name;
+    const char *value = getenv(name);
+    if (value != nullptr) {
+      request += '=';
+      request += value;
+    }
+    request.push_back('\0');
+  }
+  request += "DESKTOP_STARTUP_ID";
+  if (!startup_id.empty()) {
+    request += "=" + startup_id;
+  }
+  request.push_back('\0');
+
+  if (launcher_fd >= 0 && request.size() <= LAUNCHER_MAX_REQUEST) {
+    pid_t pid = -1;
+    if (send(launcher_fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+            (ssize_t)request.size() &&
+        recv(launcher_fd, &pid, sizeof(pid), 0) == sizeof(pid)) {
+      if (pid < 0) {
+        wlr_log(WLR_ERROR, "Can't run %s", command.c_str());
+      }
+      return pid;
+    }
+    wlr_log_errno(WLR_ERROR, "The launcher is gone");
+    close(launcher_fd);
+    launcher_fd = -1;
+  }
+
+  /* Without the launcher, the program is started from here, and reaped by
+   * a SIGCHLD handler. A program exiting before its pid is stored is reaped
+   * by the sweep of the next spawn. The environment is already the
+   * compositor's. */
+  static bool reaping = false;
+  if (!reaping) {
+    struct sigaction action = {};
+    action.sa_handler = handle_sigchld;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    reaping = sigaction(SIGCHLD, &action, nullptr) == 0;
+  }
+  reap_unreaped();
+
+  std::string id_var = "DESKTOP_STARTUP_ID=" + startup_id;
+  pid_t pid = spawn_shell(command.c_str(), {id_var.c_str()});
+  if (pid < 0) {
+    wlr_log_errno(WLR_ERROR, "Can't run %s", command.c_str());
+    return pid;
+  }
+  for (volatile pid_t &slot : unreaped) {
+    if (slot == 0) {
+      slot = pid;
+      // it may have exited already
+      reap_unreaped();
+      return pid;
+    }
+  }
+  wlr_log(WLR_ERROR, "Too many programs to reap, %s will be a zombie",
+          command.c_str());
+  return pid;
+}
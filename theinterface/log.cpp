@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "log.hpp"
+
+#define LOG_MAGIC 0x74696c67
+#define LOG_SLOTS 4096
+#define LOG_SLOT_SIZE 512
+/// messages per call site and second
+#define LOG_RATE_LIMIT 100
+/// call sites are told apart by their format string, hashed into this many
+/// counters
+#define LOG_RATE_SITES 1024
+#define LOG_JOURNAL_SOCKET "/run/systemd/journal/socket"
+
+/** A slot is free for the record at position pos of the ring when its
+ * sequence is pos, and holds it when its sequence is pos + 1. Writing the
+ * record out frees the slot for pos + LOG_SLOTS (a bounded MPMC queue, with a
+ * single consumer). */
+struct log_slot {
+  std::atomic<uint64_t> sequence;
+  /// position of the record, which orders the records of a dump
+  uint64_t index;
+  /// nanoseconds since log_init
+  int64_t time;
+  uint32_t importance;
+  uint32_t length;
+  char text[LOG_SLOT_SIZE - 32];
+};
+static_assert(sizeof(log_slot) == LOG_SLOT_SIZE, "log_slot has padding");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the ring must be usable from a crashed process' file");
+
+struct log_ring {
+  uint32_t magic;
+  uint32_t slots;
+  alignas(64) std::atomic<uint64_t> enqueue;
+  alignas(64) std::atomic<uint64_t> dequeue;
+  log_slot slot[LOG_SLOTS];
+};
+
+struct rate_site {
+  std::atomic<int64_t> second;
+  std::atomic<uint32_t> count;
+};
+
+static log_ring *ring = nullptr;
+static enum wlr_log_importance log_verbosity = WLR_ERROR;
+static int64_t log_start;
+static rate_site rate_sites[LOG_RATE_SITES];
+/// messages lost to the rate limit or a full ring since the last report
+static std::atomic<uint64_t> dropped{0};
+
+static int out_fd = STDERR_FILENO;
+static bool out_journal = false;
+static std::thread writer;
+static std::atomic<bool> stopping{false};
+/// 1 while the writer waits for records, as a futex
+static std::atomic<int> writer_sleeping{0};
+/// held by whoever writes records out: the writer, or a crash handler
+static std::atomic<bool> draining{false};
+
+static const char *importance_names[] = {"", "ERROR", "INFO", "DEBUG"};
+static const int journal_priorities[] = {0, 3, 6, 7};
+
+static int64_t now_nsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long futex(std::atomic<int> *addr, int op, int value) {
+  return syscall(SYS_futex, reinterpret_cast<int *>(addr), op, value, nullptr,
+                 nullptr, 0);
+}
+
+static bool rate_allowed(const char *fmt, int64_t now) {
+  uint64_t hash = ((uintptr_t)fmt >> 3) * 0x9e3779b97f4a7c15;
+  rate_site &site = rate_sites[(hash >> 32) % LOG_RATE_SITES];
+  int64_t second = now / 1000000000;
+  if (site.second.load(std::memory_order_relaxed) != second) {
+    site.second.store(second, std::memory_order_relaxed);
+    site.count.store(0, std::memory_order_relaxed);
+  }
+  return site.count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT;
+}
+
+/** The wlr_log callback: formats the message into a free slot and publishes
+ * it. The message has to be formatted here, its arguments don't outlive the
+ * call. Costs a vsnprintf of at most a slot, and a futex wake when the writer
+ * sleeps. */
+static void log_callback(enum wlr_log_importance importance, const char *fmt,
+                         va_list args) {
+  if (importance > log_verbosity) {
+    return;
+  }
+  int64_t now = now_nsec();
+  if (!rate_allowed(fmt, now)) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  uint64_t pos = ring->enqueue.load(std::memory_order_relaxed);
+  log_slot *slot;
+  for (;;) {
+    slot = &ring->slot[pos % LOG_SLOTS];
+    uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == pos) {
+      if (ring->enqueue.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < pos) {
+      // the writer is a whole ring behind
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = ring->enqueue.load(std::memory_order_relaxed);
+    }
+  }
+
+  int length = vsnprintf(slot->text, sizeof(slot->text), fmt, args);
+  slot->index = pos;
+  slot->time = now - log_start;
+  slot->importance = importance;
+  slot->length = std::clamp(length, 0, (int)sizeof(slot->text) - 1);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+
+  /* The publish above and the check below must not be reordered, nor the
+   * writer's store of writer_sleeping and its pending() check: otherwise both
+   * can miss each other's store, and the record waits for the next one. */
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (writer_sleeping.load()) {
+    writer_sleeping.store(0);
+    futex(&writer_sleeping, FUTEX_WAKE_PRIVATE, 1);
+  }
+}
+
+/// the record as wlroots' own log prints it
+static int format_record(char *buffer, size_t size, const log_slot *slot) {
+  int64_t msec = slot->time / 1000000;
+  return snprintf(buffer, size, "%02d:%02d:%02d.%03d [%s] %.*s\n",
+                  (int)(msec / 3600000), (int)(msec / 60000 % 60),
+                  (int)(msec / 1000 % 60), (int)(msec % 1000),
+                  importance_names[std::min(slot->importance, 3u)],
+                  (int)slot->length, slot->text);
+}
+
+static void write_record(const log_slot *slot) {
+  char buffer[LOG_SLOT_SIZE + 64];
+  int length;
+  if (out_journal) {
+    length = snprintf(buffer, sizeof(buffer),
+                      "PRIORITY=%d\nSYSLOG_IDENTIFIER=theinterface\nMESSAGE=",
+                      journal_priorities[std::min(slot->importance, 3u)]);
+    for (uint32_t i = 0; i < slot->length; ++i) {
+      // a newline would end the field
+      buffer[length++] = slot->text[i] == '\n' ? ' ' : slot->text[i];
+    }
+    buffer[length++] = '\n';
+  } else {
+    length = std::min(format_record(buffer, sizeof(buffer), slot),
+                      (int)sizeof(buffer) - 1);
+  }
+  if (write(out_fd, buffer, length) < 0) {
+    // nowhere left to complain
+  }
+}
+
+/// writes out the published records, returns false if there were none
+static bool drain() {
+  bool any = false;
+  for (;;) {
+    uint64_t pos = ring->dequeue.load(std::memory_order_relaxed);
+    log_slot *slot = &ring->slot[pos % LOG_SLOTS];
+    if (slot->sequence.load(std::memory_order_acquire) != pos + 1) {
+      break;
+    }
+    write_record(slot);
+    slot->sequence.store(pos + LOG_SLOTS, std::memory_order_release);
+    ring->dequeue.store(pos + 1, std::memory_order_relaxed);
+    any = true;
+  }
+
+  uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+  if (lost > 0) {
+    log_slot note = {};
+    note.time = now_nsec() - log_start;
+    note.importance = WLR_ERROR;
+    note.length = snprintf(note.text, sizeof(note.text),
+                           "[log] %lu messages dropped", (unsigned long)lost);
+    write_record(&note);
+  }
+  return any;
+}
+
+static bool pending() {
+  uint64_t pos = ring->dequeue.load(std::memory_order_relaxed);
+  return ring->slot[pos % LOG_SLOTS].sequence.load() == pos + 1;
+}
+
+static void writer_run() {
+  prctl(PR_SET_NAME, "ti-log");
+  while (!stopping) {
+    draining = true;
+    bool any = drain();
+    draining = false;
+    if (any) {
+      continue;
+    }
+    // a record published after this store sees the writer asleep and wakes it
+    writer_sleeping.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!pending() && !stopping) {
+      futex(&writer_sleeping, FUTEX_WAIT_PRIVATE, 1);
+    }
+    writer_sleeping.store(0);
+  }
+  draining = true;
+  drain();
+  draining = false;
+}
+
+static void log_finish() {
+  stopping = true;
+  writer_sleeping.store(0);
+  futex(&writer_sleeping, FUTEX_WAKE_PRIVATE, 1);
+  if (writer.joinable()) {
+    writer.join();
+  }
+}
+
+/// writes out what the writer didn't get to, unless the writer is the thread
+/// that crashed in the middle of it
+static void handle_crash(int sig) {
+  if (!draining.exchange(true)) {
+    drain();
+  }
+  raise(sig);
+}
+
+static int open_output() {
+  const char *dest = getenv("TI_LOG_FILE");
+  if (dest == nullptr || *dest == '\0') {
+    return STDERR_FILENO;
+  }
+
+  if (strcmp(dest, "journal") == 0) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, LOG_JOURNAL_SOCKET, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      out_journal = true;
+      return fd;
+    }
+    wlr_log_errno(WLR_ERROR, "Can't connect to the journal");
+    if (fd >= 0) {
+      close(fd);
+    }
+    return STDERR_FILENO;
+  }
+
+  int fd = open(dest, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    wlr_log_errno(WLR_ERROR, "Can't open the log file %s", dest);
+    return STDERR_FILENO;
+  }
+  return fd;
+}
+
+/// the ring file in $XDG_RUNTIME_DIR, or anonymous memory without one
+static log_ring *map_ring() {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  int fd = -1;
+  if (runtime_dir != nullptr && *runtime_dir != '\0') {
+    std::string path = std::string(runtime_dir) + "/theinterface.ring";
+    rename(path.c_str(), (path + ".old").c_str());
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0 && ftruncate(fd, sizeof(log_ring)) < 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  void *data = mmap(nullptr, sizeof(log_ring), PROT_READ | PROT_WRITE,
+                    fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS, fd, 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  // the file is zeroed, so only what isn't zero needs setting
+  auto *new_ring = reinterpret_cast<log_ring *>(data);
+  new_ring->magic = LOG_MAGIC;
+  new_ring->slots = LOG_SLOTS;
+  for (uint64_t i = 0; i < LOG_SLOTS; ++i) {
+    new_ring->slot[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  return new_ring;
+}
+
+void ti::log_init(enum wlr_log_importance verbosity) {
+  // until the ring is set up, errors go to stderr
+  wlr_log_init(verbosity, nullptr);
+
+  ring = map_ring();
+  if (ring == nullptr) {
+    wlr_log_errno(WLR_ERROR, "Can't map the log ring, logging synchronously");
+    return;
+  }
+  out_fd = open_output();
+  log_verbosity = verbosity;
+  log_start = now_nsec();
+
+  writer = std::thread(writer_run);
+  atexit(log_finish);
+
+  struct sigaction action = {};
+  action.sa_handler = handle_crash;
+  action.sa_flags = SA_RESETHAND;
+  sigemptyset(&action.sa_mask);
+  for (int sig : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}) {
+    sigaction(sig, &action, nullptr);
+  }
+
+  wlr_log_init(verbosity, log_callback);
+}
+
+bool ti::log_dump(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size == sizeof(log_ring)) {
+    data = mmap(nullptr, sizeof(log_ring), PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  const auto *dump = reinterpret_cast<const log_ring *>(data);
+  if (data == MAP_FAILED || dump->magic != LOG_MAGIC ||
+      dump->slots != LOG_SLOTS) {
+    fprintf(stderr, "%s isn't a log ring\n", path);
+    if (data != MAP_FAILED) {
+      munmap(data, sizeof(log_ring));
+    }
+    return false;
+  }
+
+  // published records, whether or not they were written out
+  std::vector<const log_slot *> records;
+  for (const log_slot &slot : dump->slot) {
+    uint64_t sequence = slot.sequence.load();
+    if (slot.length > 0 && (sequence == slot.index + 1 ||
+                            sequence == slot.index + LOG_SLOTS)) {
+      records.push_back(&slot);
+    }
+  }
+  std::sort(records.begin(), records.end(),
+            [](const log_slot *a, const log_slot *b) {
+              return a->index < b->index;
+            });
+
+  char buffer[LOG_SLOT_SIZE + 64];
+  for (const log_slot *slot : records) {
+    format_record(buffer, sizeof(buffer), slot);
+    fputs(buffer, stdout);
+  }
+  munmap(data, sizeof(log_ring));
+  return true;
+}
@@ -10,7 +10,13 @@ extern "C" {
 }
 
 #include "cursor.hpp"
+#include "desktop.hpp"
+#include "launch.hpp"
+#include "launcher.hpp"
+#include "log.hpp"
+#include "record.hpp"
 #include "server.hpp"
+#include "startup.hpp"
 #include "util.hpp"
 
 ti::server *server;
@@ -18,53 +24,60 @@ ti::server *server;
 static void ti_atexit() { delete server; }
 
 int main(int argc, char *argv[]) {
-  /// using WLR_DEBUG slows the compositor down significantly, so the user needs
-  /// to set the TI_DEBUG env var explicitly to have the debug log
-  const bool TI_DEBUG = getenv("TI_DEBUG");
-  wlr_log_init(TI_DEBUG ? WLR_DEBUG : WLR_INFO, NULL);
-
   char *startup_cmd = NULL;
 
   int c;
-  while ((c = getopt(argc, argv, "s:h")) != -1) {
+  while ((c = getopt(argc, argv, "s:d:p:h")) != -1) {
     switch (c) {
     case 's':
       startup_cmd = optarg;
       break;
+    case 'd':
+      return ti::log_dump(optarg) ? EXIT_SUCCESS : EXIT_FAILURE;
+    case 'p':
+      return ti::record_print(optarg) ? EXIT_SUCCESS : EXIT_FAILURE;
     default:
-      std::printf("Usage: %s [-s startup command]\n", argv[0]);
+      std::printf("Usage: %s [-s startup command] [-d log ring] "
+                  "[-p recording]\n",
+                  argv[0]);
       return 0;
     }
   }
   if (optind < argc) {
-    std::printf("Usage: %s [-s startup command]\n", argv[0]);
+    std::printf("Usage: %s [-s startup command] [-d log ring] "
+                "[-p recording]\n",
+                argv[0]);
     return 0;
   }
 
-  // if vmwgfx driver is detected, don't use hardware cursors unless the user
-  // asks for it explicitly by exporting WLR_NO_HARDWARE_CURSORS=0
-  if (getenv("WLR_NO_HARDWARE_CURSORS") == nullptr) {
-    if (possible_no_hardware_cursor_support()) {
-      setenv("WLR_NO_HARDWARE_CURSORS", "1", true);
-    }
+  // before the compositor grows: every program is started from the launcher
+  {
+    ti::startup_phase phase("launcher");
+    ti::launcher_start();
   }
 
+  /// even asynchronous, the debug log costs a formatted message per call, so
+  /// the user needs to set the TI_DEBUG env var explicitly to have it
+  const bool TI_DEBUG = getenv("TI_DEBUG");
+  ti::log_init(TI_DEBUG ? WLR_DEBUG : WLR_INFO);
+
   // Run the constructor for the ti::server class
-  server = new ti::server();
+  {
+    ti::startup_phase phase("server");
+    server = new ti::server();
+  }
   // we will need atexit from now on, for cleanly closing the server
   atexit(ti_atexit);
 
   if (startup_cmd) {
-    if (fork() == 0) {
-      execl("/bin/sh", "/bin/sh", "-c", startup_cmd, nullptr);
-    }
+    server->desktop->launches->spawn(startup_cmd);
   }
 
   /* Run the Wayland event loop. This does not return until you exit the
    * compositor. Starting the backend rigged up all of the necessary event
    * loop configuration to listen to libinput events, DRM events, generate
    * frame events at the refresh rate, and so on. */
-  wl_display_run(server->display);
+  server->run();
 
   return EXIT_SUCCESS;
 }
\ No newline at end of file
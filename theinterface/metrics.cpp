@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+}
+
+#include "clients.hpp"
+#include "desktop.hpp"
+#include "launch.hpp"
+#include "output.hpp"
+#include "server.hpp"
+#include "view.hpp"
+
+#include "metrics.hpp"
+
+#define METRICS_UPDATE_MSEC 1000
+
+/* Every allocation of the compositor's own code goes through these. The
+ * counters are relaxed increments: allocating from the log writer or a
+ * startup thread doesn't need to be ordered with anything. */
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> deallocations{0};
+
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p != nullptr) {
+    deallocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  free(p);
+}
+
+void operator delete(void *p, std::size_t size) noexcept {
+  operator delete(p);
+}
+
+static int64_t now_usec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int handle_update_timer(void *data) {
+  auto *metrics = reinterpret_cast<ti::metrics *>(data);
+  metrics->update();
+  return 0;
+}
+
+ti::metrics::metrics(ti::desktop *desktop, const char *display) {
+  this->desktop = desktop;
+
+  // anonymous memory without a runtime directory: nobody can read it, but it
+  // needs no checks when updating
+  path = ti::metrics_path(display);
+  int fd = -1;
+  if (!path.empty()) {
+    // a new file, for readers of the previous one to notice
+    unlink(path.c_str());
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0 && ftruncate(fd, sizeof(ti::metrics_page)) < 0) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd < 0) {
+      wlr_log_errno(WLR_ERROR, "Unable to create %s", path.c_str());
+      path.clear();
+    }
+  }
+  void *data = mmap(nullptr, sizeof(ti::metrics_page), PROT_READ | PROT_WRITE,
+                    fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS, fd, 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (data == MAP_FAILED) {
+    // never freed, like the mapping is never unmapped
+    data = aligned_alloc(alignof(ti::metrics_page), sizeof(ti::metrics_page));
+  }
+  page = new (data) ti::metrics_page();
+  page->magic = TI_METRICS_MAGIC;
+  page->version = TI_METRICS_VERSION;
+  page->size = sizeof(ti::metrics_data);
+  page->pid = getpid();
+  page->data.start_usec = now_usec();
+  last_update_usec = page->data.start_usec;
+  if (!path.empty()) {
+    wlr_log(WLR_INFO, "Publishing metrics in %s", path.c_str());
+  }
+
+  struct wl_event_loop *loop =
+      wl_display_get_event_loop(desktop->server->display);
+  timer = wl_event_loop_add_timer(loop, handle_update_timer, this);
+  wl_event_source_timer_update(timer, METRICS_UPDATE_MSEC);
+}
+
+ti::metrics::~metrics() {
+  wl_event_source_remove(timer);
+  if (!path.empty()) {
+    // readers still mapping it see the link count drop to 0
+    unlink(path.c_str());
+  }
+}
+
+void ti::metrics::begin_write() {
+  uint32_t sequence = page->sequence.load(std::memory_order_relaxed);
+  page->sequence.store(sequence + 1, std::memory_order_relaxed);
+  // the odd sequence is visible before any of the stores that follow
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ti::metrics::end_write() {
+  uint32_t sequence = page->sequence.load(std::memory_order_relaxed);
+  page->sequence.store(sequence + 1, std::memory_order_release);
+}
+
+void ti::metrics::output_frame(ti::output *output, int64_t start_usec) {
+  auto it = outputs.find(output);
+  bool fresh = it == outputs.end();
+  if (fresh) {
+    // the lowest slot no output uses, outputs that went away free theirs
+    bool used[TI_METRICS_OUTPUTS] = {};
+    for (auto &entry : outputs) {
+      used[entry.second.index] = true;
+    }
+    output_slot slot;
+    slot.index = 0;
+    while (slot.index < TI_METRICS_OUTPUTS && used[slot.index]) {
+      ++slot.index;
+    }
+    if (slot.index == TI_METRICS_OUTPUTS) {
+      return;
+    }
+    it = outputs.emplace(output, slot).first;
+  }
+  output_slot &slot = it->second;
+  int64_t now = now_usec();
+  auto frame_usec = (uint32_t)(now - start_usec);
+  slot.second_max_usec = std::max(slot.second_max_usec, frame_usec);
+
+  struct wlr_output *wlr_output = output->wlr_output;
+  const ti::damage_stats &damage = output->damage_stats;
+  ti::metrics_data &data = page->data;
+  ti::metrics_output &m = data.outputs[slot.index];
+
+  begin_write();
+  if (fresh) {
+    m = {};
+    data.output_count = std::max<uint32_t>(data.output_count, slot.index + 1);
+    snprintf(m.name, sizeof(m.name), "%s", wlr_output->name);
+  }
+  m.width = wlr_output->width;
+  m.height = wlr_output->height;
+  m.refresh_mhz = wlr_output->refresh;
+  ++m.frames;
+  m.frame_usec = frame_usec;
+  // an exponential moving average over about 16 frames
+  m.frame_usec_avg = m.frame_usec_avg == 0
+                         ? frame_usec
+                         : m.frame_usec_avg + ((int64_t)frame_usec -
+                                               (int64_t)m.frame_usec_avg) / 16;
+  m.interval_usec = slot.last_commit_usec ? now - slot.last_commit_usec : 0;
+  m.damaged_pixels = damage.damaged_pixels;
+  m.damage_fps = damage.fps;
+  m.damage_last_percent = damage.last_percent;
+  m.damage_avg_percent = damage.avg_percent;
+  m.damage_max_percent = damage.max_percent;
+  m.damage_avg_rects = damage.avg_rects;
+  data.updated_usec = now;
+  end_write();
+
+  slot.last_commit_usec = now;
+}
+
+void ti::metrics::output_destroyed(ti::output *output) {
+  auto it = outputs.find(output);
+  if (it == outputs.end()) {
+    return;
+  }
+  // readers skip the slots without a name
+  begin_write();
+  page->data.outputs[it->second.index] = {};
+  end_write();
+  outputs.erase(it);
+}
+
+void ti::metrics::update() {
+  wl_event_source_timer_update(timer, METRICS_UPDATE_MSEC);
+  int64_t now = now_usec();
+  double seconds = std::max<int64_t>(now - last_update_usec, 1) / 1e6;
+  ti::server *server = desktop->server;
+
+  uint32_t views = 0, mapped_views = 0;
+  ti::view *view;
+  wl_list_for_each(view, &desktop->views, link) {
+    ++views;
+    mapped_views += view->mapped;
+  }
+
+  desktop->clients->tick();
+  std::vector<ti::client_stats *> clients;
+  clients.reserve(desktop->clients->clients.size());
+  for (auto &entry : desktop->clients->clients) {
+    clients.push_back(entry.second);
+  }
+  size_t client_count = std::min<size_t>(clients.size(), TI_METRICS_CLIENTS);
+  std::partial_sort(clients.begin(), clients.begin() + client_count,
+                    clients.end(), [](auto *a, auto *b) {
+                      if (a->damaged_pixels.per_sec !=
+                          b->damaged_pixels.per_sec) {
+                        return a->damaged_pixels.per_sec >
+                               b->damaged_pixels.per_sec;
+                      }
+                      return a->commits.per_sec > b->commits.per_sec;
+                    });
+
+  uint64_t alloc = allocations.load(std::memory_order_relaxed);
+  uint64_t dealloc = deallocations.load(std::memory_order_relaxed);
+
+  ti::metrics_data &data = page->data;
+  begin_write();
+  data.updated_usec = now;
+  data.views = views;
+  data.mapped_views = mapped_views;
+  data.connected_clients = clients.size();
+
+  const ti::launch_stats &launches = desktop->launches->all;
+  data.launches = launches.count;
+  data.launch_last_msec = launches.last;
+  data.launch_p50_msec = desktop->launches->recent_median();
+  data.launch_max_msec = launches.max;
+
+  data.allocations = alloc;
+  data.deallocations = dealloc;
+  data.allocations_per_sec = (alloc - last_allocations) / seconds;
+
+  data.loop_busy_usec = server->loop_busy_usec;
+  data.loop_dispatches = server->loop_dispatches;
+  data.loop_busy_percent =
+      (server->loop_busy_usec - last_loop_busy_usec) / (seconds * 1e4);
+  data.loop_dispatches_per_sec =
+      (server->loop_dispatches - last_loop_dispatches) / seconds;
+
+  for (auto &entry : outputs) {
+    data.outputs[entry.second.index].frame_usec_max =
+        entry.second.second_max_usec;
+    entry.second.second_max_usec = 0;
+  }
+
+  // budgets are per view, a client is flagged if any of its views is
+  std::vector<const ti::client_stats *> flagged;
+  wl_list_for_each(view, &desktop->views, link) {
+    if (view->budget.flagged && view->surface != nullptr) {
+      flagged.push_back(desktop->clients->from_surface(view->surface));
+    }
+  }
+
+  data.client_count = client_count;
+  for (size_t i = 0; i < client_count; ++i) {
+    const ti::client_stats *c = clients[i];
+    ti::metrics_client &m = data.clients[i];
+    m.pid = c->pid;
+    m.uid = c->uid;
+    snprintf(m.name, sizeof(m.name), "%s", c->name.c_str());
+    m.commits = c->commits.total;
+    m.commits_per_sec = c->commits.per_sec;
+    m.wasted_commits = c->wasted_commits.total;
+    m.wasted_commits_per_sec = c->wasted_commits.per_sec;
+    m.damaged_pixels_per_sec = c->damaged_pixels.per_sec;
+    m.frame_callbacks_per_sec = c->frame_callbacks.per_sec;
+    m.shm_bytes = c->shm_bytes;
+    m.texture_bytes = c->texture_bytes;
+    m.throttled_commits_per_sec = c->throttled_commits.per_sec;
+    m.flagged =
+        std::find(flagged.begin(), flagged.end(), c) != flagged.end();
+  }
+  end_write();
+
+  last_allocations = alloc;
+  last_loop_busy_usec = server->loop_busy_usec;
+  last_loop_dispatches = server->loop_dispatches;
+  last_update_usec = now;
+}
@@ -1,19 +1,34 @@
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <ctime>
+#include <vector>
+
+#include <GLES2/gl2.h>
 
 extern "C" {
+#include <wlr/render/gles2.h>
 #include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
 #define static
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_matrix.h>
 #undef static
 }
 
+#include "budget.hpp"
+#include "clients.hpp"
 #include "desktop.hpp"
+#include "latency.hpp"
+#include "metrics.hpp"
+#include "record.hpp"
 #include "render.hpp"
+#include "screencopy.hpp"
+#include "seat.hpp"
 #include "server.hpp"
+#include "startup.hpp"
 #include "util.hpp"
 #include "view.hpp"
 #include "xdg_shell.hpp"
@@ -185,9 +200,210 @@ static void surface_send_frame_done_iterator(ti::output *output,
                                              struct wlr_box *box,
                                              float rotation, void *data) {
   auto *when = reinterpret_cast<const struct timespec *>(data);
+  output->desktop->clients->frame_done(surface);
   wlr_surface_send_frame_done(surface, when);
 }
 
+/** Fast path for an output with a fullscreen view: nothing but the view's
+ * surface tree is drawn, and the background is only cleared where the view
+ * doesn't cover the output (e.g. while the client hasn't resized yet). */
+static void render_fullscreen_view(ti::output *output,
+                                   ti::render_data *rdata) {
+  const float color[] = {0.0, 0.0, 0.0, 1.0};
+  struct wlr_renderer *renderer = output->desktop->server->renderer;
+  ti::view *view = output->fullscreen_view;
+
+  struct wlr_box *output_box =
+      wlr_output_layout_get_box(output->desktop->output_layout,
+                                output->wlr_output);
+  if (output_box == nullptr) {
+    return;
+  }
+  struct wlr_box box = {
+      .x = view->box.x - output_box->x,
+      .y = view->box.y - output_box->y,
+      .width = view->surface->current.width,
+      .height = view->surface->current.height,
+  };
+  scale_box(&box, output->wlr_output->scale);
+
+  pixman_region32_t uncovered;
+  pixman_region32_init(&uncovered);
+  pixman_region32_copy(&uncovered, rdata->damage);
+  pixman_region32_t covered;
+  pixman_region32_init_rect(&covered, box.x, box.y, box.width, box.height);
+  pixman_region32_subtract(&uncovered, &uncovered, &covered);
+  pixman_region32_fini(&covered);
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&uncovered, &nrects);
+  for (int i = 0; i < nrects; ++i) {
+    scissor_output(output->wlr_output, &rects[i]);
+    wlr_renderer_clear(renderer, color);
+  }
+  pixman_region32_fini(&uncovered);
+
+  view->render(output, rdata);
+}
+
+/// where the source's frame goes on the mirror: scaled to fit and centered
+static void get_mirror_box(ti::output *mirror, struct wlr_box *box) {
+  int sw, sh, mw, mh;
+  wlr_output_transformed_resolution(mirror->mirror_source->wlr_output, &sw,
+                                    &sh);
+  wlr_output_transformed_resolution(mirror->wlr_output, &mw, &mh);
+  float scale = std::min((float)mw / sw, (float)mh / sh);
+  box->width = std::round(sw * scale);
+  box->height = std::round(sh * scale);
+  box->x = (mw - box->width) / 2;
+  box->y = (mh - box->height) / 2;
+}
+
+/** Renders a mirror output: its source's last frame, from the mirror texture,
+ * only where the mirror is damaged. No view is rendered here. */
+static void render_mirror(ti::output *output, pixman_region32_t *damage) {
+  const float color[] = {0.0, 0.0, 0.0, 1.0};
+  struct wlr_renderer *renderer = output->desktop->server->renderer;
+  ti::output *source = output->mirror_source;
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+  for (int i = 0; i < nrects; ++i) {
+    scissor_output(output->wlr_output, &rects[i]);
+    wlr_renderer_clear(renderer, color);
+  }
+  if (source == nullptr || source->mirror_texture == nullptr) {
+    return;
+  }
+
+  struct wlr_box box;
+  get_mirror_box(output, &box);
+
+  // the texture holds the source's buffer, which is transformed like a client
+  // buffer would be, and stored bottom-up: flip it before anything else
+  float matrix[9];
+  enum wl_output_transform transform =
+      wlr_output_transform_invert(source->wlr_output->transform);
+  wlr_matrix_project_box(matrix, &box, transform, 0,
+                         output->wlr_output->transform_matrix);
+  wlr_matrix_translate(matrix, 0, 1);
+  wlr_matrix_scale(matrix, 1, -1);
+
+  for (int i = 0; i < nrects; ++i) {
+    scissor_output(output->wlr_output, &rects[i]);
+    wlr_render_texture_with_matrix(renderer, source->mirror_texture, matrix,
+                                   1.0);
+  }
+}
+
+/** (Re)creates the mirror texture of output if it doesn't match the output's
+ * size. Returns true if the texture is new, and needs a full copy. */
+static bool ensure_mirror_texture(ti::output *output) {
+  struct wlr_renderer *renderer = output->desktop->server->renderer;
+  int width = output->wlr_output->width;
+  int height = output->wlr_output->height;
+
+  if (output->mirror_texture != nullptr) {
+    int tw, th;
+    wlr_texture_get_size(output->mirror_texture, &tw, &th);
+    if (tw == width && th == height) {
+      return false;
+    }
+    wlr_texture_destroy(output->mirror_texture);
+    output->mirror_texture = nullptr;
+  }
+
+  // ABGR8888 is plain GL_RGBA, which any framebuffer can be copied into
+  std::vector<uint8_t> pixels(4 * width * height);
+  struct wlr_texture *texture = wlr_texture_from_pixels(
+      renderer, WL_SHM_FORMAT_ABGR8888, 4 * width, width, height,
+      pixels.data());
+  if (texture != nullptr && !wlr_texture_is_gles2(texture)) {
+    wlr_log(WLR_ERROR, "Mirroring needs the GLES2 renderer");
+    wlr_texture_destroy(texture);
+    texture = nullptr;
+  }
+  output->mirror_texture = texture;
+  return texture != nullptr;
+}
+
+/** Called on outputs with a frame still bound: copies the frame's damage
+ * (frame_damage, in buffer coordinates) into the mirror texture on the GPU,
+ * and damages the mirrors where it changed. */
+static void update_mirrors(ti::output *output,
+                           pixman_region32_t *frame_damage) {
+  bool mirrored = false;
+  ti::output *mirror;
+  wl_list_for_each(mirror, &output->desktop->outputs, link) {
+    if (mirror->mirror_source == output && mirror->wlr_output->enabled) {
+      mirrored = true;
+      break;
+    }
+  }
+  if (!mirrored) {
+    if (output->mirror_texture != nullptr) {
+      wlr_texture_destroy(output->mirror_texture);
+      output->mirror_texture = nullptr;
+    }
+    return;
+  }
+
+  int width = output->wlr_output->width;
+  int height = output->wlr_output->height;
+  bool full = ensure_mirror_texture(output);
+  if (output->mirror_texture == nullptr) {
+    return;
+  }
+
+  pixman_region32_t copy;
+  if (full) {
+    pixman_region32_init_rect(&copy, 0, 0, width, height);
+  } else {
+    pixman_region32_init(&copy);
+    pixman_region32_copy(&copy, frame_damage);
+  }
+
+  struct wlr_gles2_texture_attribs attribs;
+  wlr_gles2_texture_get_attribs(output->mirror_texture, &attribs);
+  glBindTexture(attribs.target, attribs.tex);
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&copy, &nrects);
+  for (int i = 0; i < nrects; ++i) {
+    // GL rows count from the bottom of the framebuffer
+    int w = rects[i].x2 - rects[i].x1;
+    int h = rects[i].y2 - rects[i].y1;
+    int y = height - rects[i].y2;
+    glCopyTexSubImage2D(attribs.target, 0, rects[i].x1, y, rects[i].x1, y, w,
+                        h);
+  }
+  glBindTexture(attribs.target, 0);
+  pixman_region32_fini(&copy);
+
+  int sw, sh;
+  wlr_output_transformed_resolution(output->wlr_output, &sw, &sh);
+  wl_list_for_each(mirror, &output->desktop->outputs, link) {
+    if (mirror->mirror_source != output || !mirror->wlr_output->enabled) {
+      continue;
+    }
+    if (full) {
+      wlr_output_damage_add_whole(mirror->damage);
+      continue;
+    }
+
+    struct wlr_box box;
+    get_mirror_box(mirror, &box);
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+    wlr_region_scale(&damage, &output->damage->current,
+                     (float)box.width / sw);
+    pixman_region32_translate(&damage, box.x, box.y);
+    // texture filtering bleeds into the neighbouring pixels
+    wlr_region_expand(&damage, &damage, 1);
+    wlr_output_damage_add(mirror->damage, &damage);
+    pixman_region32_fini(&damage);
+  }
+}
+
 /* This function is called every time an output is ready to display a frame,
  * generally at the output's refresh rate (e.g. 60Hz). */
 static void output_frame(struct wl_listener *listener, void *data) {
@@ -197,15 +413,44 @@ static void output_frame(struct wl_listener *listener, void *data) {
   const float color[] = {0.4, 0.4, 0.4, 1.0};
 
   enum wl_output_transform transform;
+  ti::view *view;
   ti::output *output = wl_container_of(listener, output, frame);
   struct wlr_renderer *renderer = output->desktop->server->renderer;
 
+  // the backend can still deliver a frame that was pending when the output
+  // got disabled
+  if (!output->wlr_output->enabled) {
+    return;
+  }
+
+  // a replay plays the frames of its recording instead of the backend's
+  ti::replayer *replayer = output->desktop->replayer;
+  if (replayer != nullptr && !replayer->owns_frame(output)) {
+    return;
+  }
+
   struct timespec now;
-  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (replayer != nullptr) {
+    now = replayer->now();
+  } else {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  }
+
+  // damage deferred by the commit budget is part of this frame
+  output->desktop->budget->frame();
 
   /// use this for debugging rendering functions in case nothing else works
   // wlr_output_damage_add_whole(output->damage);
 
+  /* The damage the scene accumulated for this frame, taken before the
+   * overlay adds its own. */
+  pixman_region32_t scene_damage;
+  pixman_region32_init(&scene_damage);
+  pixman_region32_copy(&scene_damage, &output->damage->current);
+  if (output->damage_overlay != nullptr) {
+    output->damage_overlay->begin_frame(&scene_damage);
+  }
+
   bool needs_frame;
   pixman_region32_t buffer_damage;
   pixman_region32_init(&buffer_damage);
@@ -213,12 +458,15 @@ static void output_frame(struct wl_listener *listener, void *data) {
   /* wlr_output_attach_render makes the OpenGL context current. */
   if (!wlr_output_damage_attach_render(output->damage, &needs_frame,
                                        &buffer_damage)) {
+    pixman_region32_fini(&scene_damage);
+    pixman_region32_fini(&buffer_damage);
     return;
   }
 
   ti::render_data rdata = {
       .damage = &buffer_damage,
       .alpha = 1.0,
+      .view = nullptr,
   };
 
   if (!needs_frame) {
@@ -237,6 +485,16 @@ static void output_frame(struct wl_listener *listener, void *data) {
     goto renderer_end;
   }
 
+  if (!output->mirror_of.empty()) {
+    render_mirror(output, &buffer_damage);
+    goto renderer_end;
+  }
+
+  if (output->fullscreen_view != nullptr) {
+    render_fullscreen_view(output, &rdata);
+    goto renderer_end;
+  }
+
   rects = pixman_region32_rectangles(&buffer_damage, &nrects);
   for (int i = 0; i < nrects; ++i) {
     scissor_output(output->wlr_output, &rects[i]);
@@ -245,12 +503,15 @@ static void output_frame(struct wl_listener *listener, void *data) {
 
   /* Each subsequent window we render is rendered on top of the last. Because
    * our view list is ordered front-to-back, we iterate over it backwards. */
-  ti::view *view;
   wl_list_for_each_reverse(view, &output->desktop->wem_views, wem_link) {
     view->render(output, &rdata);
   }
 
 renderer_end:
+  if (output->damage_overlay != nullptr) {
+    output->damage_overlay->render(&scene_damage, &buffer_damage);
+  }
+
   /* Hardware cursors are rendered by the GPU on a separate plane, and can be
    * moved around without re-rendering what's beneath them - which is more
    * efficient. However, not all hardware supports hardware cursors. For this
@@ -274,15 +535,153 @@ renderer_end:
                        width, height);
 
   wlr_output_set_damage(output->wlr_output, &frame_damage);
+  // copy the finished frame to screencopy clients before it gets swapped
+  output->desktop->screencopy->output_rendered(output, &frame_damage, &now);
+  update_mirrors(output, &frame_damage);
   pixman_region32_fini(&frame_damage);
 
-  wlr_output_commit(output->wlr_output);
+  if (wlr_output_commit(output->wlr_output)) {
+    ti::startup_first_frame();
+    if (pixman_region32_not_empty(&scene_damage)) {
+      output->desktop->latency->frame_committed(output);
+    }
+    if (output->damage_stats.add_frame(&scene_damage, width, height,
+                                       timespec_to_msec(now)) &&
+        output->damage_overlay != nullptr) {
+      output->damage_overlay->update_panel();
+    }
+    int64_t start_usec = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    output->desktop->metrics->output_frame(output, start_usec);
+    if (output->desktop->recorder != nullptr) {
+      output->desktop->recorder->frame(output, start_usec);
+    }
+    if (replayer != nullptr) {
+      replayer->frame();
+    }
+  }
 
 buffer_damage_finish:
   pixman_region32_fini(&buffer_damage);
+  pixman_region32_fini(&scene_damage);
+
+  /* Send frame done events only to the views this output is the primary output
+   * of. A view spanning outputs with different refresh rates would otherwise
+   * get callbacks at an irregular, combined cadence. Views hidden beneath a
+   * fullscreen view don't get any. */
+  if (output->fullscreen_view != nullptr) {
+    view = output->fullscreen_view;
+    if (view->primary_output == output &&
+        !output->desktop->budget->hold_frame_done(view, output)) {
+      output->view_for_each_surface(view, surface_send_frame_done_iterator,
+                                    &now);
+    }
+    return;
+  }
+  wl_list_for_each_reverse(view, &output->desktop->wem_views, wem_link) {
+    if (view->primary_output == output &&
+        !output->desktop->budget->hold_frame_done(view, output)) {
+      output->view_for_each_surface(view, surface_send_frame_done_iterator,
+                                    &now);
+    }
+  }
+}
+
+/** Looks name up in TI_MIRROR, a comma separated list of mirror=source pairs
+ * of output names. Returns the name of the output to mirror, or "". */
+static std::string get_mirror_of(const char *name) {
+  const char *env = getenv("TI_MIRROR");
+  if (env == nullptr) {
+    return "";
+  }
+
+  std::string pairs = env;
+  size_t start = 0;
+  while (start < pairs.size()) {
+    size_t end = pairs.find(',', start);
+    if (end == std::string::npos) {
+      end = pairs.size();
+    }
+    std::string pair = pairs.substr(start, end - start);
+    size_t eq = pair.find('=');
+    if (eq != std::string::npos && pair.substr(0, eq) == name) {
+      return pair.substr(eq + 1);
+    }
+    start = end + 1;
+  }
+  return "";
+}
+
+/// connects mirrors to their sources, which can show up in any order
+static void update_mirror_sources(ti::desktop *desktop) {
+  ti::output *mirror, *source;
+  wl_list_for_each(mirror, &desktop->outputs, link) {
+    if (mirror->mirror_of.empty() || mirror->mirror_source != nullptr) {
+      continue;
+    }
+    wl_list_for_each(source, &desktop->outputs, link) {
+      // mirrors of mirrors aren't supported
+      if (source->mirror_of.empty() &&
+          mirror->mirror_of == source->wlr_output->name) {
+        wlr_log(WLR_INFO, "Mirroring output %s on %s",
+                source->wlr_output->name, mirror->wlr_output->name);
+        mirror->mirror_source = source;
+        // the source's next frame fills the mirror texture
+        wlr_output_damage_add_whole(source->damage);
+        wlr_output_damage_add_whole(mirror->damage);
+        break;
+      }
+    }
+  }
+}
+
+/** The output is gone, e.g. unplugged: nothing may point to it anymore. This
+ * runs before the wlr_output_damage and the output layout, which listen to
+ * the wlr_output too, let go of it. */
+static void output_destroy(struct wl_listener *listener, void *data) {
+  ti::output *output = wl_container_of(listener, output, destroy);
+  ti::desktop *desktop = output->desktop;
+  wlr_log(WLR_INFO, "Output %s destroyed", output->wlr_output->name);
 
-  // Send frame done events to all surfaces
-  output->for_each_surface(surface_send_frame_done_iterator, &now);
+  if (output->fullscreen_view != nullptr) {
+    output->fullscreen_view->set_fullscreen(false, nullptr);
+  }
+  ti::view *view;
+  wl_list_for_each(view, &desktop->views, link) {
+    if (view->primary_output == output) {
+      view->primary_output = nullptr;
+    }
+  }
+
+  ti::output *mirror;
+  wl_list_for_each(mirror, &desktop->outputs, link) {
+    if (mirror->mirror_source == output) {
+      mirror->mirror_source = nullptr;
+      wlr_output_damage_add_whole(mirror->damage);
+    }
+  }
+
+  desktop->screencopy->output_destroyed(output);
+  desktop->latency->output_destroyed(output);
+  desktop->metrics->output_destroyed(output);
+  if (desktop->recorder != nullptr) {
+    desktop->recorder->output_destroyed(output);
+  }
+  if (desktop->replayer != nullptr) {
+    desktop->replayer->output_destroyed(output);
+  }
+
+  wl_list_remove(&output->frame.link);
+  wl_list_remove(&output->destroy.link);
+  wl_list_remove(&output->link);
+  output->wlr_output->data = nullptr;
+  if (output->mirror_texture != nullptr) {
+    wlr_texture_destroy(output->mirror_texture);
+  }
+  delete output->damage_overlay;
+  delete output;
+
+  // views on the output are now on the others, or nowhere
+  desktop->update_primary_outputs();
 }
 
 void handle_new_output(struct wl_listener *listener, void *data) {
@@ -316,7 +715,15 @@ void handle_new_output(struct wl_listener *listener, void *data) {
   ti::output *output = new ti::output;
   output->wlr_output = wlr_output;
   output->desktop = desktop;
+  // before the damage and the layout, which also go away with the output
+  output->destroy.notify = output_destroy;
+  wl_signal_add(&wlr_output->events.destroy, &output->destroy);
   output->damage = wlr_output_damage_create(wlr_output);
+  output->mirror_of = get_mirror_of(wlr_output->name);
+  wlr_output->data = output;
+  if (desktop->damage_debug) {
+    output->damage_overlay = new ti::damage_overlay(output);
+  }
 
   /* Sets up a listener for the frame notify event. */
   output->frame.notify = output_frame;
@@ -331,11 +738,26 @@ void handle_new_output(struct wl_listener *listener, void *data) {
    * display, which Wayland clients can see to find out information about the
    * output (such as DPI, scale factor, manufacturer, etc).
    */
-  wlr_output_layout_add_auto(desktop->output_layout, wlr_output);
+  if (output->mirror_of.empty()) {
+    wlr_output_layout_add_auto(desktop->output_layout, wlr_output);
+  } else {
+    // a mirror has no place in the layout, but clients still see it
+    wlr_output_create_global(wlr_output);
+  }
+  update_mirror_sources(desktop);
+  // the new output may need a scale the cursor isn't loaded at yet
+  desktop->seat->cursor_image = nullptr;
 
   wlr_output_damage_add_whole(output->damage);
 }
 
+ti::output *output_from_wlr_output(struct wlr_output *wlr_output) {
+  if (wlr_output == nullptr) {
+    return nullptr;
+  }
+  return reinterpret_cast<ti::output *>(wlr_output->data);
+}
+
 void ti::output::get_decoration_box(ti::view &view, struct wlr_box &box) {
   struct wlr_box deco_box;
   view.get_deco_box(deco_box);
@@ -356,12 +778,25 @@ void ti::output::get_decoration_box(ti::view &view, struct wlr_box &box) {
 }
 
 void ti::output::damage_partial_view(ti::view *view) {
+  // mirrors are only damaged by their source
+  if (!wlr_output->enabled || !mirror_of.empty()) {
+    return;
+  }
+  if (fullscreen_view != nullptr && fullscreen_view != view) {
+    return;
+  }
   /// TODO: incomplete
   bool whole = false;
   this->view_for_each_surface(view, damage_surface_iterator, &whole);
 }
 
 void ti::output::damage_whole_view(ti::view *view) {
+  if (!wlr_output->enabled || !mirror_of.empty()) {
+    return;
+  }
+  if (fullscreen_view != nullptr && fullscreen_view != view) {
+    return;
+  }
 
   damage_whole_decoration(view, this);
 
@@ -371,9 +806,35 @@ void ti::output::damage_whole_view(ti::view *view) {
 
 void ti::output::for_each_surface(ti_surface_iterator_func_t iterator,
                                   void *user_data) {
-  /// TODO: re-add fullscreen, drag icons, layers
+  /// TODO: re-add drag icons, layers
+  if (fullscreen_view != nullptr) {
+    this->view_for_each_surface(fullscreen_view, iterator, user_data);
+    return;
+  }
+
   ti::view *view;
   wl_list_for_each_reverse(view, &desktop->wem_views, wem_link) {
     this->view_for_each_surface(view, iterator, user_data);
   }
 }
+
+void ti::output::set_enabled(bool enabled) {
+  if (wlr_output->enabled == enabled) {
+    return;
+  }
+
+  wlr_output_enable(wlr_output, enabled);
+  if (!wlr_output_commit(wlr_output)) {
+    wlr_log(WLR_ERROR, "Failed to turn output %s %s", wlr_output->name,
+            enabled ? "on" : "off");
+    return;
+  }
+  wlr_log(WLR_DEBUG, "Output %s turned %s", wlr_output->name,
+          enabled ? "on" : "off");
+
+  if (enabled) {
+    // nothing was tracked while the output was off
+    wlr_output_damage_add_whole(damage);
+  }
+  desktop->update_primary_outputs();
+}
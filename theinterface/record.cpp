@@ -0,0 +1,595 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+}
+
+#include "clients.hpp"
+#include "desktop.hpp"
+#include "output.hpp"
+#include "seat.hpp"
+#include "server.hpp"
+#include "util.hpp"
+
+#include "record.hpp"
+
+#define RECORD_BUFFER_SIZE 65536
+#define RECORD_FLUSH_MSEC 1000
+
+static int64_t now_usec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/// a multiplicative hash eight bytes at a time, fast enough for every commit
+static uint64_t hash_pixels(const uint8_t *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+static int handle_flush_timer(void *data) {
+  auto *recorder = reinterpret_cast<ti::recorder *>(data);
+  recorder->flush();
+  return 0;
+}
+
+ti::recorder::recorder(ti::desktop *desktop, const char *path) {
+  this->desktop = desktop;
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    wlr_log_errno(WLR_ERROR, "Unable to record to %s", path);
+  } else {
+    wlr_log(WLR_INFO, "Recording to %s", path);
+  }
+
+  buffer.reserve(RECORD_BUFFER_SIZE + 256);
+  ti::record_file_header header = {
+      .magic = TI_RECORD_MAGIC,
+      .version = TI_RECORD_VERSION,
+      .started = (int64_t)time(nullptr),
+  };
+  auto *bytes = reinterpret_cast<const uint8_t *>(&header);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(header));
+  last_usec = now_usec();
+
+  double cursor[2] = {desktop->seat->cursor->x, desktop->seat->cursor->y};
+  add(ti::RECORD_CURSOR, cursor, sizeof(cursor));
+
+  struct wl_event_loop *loop =
+      wl_display_get_event_loop(desktop->server->display);
+  flush_timer = wl_event_loop_add_timer(loop, handle_flush_timer, this);
+  wl_event_source_timer_update(flush_timer, RECORD_FLUSH_MSEC);
+}
+
+ti::recorder::~recorder() {
+  flush();
+  wl_event_source_remove(flush_timer);
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void ti::recorder::add(ti::record_type type, const void *payload,
+                       size_t size) {
+  int64_t now = now_usec();
+  int64_t delta = now - last_usec;
+  last_usec = now;
+  if (delta > UINT32_MAX) {
+    uint64_t pause = delta;
+    delta = 0;
+    add(ti::RECORD_PAUSE, &pause, sizeof(pause));
+  }
+
+  ti::record_header header = {
+      .type = type,
+      .size = (uint8_t)size,
+      .reserved = 0,
+      .delta_usec = (uint32_t)delta,
+  };
+  auto *bytes = reinterpret_cast<const uint8_t *>(&header);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(header));
+  bytes = reinterpret_cast<const uint8_t *>(payload);
+  buffer.insert(buffer.end(), bytes, bytes + size);
+  if (buffer.size() >= RECORD_BUFFER_SIZE) {
+    flush();
+  }
+}
+
+void ti::recorder::flush() {
+  wl_event_source_timer_update(flush_timer, RECORD_FLUSH_MSEC);
+  size_t written = 0;
+  while (fd >= 0 && written < buffer.size()) {
+    ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      wlr_log_errno(WLR_ERROR, "Recording stopped");
+      close(fd);
+      fd = -1;
+    } else {
+      written += n;
+    }
+  }
+  buffer.clear();
+}
+
+void ti::recorder::motion(struct wlr_event_pointer_motion *event) {
+  ti::record_motion record = {event->time_msec, event->delta_x,
+                              event->delta_y};
+  add(ti::RECORD_MOTION, &record, sizeof(record));
+}
+
+void ti::recorder::motion_absolute(
+    struct wlr_event_pointer_motion_absolute *event) {
+  ti::record_motion record = {event->time_msec, event->x, event->y};
+  add(ti::RECORD_MOTION_ABSOLUTE, &record, sizeof(record));
+}
+
+void ti::recorder::button(struct wlr_event_pointer_button *event) {
+  ti::record_button record = {event->time_msec, event->button,
+                              (uint32_t)event->state};
+  add(ti::RECORD_BUTTON, &record, sizeof(record));
+}
+
+void ti::recorder::axis(struct wlr_event_pointer_axis *event) {
+  ti::record_axis record = {
+      .time_msec = event->time_msec,
+      .orientation = (uint8_t)event->orientation,
+      .source = (uint8_t)event->source,
+      .delta_discrete = event->delta_discrete,
+      .delta = event->delta,
+  };
+  add(ti::RECORD_AXIS, &record, sizeof(record));
+}
+
+void ti::recorder::pointer_frame() {
+  add(ti::RECORD_POINTER_FRAME, nullptr, 0);
+}
+
+void ti::recorder::key(struct wlr_event_keyboard_key *event) {
+  ti::record_key record = {event->time_msec, event->keycode,
+                           (uint32_t)event->state};
+  add(ti::RECORD_KEY, &record, sizeof(record));
+}
+
+void ti::recorder::frame(ti::output *output, int64_t start_usec) {
+  size_t index = 0;
+  while (index < outputs.size() && outputs[index] != output) {
+    ++index;
+  }
+  if (index == outputs.size()) {
+    outputs.push_back(output);
+    struct wlr_output *wlr_output = output->wlr_output;
+    ti::record_output record = {
+        .index = (uint8_t)index,
+        .width = wlr_output->width,
+        .height = wlr_output->height,
+        .refresh = wlr_output->refresh,
+        .name = {},
+    };
+    snprintf(record.name, sizeof(record.name), "%s", wlr_output->name);
+    add(ti::RECORD_OUTPUT, &record, sizeof(record));
+  }
+
+  ti::record_frame record = {(uint8_t)index,
+                             (uint32_t)(now_usec() - start_usec)};
+  add(ti::RECORD_FRAME, &record, sizeof(record));
+}
+
+void ti::recorder::output_destroyed(ti::output *output) {
+  for (ti::output *&o : outputs) {
+    if (o == output) {
+      o = nullptr;
+    }
+  }
+}
+
+void ti::recorder::commit(struct wlr_surface *surface,
+                          ti::client_stats *stats) {
+  ti::record_commit record = {
+      .pid = stats->pid,
+      .surface = wl_resource_get_id(surface->resource),
+      .width = surface->current.buffer_width,
+      .height = surface->current.buffer_height,
+      .hash = 0,
+  };
+  struct wlr_buffer *buffer = surface->buffer;
+  struct wl_shm_buffer *shm =
+      buffer != nullptr && buffer->resource != nullptr
+          ? wl_shm_buffer_get(buffer->resource)
+          : nullptr;
+  if (shm != nullptr) {
+    wl_shm_buffer_begin_access(shm);
+    auto *pixels =
+        reinterpret_cast<const uint8_t *>(wl_shm_buffer_get_data(shm));
+    record.hash = hash_pixels(pixels, (size_t)wl_shm_buffer_get_stride(shm) *
+                                          wl_shm_buffer_get_height(shm));
+    wl_shm_buffer_end_access(shm);
+  }
+  add(ti::RECORD_COMMIT, &record, sizeof(record));
+}
+
+void ti::replayer::prepare() {
+  setenv("WLR_BACKENDS", "headless", true);
+  setenv("WLR_LIBINPUT_NO_DEVICES", "1", true);
+}
+
+ti::replayer::replayer(ti::desktop *desktop) { this->desktop = desktop; }
+
+ti::replayer::~replayer() {
+  if (timer != nullptr) {
+    wl_event_source_remove(timer);
+  }
+}
+
+/// reads the whole of path into data
+static bool read_file(const char *path, std::vector<uint8_t> &data) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    wlr_log_errno(WLR_ERROR, "Unable to open %s", path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  data.resize(st.st_size);
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = read(fd, data.data() + done, data.size() - done);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    done += n;
+  }
+  close(fd);
+  data.resize(done);
+
+  ti::record_file_header header;
+  if (data.size() < sizeof(header)) {
+    wlr_log(WLR_ERROR, "%s is not a recording", path);
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != TI_RECORD_MAGIC ||
+      header.version != TI_RECORD_VERSION) {
+    wlr_log(WLR_ERROR, "%s is not a recording of version %d", path,
+            TI_RECORD_VERSION);
+    return false;
+  }
+  return true;
+}
+
+bool ti::replayer::load(const char *path) {
+  if (!read_file(path, data)) {
+    return false;
+  }
+  position = sizeof(ti::record_file_header);
+  return true;
+}
+
+static void find_headless(struct wlr_backend *backend, void *data) {
+  if (wlr_backend_is_headless(backend)) {
+    *reinterpret_cast<struct wlr_backend **>(data) = backend;
+  }
+}
+
+static int handle_play_timer(void *data) {
+  auto *replayer = reinterpret_cast<ti::replayer *>(data);
+  replayer->play();
+  return 0;
+}
+
+void ti::replayer::start() {
+  struct wlr_backend *backend = desktop->server->backend;
+  if (wlr_backend_is_headless(backend)) {
+    headless = backend;
+  } else if (wlr_backend_is_multi(backend)) {
+    wlr_multi_for_each_backend(backend, find_headless, &headless);
+  }
+  if (headless == nullptr) {
+    wlr_log(WLR_ERROR, "Replays need the headless backend");
+    return;
+  }
+
+  // the outputs of the whole recording, in the order they first showed
+  for (size_t p = position; p + sizeof(ti::record_header) <= data.size();) {
+    ti::record_header header;
+    memcpy(&header, &data[p], sizeof(header));
+    if (header.type == ti::RECORD_OUTPUT &&
+        header.size == sizeof(ti::record_output)) {
+      ti::record_output output;
+      memcpy(&output, &data[p + sizeof(header)], sizeof(output));
+      wlr_log(WLR_INFO, "Replaying output %s as %dx%d", output.name,
+              output.width, output.height);
+      outputs.push_back(
+          wlr_headless_add_output(headless, output.width, output.height));
+    }
+    p += sizeof(header) + header.size;
+  }
+  // handle_new_input gives it to the seat, like a real keyboard
+  keyboard = wlr_headless_add_input_device(headless, WLR_INPUT_DEVICE_KEYBOARD);
+
+  start_msec = timespec_to_msec(ti::monotonic_now());
+  struct wl_event_loop *loop =
+      wl_display_get_event_loop(desktop->server->display);
+  timer = wl_event_loop_add_timer(loop, handle_play_timer, this);
+  play();
+}
+
+uint32_t ti::replayer::event_time() {
+  return (uint32_t)(start_msec + record_usec / 1000);
+}
+
+timespec ti::replayer::now() {
+  int64_t usec = start_msec * 1000 + record_usec;
+  return {.tv_sec = usec / 1000000, .tv_nsec = usec % 1000000 * 1000};
+}
+
+void ti::replayer::output_destroyed(ti::output *output) {
+  for (struct wlr_output *&o : outputs) {
+    if (o == output->wlr_output) {
+      o = nullptr;
+    }
+  }
+}
+
+bool ti::replayer::owns_frame(ti::output *output) {
+  return output->wlr_output == frame_output;
+}
+
+void ti::replayer::play() {
+  int64_t elapsed_usec =
+      (timespec_to_msec(ti::monotonic_now()) - start_msec) * 1000;
+  while (position + sizeof(ti::record_header) <= data.size()) {
+    ti::record_header header;
+    memcpy(&header, &data[position], sizeof(header));
+    const uint8_t *payload = &data[position + sizeof(header)];
+    if (position + sizeof(header) + header.size > data.size()) {
+      break;
+    }
+
+    int64_t due = record_usec + header.delta_usec;
+    if (due > elapsed_usec) {
+      int msec = (due - elapsed_usec + 999) / 1000;
+      wl_event_source_timer_update(timer, ti::real_msec(msec));
+      return;
+    }
+    record_usec = due;
+    if (header.type == ti::RECORD_PAUSE) {
+      uint64_t pause;
+      memcpy(&pause, payload, sizeof(pause));
+      record_usec += pause;
+    } else {
+      dispatch(header, payload);
+    }
+    position += sizeof(header) + header.size;
+  }
+
+  wlr_log(WLR_INFO,
+          "Replay finished: %" PRIu64 " input events over %.1f s, %" PRIu64
+          " frames recorded, %" PRIu64 " replayed",
+          events, record_usec / 1e6, record_frames, replay_frames);
+  desktop->server->terminate();
+}
+
+void ti::replayer::dispatch(const ti::record_header &header,
+                            const uint8_t *payload) {
+  struct wlr_cursor *cursor = desktop->seat->cursor;
+  switch (header.type) {
+  case ti::RECORD_CURSOR: {
+    double p[2];
+    memcpy(p, payload, sizeof(p));
+    wlr_cursor_warp_closest(cursor, nullptr, p[0], p[1]);
+    break;
+  }
+  case ti::RECORD_MOTION: {
+    ti::record_motion record;
+    memcpy(&record, payload, sizeof(record));
+    struct wlr_event_pointer_motion event = {};
+    event.time_msec = event_time();
+    event.delta_x = event.unaccel_dx = record.x;
+    event.delta_y = event.unaccel_dy = record.y;
+    wl_signal_emit(&cursor->events.motion, &event);
+    ++events;
+    break;
+  }
+  case ti::RECORD_MOTION_ABSOLUTE: {
+    ti::record_motion record;
+    memcpy(&record, payload, sizeof(record));
+    struct wlr_event_pointer_motion_absolute event = {};
+    event.time_msec = event_time();
+    event.x = record.x;
+    event.y = record.y;
+    wl_signal_emit(&cursor->events.motion_absolute, &event);
+    ++events;
+    break;
+  }
+  case ti::RECORD_BUTTON: {
+    ti::record_button record;
+    memcpy(&record, payload, sizeof(record));
+    struct wlr_event_pointer_button event = {};
+    event.time_msec = event_time();
+    event.button = record.button;
+    event.state = (enum wlr_button_state)record.state;
+    wl_signal_emit(&cursor->events.button, &event);
+    ++events;
+    break;
+  }
+  case ti::RECORD_AXIS: {
+    ti::record_axis record;
+    memcpy(&record, payload, sizeof(record));
+    struct wlr_event_pointer_axis event = {};
+    event.time_msec = event_time();
+    event.orientation = (enum wlr_axis_orientation)record.orientation;
+    event.source = (enum wlr_axis_source)record.source;
+    event.delta = record.delta;
+    event.delta_discrete = record.delta_discrete;
+    wl_signal_emit(&cursor->events.axis, &event);
+    ++events;
+    break;
+  }
+  case ti::RECORD_POINTER_FRAME:
+    wl_signal_emit(&cursor->events.frame, cursor);
+    break;
+  case ti::RECORD_KEY: {
+    ti::record_key record;
+    memcpy(&record, payload, sizeof(record));
+    struct wlr_event_keyboard_key event = {
+        .time_msec = event_time(),
+        .keycode = record.keycode,
+        .update_state = true,
+        .state = (enum wlr_key_state)record.state,
+    };
+    if (keyboard != nullptr) {
+      wlr_keyboard_notify_key(keyboard->keyboard, &event);
+    }
+    ++events;
+    break;
+  }
+  case ti::RECORD_FRAME: {
+    ti::record_frame record;
+    memcpy(&record, payload, sizeof(record));
+    ++record_frames;
+    if (record.output < outputs.size() && outputs[record.output] != nullptr &&
+        outputs[record.output]->enabled) {
+      frame_output = outputs[record.output];
+      wlr_output_send_frame(frame_output);
+      frame_output = nullptr;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+bool ti::record_print(const char *path) {
+  std::vector<uint8_t> data;
+  if (!read_file(path, data)) {
+    return false;
+  }
+  ti::record_file_header file_header;
+  memcpy(&file_header, data.data(), sizeof(file_header));
+  time_t started = file_header.started;
+  printf("# recorded %s", ctime(&started));
+
+  int64_t usec = 0;
+  size_t position = sizeof(file_header);
+  while (position + sizeof(ti::record_header) <= data.size()) {
+    ti::record_header header;
+    memcpy(&header, &data[position], sizeof(header));
+    const uint8_t *payload = &data[position + sizeof(header)];
+    position += sizeof(header) + header.size;
+    if (position > data.size()) {
+      break;
+    }
+    usec += header.delta_usec;
+    printf("%12.3f ", usec / 1000.0);
+
+    switch (header.type) {
+    case ti::RECORD_PAUSE: {
+      uint64_t pause;
+      memcpy(&pause, payload, sizeof(pause));
+      usec += pause;
+      printf("pause %" PRIu64 " usec\n", pause);
+      break;
+    }
+    case ti::RECORD_CURSOR: {
+      double p[2];
+      memcpy(p, payload, sizeof(p));
+      printf("cursor %.2f %.2f\n", p[0], p[1]);
+      break;
+    }
+    case ti::RECORD_OUTPUT: {
+      ti::record_output r;
+      memcpy(&r, payload, sizeof(r));
+      printf("output %u %s %dx%d@%.3f\n", r.index, r.name, r.width, r.height,
+             r.refresh / 1000.0);
+      break;
+    }
+    case ti::RECORD_MOTION:
+    case ti::RECORD_MOTION_ABSOLUTE: {
+      ti::record_motion r;
+      memcpy(&r, payload, sizeof(r));
+      printf("%s %u %.4f %.4f\n",
+             header.type == ti::RECORD_MOTION ? "motion" : "motion-absolute",
+             r.time_msec, r.x, r.y);
+      break;
+    }
+    case ti::RECORD_BUTTON: {
+      ti::record_button r;
+      memcpy(&r, payload, sizeof(r));
+      printf("button %u %u %s\n", r.time_msec, r.button,
+             r.state == WLR_BUTTON_PRESSED ? "pressed" : "released");
+      break;
+    }
+    case ti::RECORD_AXIS: {
+      ti::record_axis r;
+      memcpy(&r, payload, sizeof(r));
+      printf("axis %u %u %u %.4f %d\n", r.time_msec, r.orientation, r.source,
+             r.delta, r.delta_discrete);
+      break;
+    }
+    case ti::RECORD_POINTER_FRAME:
+      printf("pointer-frame\n");
+      break;
+    case ti::RECORD_KEY: {
+      ti::record_key r;
+      memcpy(&r, payload, sizeof(r));
+      printf("key %u %u %s\n", r.time_msec, r.keycode,
+             r.state == WLR_KEY_PRESSED ? "pressed" : "released");
+      break;
+    }
+    case ti::RECORD_FRAME: {
+      ti::record_frame r;
+      memcpy(&r, payload, sizeof(r));
+      printf("frame %u %.3f ms\n", r.output, r.frame_usec / 1000.0);
+      break;
+    }
+    case ti::RECORD_COMMIT: {
+      ti::record_commit r;
+      memcpy(&r, payload, sizeof(r));
+      printf("commit %d %u %dx%d %016" PRIx64 "\n", r.pid, r.surface, r.width,
+             r.height, r.hash);
+      break;
+    }
+    default:
+      printf("unknown %u\n", header.type);
+      break;
+    }
+  }
+  return true;
+}
@@ -1,6 +1,9 @@
+#include <cmath>
+
 extern "C" {
 #include <wlr/backend.h>
 
+#include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include <wlr/util/log.h>
 #define static
@@ -9,9 +12,14 @@ extern "C" {
 #undef static
 }
 
+#include "clients.hpp"
+#include "damage_overlay.hpp"
 #include "desktop.hpp"
 #include "output.hpp"
+#include "seat.hpp"
 #include "server.hpp"
+#include "titlebar.hpp"
+#include "view.hpp"
 #include "xdg_shell.hpp"
 
 #include "render.hpp"
@@ -37,12 +45,49 @@ void scissor_output(struct wlr_output *wlr_output, pixman_box32_t *rect) {
   wlr_renderer_scissor(renderer, &box);
 }
 
+/// above this many rectangles, reading back the extents is cheaper
+#define READ_PIXELS_MAX_RECTS 32
+
+bool read_region_to_shm(struct wlr_renderer *renderer,
+                        struct wl_resource *buffer, enum wl_shm_format format,
+                        int stride, pixman_region32_t *region, int dx, int dy) {
+  struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer);
+  if (shm_buffer == NULL) {
+    return false;
+  }
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+  if (nrects > READ_PIXELS_MAX_RECTS) {
+    rects = pixman_region32_extents(region);
+    nrects = 1;
+  }
+
+  bool ok = true;
+  wl_shm_buffer_begin_access(shm_buffer);
+  void *data = wl_shm_buffer_get_data(shm_buffer);
+  for (int i = 0; i < nrects && ok; ++i) {
+    // no flags: partial reads must all have the same (top-down) orientation
+    ok = wlr_renderer_read_pixels(renderer, format, NULL, stride,
+                                  rects[i].x2 - rects[i].x1,
+                                  rects[i].y2 - rects[i].y1, rects[i].x1,
+                                  rects[i].y1, rects[i].x1 - dx,
+                                  rects[i].y1 - dy, data);
+  }
+  wl_shm_buffer_end_access(shm_buffer);
+  return ok;
+}
+
 void ti::view::render_decorations(ti::output *output, ti::render_data *data) {
-  float decoration_color[4] = {0.1, 0.1, 0.1, alpha};
   pixman_box32_t *rects;
-  if (!decorated || surface == NULL) {
+  struct wlr_texture *title = nullptr;
+  float title_matrix[9];
+  if (!decorated || surface == NULL || fullscreen_output != nullptr) {
     return;
   }
+  bool activated = desktop->seat->focused_view == this;
+  float decoration_color[4];
+  ti::titlebar::background(activated, alpha, decoration_color);
 
   struct wlr_renderer *renderer =
       wlr_backend_get_renderer(output->wlr_output->backend);
@@ -67,18 +112,40 @@ void ti::view::render_decorations(ti::output *output, ti::render_data *data) {
   wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, rotation,
                          output->wlr_output->transform_matrix);
 
+  // the title over the titlebar, rotated views keep a plain one
+  if (titlebar != nullptr && rotation == 0) {
+    float scale = output->wlr_output->scale;
+    title = titlebar->texture(renderer, this->box.width, scale, activated);
+    double x = this->box.x, y = this->box.y - (int)titlebar_height;
+    wlr_output_layout_output_coords(desktop->output_layout,
+                                    output->wlr_output, &x, &y);
+    struct wlr_box title_box = {
+        .x = (int)(x * scale),
+        .y = (int)(y * scale),
+        .width = (int)std::ceil(this->box.width * scale),
+        .height = (int)std::ceil(titlebar_height * scale),
+    };
+    wlr_matrix_project_box(title_matrix, &title_box,
+                           WL_OUTPUT_TRANSFORM_NORMAL, 0,
+                           output->wlr_output->transform_matrix);
+  }
+
   int nrects;
   rects = pixman_region32_rectangles(&damage, &nrects);
   for (int i = 0; i < nrects; ++i) {
     scissor_output(output->wlr_output, &rects[i]);
     wlr_render_quad_with_matrix(renderer, decoration_color, matrix);
+    if (title != nullptr) {
+      wlr_render_texture_with_matrix(renderer, title, title_matrix, alpha);
+    }
   }
 
 buffer_damage_finish:
   pixman_region32_fini(&damage);
 }
 
-static void render_texture(struct wlr_output *wlr_output,
+/// returns true if any of the texture was drawn
+static bool render_texture(struct wlr_output *wlr_output,
                            pixman_region32_t *output_damage,
                            struct wlr_texture *texture,
                            const struct wlr_box *box, const float matrix[9],
@@ -108,6 +175,7 @@ static void render_texture(struct wlr_output *wlr_output,
 
 buffer_damage_finish:
   pixman_region32_fini(&damage);
+  return damaged;
 }
 
 void render_surface_iterator(ti::output *output, struct wlr_surface *surface,
@@ -148,8 +216,17 @@ void render_surface_iterator(ti::output *output, struct wlr_surface *surface,
   wlr_matrix_project_box(matrix, &box, transform, rotation,
                          wlr_output->transform_matrix);
 
-  render_texture(wlr_output, output_damage, texture, &box, matrix, 0.0, alpha);
+  bool rendered = render_texture(wlr_output, output_damage, texture, &box,
+                                 matrix, 0.0, alpha);
+  if (rendered && output->damage_overlay != nullptr) {
+    output->damage_overlay->surface_rendered(box);
+  }
 
-  wlr_presentation_surface_sampled_on_output(output->desktop->presentation,
-                                             surface, wlr_output);
+  // only the primary output reports presentation feedback, otherwise a view
+  // spanning outputs with different refresh rates gets mixed timings
+  if (data->view == nullptr || data->view->primary_output == output) {
+    wlr_presentation_surface_sampled_on_output(output->desktop->presentation,
+                                               surface, wlr_output);
+    output->desktop->clients->surface_sampled(surface);
+  }
 }
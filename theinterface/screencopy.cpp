@@ -0,0 +1,408 @@
+#include <cstring>
+
+extern "C" {
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
+#include <wlr/util/log.h>
+#include <wlr/util/region.h>
+#define static
+#include <wlr/render/wlr_renderer.h>
+#undef static
+}
+
+#include "wlr-screencopy-unstable-v1-protocol.h"
+
+#include "desktop.hpp"
+#include "output.hpp"
+#include "render.hpp"
+#include "server.hpp"
+
+#include "screencopy.hpp"
+
+#define SCREENCOPY_MANAGER_VERSION 2
+
+/// above this many damage rectangles, only the extents are sent
+#define SCREENCOPY_MAX_RECTS 32
+
+/// returns nullptr once the frame is done
+static ti::screencopy_frame *frame_from_resource(struct wl_resource *resource) {
+  return reinterpret_cast<ti::screencopy_frame *>(
+      wl_resource_get_user_data(resource));
+}
+
+/// the frame is done (ready or failed), but the resource lives on until the
+/// client destroys it
+static void frame_finish(ti::screencopy_frame *frame) {
+  wl_list_remove(&frame->link);
+  wl_list_init(&frame->link);
+  wl_list_remove(&frame->buffer_destroy.link);
+  wl_list_init(&frame->buffer_destroy.link);
+  wl_resource_set_user_data(frame->resource, NULL);
+  delete frame;
+}
+
+static void frame_fail(ti::screencopy_frame *frame) {
+  zwlr_screencopy_frame_v1_send_failed(frame->resource);
+  frame_finish(frame);
+}
+
+static void frame_handle_buffer_destroy(struct wl_listener *listener,
+                                        void *data) {
+  ti::screencopy_frame *frame =
+      wl_container_of(listener, frame, buffer_destroy);
+  frame_fail(frame);
+}
+
+static void buffer_handle_destroy(struct wl_listener *listener, void *data) {
+  ti::screencopy_buffer *buffer = wl_container_of(listener, buffer, destroy);
+  wl_list_remove(&buffer->link);
+  wl_list_remove(&buffer->destroy.link);
+  pixman_region32_fini(&buffer->damage);
+  delete buffer;
+}
+
+/// returns the state of the wl_buffer resource, creating it if needed
+static ti::screencopy_buffer *get_buffer(ti::screencopy_manager *manager,
+                                         struct wl_resource *resource) {
+  ti::screencopy_buffer *buffer;
+  wl_list_for_each(buffer, &manager->buffers, link) {
+    if (buffer->resource == resource) {
+      return buffer;
+    }
+  }
+
+  buffer = new ti::screencopy_buffer{};
+  buffer->resource = resource;
+  pixman_region32_init(&buffer->damage);
+  buffer->destroy.notify = buffer_handle_destroy;
+  wl_resource_add_destroy_listener(resource, &buffer->destroy);
+  wl_list_insert(&manager->buffers, &buffer->link);
+  return buffer;
+}
+
+bool ti::screencopy_buffer::holds(ti::output *output,
+                                  const struct wlr_box &box) {
+  return this->output == output &&
+         memcmp(&this->box, &box, sizeof(wlr_box)) == 0;
+}
+
+static void frame_send_damage(ti::screencopy_frame *frame,
+                              pixman_region32_t *damage) {
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+  if (nrects > SCREENCOPY_MAX_RECTS) {
+    rects = pixman_region32_extents(damage);
+    nrects = 1;
+  }
+  for (int i = 0; i < nrects; ++i) {
+    zwlr_screencopy_frame_v1_send_damage(
+        frame->resource, rects[i].x1 - frame->box.x,
+        rects[i].y1 - frame->box.y, rects[i].x2 - rects[i].x1,
+        rects[i].y2 - rects[i].y1);
+  }
+}
+
+void ti::screencopy_manager::output_rendered(ti::output *output,
+                                             pixman_region32_t *frame_damage,
+                                             const timespec *when) {
+  if (wl_list_empty(&buffers) && wl_list_empty(&frames)) {
+    return;
+  }
+
+  ti::screencopy_buffer *buffer;
+  wl_list_for_each(buffer, &buffers, link) {
+    if (buffer->output == output) {
+      pixman_region32_union(&buffer->damage, &buffer->damage, frame_damage);
+    }
+  }
+
+  ti::screencopy_frame *frame, *tmp;
+  wl_list_for_each_safe(frame, tmp, &frames, link) {
+    if (frame->output != output || frame->buffer == nullptr) {
+      continue;
+    }
+    buffer = get_buffer(this, frame->buffer);
+
+    /* If the buffer holds another output or region, e.g. its last copy was
+     * of another output, all of it is copied. */
+    pixman_region32_t damage;
+    pixman_region32_init_rect(&damage, frame->box.x, frame->box.y,
+                              frame->box.width, frame->box.height);
+    if (buffer->holds(output, frame->box)) {
+      pixman_region32_intersect(&damage, &damage, &buffer->damage);
+    }
+    if (frame->with_damage && !pixman_region32_not_empty(&damage)) {
+      // nothing changed in the captured region, wait for the next frame
+      pixman_region32_fini(&damage);
+      continue;
+    }
+
+    bool ok = !pixman_region32_not_empty(&damage) ||
+              read_region_to_shm(desktop->server->renderer, frame->buffer,
+                                 frame->format, frame->stride, &damage,
+                                 frame->box.x, frame->box.y);
+    if (!ok) {
+      pixman_region32_fini(&damage);
+      frame_fail(frame);
+      continue;
+    }
+
+    buffer->output = output;
+    buffer->box = frame->box;
+    pixman_region32_clear(&buffer->damage);
+
+    zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
+    if (frame->with_damage) {
+      frame_send_damage(frame, &damage);
+    }
+    pixman_region32_fini(&damage);
+
+    uint64_t tv_sec = (uint64_t)when->tv_sec;
+    zwlr_screencopy_frame_v1_send_ready(frame->resource, tv_sec >> 32,
+                                        tv_sec & 0xFFFFFFFF, when->tv_nsec);
+    frame_finish(frame);
+  }
+}
+
+void ti::screencopy_manager::output_destroyed(ti::output *output) {
+  ti::screencopy_frame *frame, *tmp;
+  wl_list_for_each_safe(frame, tmp, &frames, link) {
+    if (frame->output == output) {
+      frame_fail(frame);
+    }
+  }
+  ti::screencopy_buffer *buffer;
+  wl_list_for_each(buffer, &buffers, link) {
+    if (buffer->output == output) {
+      buffer->output = nullptr;
+      pixman_region32_clear(&buffer->damage);
+    }
+  }
+}
+
+/// converts a region in buffer coordinates to output damage coordinates
+static void damage_from_buffer_region(ti::output *output,
+                                      pixman_region32_t *region) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  pixman_region32_t damage;
+  pixman_region32_init(&damage);
+  wlr_region_transform(&damage, region, wlr_output->transform,
+                       wlr_output->width, wlr_output->height);
+  wlr_output_damage_add(output->damage, &damage);
+  pixman_region32_fini(&damage);
+}
+
+static void frame_handle_copy(struct wl_client *client,
+                              struct wl_resource *resource,
+                              struct wl_resource *buffer_resource,
+                              bool with_damage) {
+  ti::screencopy_frame *frame = frame_from_resource(resource);
+  if (frame == nullptr) {
+    // already done
+    return;
+  }
+
+  if (frame->buffer != nullptr) {
+    wl_resource_post_error(frame->resource,
+                           ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED,
+                           "frame already used");
+    return;
+  }
+
+  struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer_resource);
+  if (shm_buffer == NULL ||
+      wl_shm_buffer_get_format(shm_buffer) != (uint32_t)frame->format ||
+      wl_shm_buffer_get_width(shm_buffer) != frame->box.width ||
+      wl_shm_buffer_get_height(shm_buffer) != frame->box.height ||
+      wl_shm_buffer_get_stride(shm_buffer) != frame->stride) {
+    wl_resource_post_error(frame->resource,
+                           ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
+                           "invalid buffer attributes");
+    return;
+  }
+
+  ti::output *output = frame->output;
+  if (!output->wlr_output->enabled) {
+    frame_fail(frame);
+    return;
+  }
+
+  frame->buffer = buffer_resource;
+  frame->with_damage = with_damage;
+  frame->buffer_destroy.notify = frame_handle_buffer_destroy;
+  wl_resource_add_destroy_listener(buffer_resource, &frame->buffer_destroy);
+
+  ti::screencopy_buffer *buffer = get_buffer(frame->manager, buffer_resource);
+  if (!with_damage || !buffer->holds(output, frame->box)) {
+    // a full frame was asked for, the output has to render one
+    pixman_region32_t region;
+    pixman_region32_init_rect(&region, frame->box.x, frame->box.y,
+                              frame->box.width, frame->box.height);
+    damage_from_buffer_region(output, &region);
+    pixman_region32_fini(&region);
+  } else if (pixman_region32_not_empty(&buffer->damage)) {
+    // something changed since the last copy: only that needs to be rendered
+    damage_from_buffer_region(output, &buffer->damage);
+  }
+  /* Otherwise nothing is scheduled at all: an idle output keeps sleeping
+   * until something damages it. */
+}
+
+static void frame_handle_copy_without_damage(struct wl_client *client,
+                                             struct wl_resource *resource,
+                                             struct wl_resource *buffer) {
+  frame_handle_copy(client, resource, buffer, false);
+}
+
+static void frame_handle_copy_with_damage(struct wl_client *client,
+                                          struct wl_resource *resource,
+                                          struct wl_resource *buffer) {
+  frame_handle_copy(client, resource, buffer, true);
+}
+
+static void frame_handle_destroy(struct wl_client *client,
+                                 struct wl_resource *resource) {
+  wl_resource_destroy(resource);
+}
+
+static const struct zwlr_screencopy_frame_v1_interface frame_impl = {
+    .copy = frame_handle_copy_without_damage,
+    .destroy = frame_handle_destroy,
+    .copy_with_damage = frame_handle_copy_with_damage,
+};
+
+static void frame_handle_resource_destroy(struct wl_resource *resource) {
+  ti::screencopy_frame *frame = frame_from_resource(resource);
+  if (frame != nullptr) {
+    frame_finish(frame);
+  }
+}
+
+static void capture_output(struct wl_client *client,
+                           struct wl_resource *manager_resource, uint32_t id,
+                           struct wl_resource *output_resource,
+                           struct wlr_box *logical_box) {
+  auto *manager = reinterpret_cast<ti::screencopy_manager *>(
+      wl_resource_get_user_data(manager_resource));
+
+  auto *frame = new ti::screencopy_frame{};
+  frame->manager = manager;
+  frame->resource =
+      wl_resource_create(client, &zwlr_screencopy_frame_v1_interface,
+                         wl_resource_get_version(manager_resource), id);
+  if (frame->resource == NULL) {
+    delete frame;
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(frame->resource, &frame_impl, frame,
+                                 frame_handle_resource_destroy);
+  wl_list_init(&frame->link);
+  wl_list_init(&frame->buffer_destroy.link);
+
+  struct wlr_output *wlr_output = wlr_output_from_resource(output_resource);
+  ti::output *output = output_from_wlr_output(wlr_output);
+  if (output == nullptr || !wlr_output->enabled) {
+    frame_fail(frame);
+    return;
+  }
+  frame->output = output;
+
+  struct wlr_box buffer_box = {
+      .x = 0,
+      .y = 0,
+      .width = wlr_output->width,
+      .height = wlr_output->height,
+  };
+  frame->box = buffer_box;
+  if (logical_box != nullptr) {
+    struct wlr_box box = *logical_box;
+    scale_box(&box, wlr_output->scale);
+
+    int ow, oh;
+    wlr_output_transformed_resolution(wlr_output, &ow, &oh);
+    enum wl_output_transform transform =
+        wlr_output_transform_invert(wlr_output->transform);
+    wlr_box_transform(&box, &box, transform, ow, oh);
+
+    if (!wlr_box_intersection(&frame->box, &buffer_box, &box)) {
+      frame_fail(frame);
+      return;
+    }
+  }
+
+  struct wlr_renderer *renderer = manager->desktop->server->renderer;
+  frame->format = wlr_renderer_preferred_read_format(renderer);
+  frame->stride = 4 * frame->box.width;
+
+  wl_list_insert(&manager->frames, &frame->link);
+  zwlr_screencopy_frame_v1_send_buffer(frame->resource, frame->format,
+                                       frame->box.width, frame->box.height,
+                                       frame->stride);
+}
+
+static void manager_handle_capture_output(struct wl_client *client,
+                                          struct wl_resource *manager_resource,
+                                          uint32_t id, int32_t overlay_cursor,
+                                          struct wl_resource *output_resource) {
+  /* Software cursors are part of the rendered buffer anyway, hardware cursors
+   * are never captured. */
+  capture_output(client, manager_resource, id, output_resource, nullptr);
+}
+
+static void manager_handle_capture_output_region(
+    struct wl_client *client, struct wl_resource *manager_resource,
+    uint32_t id, int32_t overlay_cursor, struct wl_resource *output_resource,
+    int32_t x, int32_t y, int32_t width, int32_t height) {
+  struct wlr_box box = {
+      .x = x,
+      .y = y,
+      .width = width,
+      .height = height,
+  };
+  capture_output(client, manager_resource, id, output_resource, &box);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+                                   struct wl_resource *manager_resource) {
+  wl_resource_destroy(manager_resource);
+}
+
+static const struct zwlr_screencopy_manager_v1_interface manager_impl = {
+    .capture_output = manager_handle_capture_output,
+    .capture_output_region = manager_handle_capture_output_region,
+    .destroy = manager_handle_destroy,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+                         uint32_t version, uint32_t id) {
+  auto *manager = reinterpret_cast<ti::screencopy_manager *>(data);
+
+  struct wl_resource *resource = wl_resource_create(
+      client, &zwlr_screencopy_manager_v1_interface, version, id);
+  if (resource == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(resource, &manager_impl, manager, NULL);
+}
+
+ti::screencopy_manager::screencopy_manager(ti::desktop *d) {
+  this->desktop = d;
+  wl_list_init(&this->frames);
+  wl_list_init(&this->buffers);
+
+  this->global = wl_global_create(
+      desktop->server->display, &zwlr_screencopy_manager_v1_interface,
+      SCREENCOPY_MANAGER_VERSION, this, manager_bind);
+}
+
+ti::screencopy_manager::~screencopy_manager() {
+  ti::screencopy_frame *frame, *tmp;
+  wl_list_for_each_safe(frame, tmp, &frames, link) { frame_fail(frame); }
+  ti::screencopy_buffer *buffer, *buffer_tmp;
+  wl_list_for_each_safe(buffer, buffer_tmp, &buffers, link) {
+    buffer_handle_destroy(&buffer->destroy, nullptr);
+  }
+  wl_global_destroy(this->global);
+}
@@ -1,5 +1,17 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include <wlr/types/wlr_virtual_keyboard_v1.h>
+#include <wlr/types/wlr_virtual_pointer_v1.h>
+}
+
+#include "constraints.hpp"
 #include "cursor.hpp"
+#include "output.hpp"
 #include "server.hpp"
+#include "xcursor.hpp"
 #include "xdg_shell.hpp"
 #include "xwayland.hpp"
 
@@ -20,6 +32,7 @@ void seat_request_cursor(struct wl_listener *listener, void *data) {
      * cursor moves between outputs. */
     wlr_cursor_set_surface(seat->cursor, event->surface, event->hotspot_x,
                            event->hotspot_y);
+    seat->cursor_image = nullptr;
   }
 }
 
@@ -53,6 +66,7 @@ void ti::seat::focus(ti::view *v) {
    */
   wlr_seat_keyboard_notify_enter(this->wlr_seat, v->surface, keyboard->keycodes,
                                  keyboard->num_keycodes, &keyboard->modifiers);
+  desktop->constraints->update(this);
 }
 
 ti::seat::seat(ti::desktop *d) {
@@ -65,13 +79,6 @@ ti::seat::seat(ti::desktop *d) {
   this->cursor = wlr_cursor_create();
   wlr_cursor_attach_output_layout(this->cursor, desktop->output_layout);
 
-  /* Creates an xcursor manager, another wlroots utility which loads up
-   * Xcursor themes to source cursor images from and makes sure that cursor
-   * images are available at all scale factors on the screen (necessary for
-   * HiDPI support). We add a cursor theme at scale factor 1 to begin with. */
-  this->cursor_mgr = wlr_xcursor_manager_create(nullptr, 24);
-  wlr_xcursor_manager_load(this->cursor_mgr, 1);
-
   /*
    * wlr_cursor *only* displays an image on screen. It does not move around
    * when the pointer moves. However, we can attach input devices to it, and
@@ -103,26 +110,79 @@ ti::seat::seat(ti::desktop *d) {
    * let us know when new input devices are available on the backend.
    */
   wl_list_init(&this->keyboards);
+  wl_list_init(&this->keyboard_groups);
 
   this->wlr_seat = wlr_seat_create(desktop->server->display, "seat0");
   this->request_cursor.notify = seat_request_cursor;
   wl_signal_add(&this->wlr_seat->events.request_set_cursor,
                 &this->request_cursor);
+
+  /* Any client could type into any other through these, so they are only
+   * there when asked for, e.g. to generate input on the headless backend. */
+  const char *virtual_input = getenv("TI_VIRTUAL_INPUT");
+  if (virtual_input != nullptr && atoi(virtual_input) == 1) {
+    struct wl_display *display = desktop->server->display;
+    this->virtual_pointer = wlr_virtual_pointer_manager_v1_create(display);
+    this->new_virtual_pointer.notify = handle_new_virtual_pointer;
+    wl_signal_add(&this->virtual_pointer->events.new_virtual_pointer,
+                  &this->new_virtual_pointer);
+    this->virtual_keyboard = wlr_virtual_keyboard_manager_v1_create(display);
+    this->new_virtual_keyboard.notify = handle_new_virtual_keyboard;
+    wl_signal_add(&this->virtual_keyboard->events.new_virtual_keyboard,
+                  &this->new_virtual_keyboard);
+  }
+}
+
+void ti::seat::update_capabilities() {
+  /* In TinyWL we always have a cursor, even if there are no pointer devices,
+   * so we always include that capability. */
+  unsigned caps = WL_SEAT_CAPABILITY_POINTER;
+  if (!wl_list_empty(&this->keyboards)) {
+    caps |= WL_SEAT_CAPABILITY_KEYBOARD;
+  }
+  wlr_seat_set_capabilities(this->wlr_seat, caps);
+}
+
+void ti::seat::set_cursor(const char *name) {
+  if (this->cursor_image == name) {
+    return;
+  }
+
+  /* wlr_cursor shows the image of a scale on the outputs of that scale, so
+   * each scale in use gets the theme image made for it. */
+  std::vector<float> scales;
+  ti::output *output;
+  wl_list_for_each(output, &desktop->outputs, link) {
+    float scale = output->wlr_output->scale;
+    if (std::find(scales.begin(), scales.end(), scale) != scales.end()) {
+      continue;
+    }
+    scales.push_back(scale);
+
+    const ti::cursor_image *image = ti::cursor_theme::get().image(name, scale);
+    if (image != nullptr) {
+      wlr_cursor_set_image(this->cursor, image->pixels, image->width * 4,
+                           image->width, image->height, image->hotspot_x,
+                           image->hotspot_y, scale);
+    }
+  }
+  this->cursor_image = name;
 }
 
 void ti::seat::setup_xwayland_cursor(wlr_xwayland *xwayland) {
 #ifdef WLR_HAS_XWAYLAND
-  this->xwayland_xcursor_manager = wlr_xcursor_manager_create(nullptr, 24);
-  wlr_xcursor_manager_load(this->xwayland_xcursor_manager, 1);
-  this->xcursor = wlr_xcursor_manager_get_xcursor(
-      this->xwayland_xcursor_manager, "left_ptr", 1);
-  if (this->xcursor != NULL) {
-    struct wlr_xcursor_image *image = this->xcursor->images[0];
-    wlr_xwayland_set_cursor(xwayland, image->buffer, image->width * 4,
-                            image->width, image->height, image->hotspot_x,
-                            image->hotspot_y);
+  const ti::cursor_image *image = ti::cursor_theme::get().image("left_ptr", 1);
+  if (image != nullptr) {
+    wlr_xwayland_set_cursor(xwayland, const_cast<uint8_t *>(image->pixels),
+                            image->width * 4, image->width, image->height,
+                            image->hotspot_x, image->hotspot_y);
   }
 #endif
 }
 
-ti::seat::~seat() {}
\ No newline at end of file
+ti::seat::~seat() {
+  if (this->virtual_pointer != nullptr) {
+    wl_list_remove(&this->new_virtual_pointer.link);
+    wl_list_remove(&this->new_virtual_keyboard.link);
+  }
+}
\ No newline at end of file
@@ -1,3 +1,8 @@
+#include <cstdlib>
+#include <ctime>
+#include <future>
+#include <poll.h>
+
 extern "C" {
 #include <wlr/backend.h>
 #include <wlr/types/wlr_foreign_toplevel_management_v1.h>
@@ -7,11 +12,46 @@ extern "C" {
 #undef static
 }
 
+#include "desktop.hpp"
+#include "metrics.hpp"
+#include "record.hpp"
 #include "seat.hpp"
+#include "startup.hpp"
+#include "util.hpp"
+#include "xcursor.hpp"
 
 #include "server.hpp"
 
 ti::server::server() {
+  const char *replay = getenv("TI_REPLAY");
+  if (replay != nullptr) {
+    ti::replayer::prepare();
+  }
+
+  /* Work that doesn't need the display runs on other threads while the
+   * backend comes up. The main thread sets environment variables meanwhile
+   * (e.g. DISPLAY and WAYLAND_DISPLAY), which getenv on another thread may
+   * read while they are reallocated: the workers get what they need of the
+   * environment before they start, and the GPU probe, whose libraries may
+   * read it, is done before the first setenv.
+   *
+   * Probing the GPUs opens every DRM card. If the vmwgfx driver is detected,
+   * hardware cursors aren't used unless the user asks for them explicitly by
+   * exporting WLR_NO_HARDWARE_CURSORS=0. */
+  std::future<bool> no_hardware_cursors;
+  if (getenv("WLR_NO_HARDWARE_CURSORS") == nullptr) {
+    no_hardware_cursors = std::async(std::launch::async, [] {
+      ti::startup_phase phase("gpu probe");
+      return possible_no_hardware_cursor_support();
+    });
+  }
+  // the default cursor is shown as soon as the pointer moves
+  ti::cursor_theme::get();
+  std::future<void> cursor = std::async(std::launch::async, [] {
+    ti::startup_phase phase("cursor theme");
+    ti::cursor_theme::get().image("left_ptr", 1);
+  });
+
   /* The Wayland display is managed by libwayland. It handles accepting
    * clients from the Unix socket, manging Wayland globals, and so on. */
   this->display = wl_display_create();
@@ -27,7 +67,10 @@ ti::server::server() {
    * backend uses the renderer, for example, to fall back to software cursors
    * if the backend does not support hardware cursors (some older GPUs
    * don't). */
-  this->backend = wlr_backend_autocreate(this->display, NULL);
+  {
+    ti::startup_phase phase("backend");
+    this->backend = wlr_backend_autocreate(this->display, NULL);
+  }
   if (!this->backend) {
     wlr_log_errno(WLR_ERROR, "Unable to start backend");
   }
@@ -42,7 +85,15 @@ ti::server::server() {
   this->data_device_manager = wlr_data_device_manager_create(this->display);
   wlr_renderer_init_wl_display(this->renderer, this->display);
 
-  this->desktop = new ti::desktop(this);
+  // outputs read WLR_NO_HARDWARE_CURSORS when the backend creates them
+  if (no_hardware_cursors.valid() && no_hardware_cursors.get()) {
+    setenv("WLR_NO_HARDWARE_CURSORS", "1", true);
+  }
+
+  {
+    ti::startup_phase phase("desktop");
+    this->desktop = new ti::desktop(this);
+  }
 
   /* Add a Unix socket to the Wayland display. */
   const char *socket = wl_display_add_socket_auto(this->display);
@@ -55,21 +106,80 @@ ti::server::server() {
    * startup command if requested. */
   wlr_log(WLR_INFO, "Running TheInterface on WAYLAND_DISPLAY=%s", socket);
   setenv("WAYLAND_DISPLAY", socket, true);
+  // named after the socket, for ti-top to find it
+  this->desktop->metrics = new ti::metrics(this->desktop, socket);
+  // from before the backend starts, so the recording has every device
+  const char *record = getenv("TI_RECORD");
+  if (record != nullptr) {
+    this->desktop->recorder = new ti::recorder(this->desktop, record);
+  }
 
   /* Start the backend. This will enumerate outputs and inputs, become the DRM
    * master, etc */
-  if (!wlr_backend_start(this->backend)) {
+  bool started;
+  {
+    ti::startup_phase phase("backend start");
+    started = wlr_backend_start(this->backend);
+  }
+  if (!started) {
     wlr_backend_destroy(this->backend);
     wl_display_destroy(this->display);
     exit(EXIT_FAILURE);
   }
+  // the theme isn't safe to use from two threads
+  cursor.wait();
+
+  if (replay != nullptr) {
+    this->desktop->replayer = new ti::replayer(this->desktop);
+    if (!this->desktop->replayer->load(replay)) {
+      exit(EXIT_FAILURE);
+    }
+    this->desktop->replayer->start();
+  }
+}
+
+static uint64_t now_usec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void ti::server::run() {
+  struct wl_event_loop *loop = wl_display_get_event_loop(display);
+  struct pollfd pfd = {
+      .fd = wl_event_loop_get_fd(loop),
+      .events = POLLIN,
+      .revents = 0,
+  };
+  running = true;
+  while (running) {
+    uint64_t start = now_usec();
+    wl_event_loop_dispatch_idle(loop);
+    wl_display_flush_clients(display);
+    loop_busy_usec += now_usec() - start;
+
+    // the wait wl_event_loop_dispatch would do, outside of the timing
+    if (poll(&pfd, 1, -1) < 0) {
+      continue;
+    }
+    start = now_usec();
+    wl_event_loop_dispatch(loop, 0);
+    loop_busy_usec += now_usec() - start;
+    ++loop_dispatches;
+  }
+}
+
+void ti::server::terminate() {
+  running = false;
+  // wakes the loop up
+  wl_display_terminate(display);
 }
 
 /// automatically ran when the program is about to exit
 ti::server::~server() {
   wlr_log(WLR_INFO, "Deallocating server resources");
   delete desktop;
-  /* Once wl_display_run returns, we shut down the server. */
+  /* Once run returns, we shut down the server. */
   wl_display_destroy_clients(display);
   wl_display_destroy(display);
 }
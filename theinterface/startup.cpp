@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include <wlr/util/log.h>
+}
+
+#include "startup.hpp"
+
+static int64_t now_nsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// startup is counted from the static initialization of the binary
+static const int64_t origin = now_nsec();
+
+struct startup_record {
+  const char *name;
+  int64_t start, end;
+  int thread;
+};
+
+static std::mutex records_mutex;
+static std::vector<startup_record> records;
+static std::atomic<bool> finished{false};
+
+/// static initialization runs on the main thread
+static const std::thread::id main_thread = std::this_thread::get_id();
+
+/// small numbers for the threads timing phases, 0 is the main thread
+static int thread_number() {
+  static std::atomic<int> next_thread{1};
+  if (std::this_thread::get_id() == main_thread) {
+    return 0;
+  }
+  thread_local int number = next_thread++;
+  return number;
+}
+
+ti::startup_phase::startup_phase(const char *name) {
+  this->name = name;
+  this->start = now_nsec();
+}
+
+ti::startup_phase::~startup_phase() {
+  if (finished) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(records_mutex);
+  records.push_back({name, start, now_nsec(), thread_number()});
+}
+
+static double to_msec(int64_t nsec) { return (nsec - origin) / 1e6; }
+
+/// the timeline in the Trace Event Format, times are in microseconds
+static void write_trace(const char *path,
+                        const std::vector<startup_record> &timeline,
+                        int64_t first_frame) {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    wlr_log_errno(WLR_ERROR, "Can't write the startup trace to %s", path);
+    return;
+  }
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (const startup_record &record : timeline) {
+    fprintf(file,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%d},\n",
+            record.name, to_msec(record.start) * 1e3,
+            (record.end - record.start) / 1e3, getpid(), record.thread);
+  }
+  fprintf(file,
+          "{\"name\":\"first frame\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,"
+          "\"pid\":%d,\"tid\":0}\n]}\n",
+          to_msec(first_frame) * 1e3, getpid());
+  fclose(file);
+}
+
+void ti::startup_first_frame() {
+  if (finished) {
+    return;
+  }
+  int64_t first_frame = now_nsec();
+  finished = true;
+
+  std::vector<startup_record> timeline;
+  {
+    std::lock_guard<std::mutex> lock(records_mutex);
+    timeline = records;
+  }
+  // enclosing phases before the phases they contain
+  std::sort(timeline.begin(), timeline.end(),
+            [](const startup_record &a, const startup_record &b) {
+              return a.start != b.start ? a.start < b.start : a.end > b.end;
+            });
+
+  for (size_t i = 0; i < timeline.size(); ++i) {
+    const startup_record &record = timeline[i];
+    int depth = 0;
+    for (size_t j = 0; j < i; ++j) {
+      depth += timeline[j].thread == record.thread &&
+               timeline[j].end >= record.end;
+    }
+    char thread[16] = "";
+    if (record.thread != 0) {
+      snprintf(thread, sizeof(thread), " [thread %d]", record.thread);
+    }
+    wlr_log(WLR_INFO, "Startup: %*s%s %.1f ms, at %.1f ms%s", depth * 2, "",
+            record.name, (record.end - record.start) / 1e6,
+            to_msec(record.start), thread);
+  }
+  wlr_log(WLR_INFO, "First frame after %.1f ms", to_msec(first_frame));
+
+  const char *path = getenv("TI_STARTUP_TRACE");
+  if (path != nullptr && *path != '\0') {
+    write_trace(path, timeline, first_frame);
+  }
+}
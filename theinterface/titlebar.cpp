@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cairo.h>
+#include <cmath>
+
+extern "C" {
+#include <wlr/render/wlr_texture.h>
+#define static
+#include <wlr/render/wlr_renderer.h>
+#undef static
+}
+
+#include "desktop.hpp"
+#include "server.hpp"
+#include "util.hpp"
+#include "view.hpp"
+
+#include "titlebar.hpp"
+
+#define TITLEBAR_TITLE_INTERVAL_MSEC 250
+/// of the title text, from the left edge of the titlebar
+#define TITLEBAR_PADDING 6
+
+void ti::titlebar::background(bool activated, float alpha, float color[4]) {
+  color[0] = activated ? 0.18 : 0.1;
+  color[1] = activated ? 0.22 : 0.1;
+  color[2] = activated ? 0.3 : 0.1;
+  color[3] = alpha;
+}
+
+ti::titlebar::titlebar(ti::view *view, const std::string &title) {
+  this->view = view;
+  shown_title = title;
+}
+
+ti::titlebar::~titlebar() {
+  for (auto &entry : cache) {
+    wlr_texture_destroy(entry.texture);
+  }
+  if (title_timer != nullptr) {
+    wl_event_source_remove(title_timer);
+  }
+}
+
+int ti::titlebar::handle_title_timer(void *data) {
+  auto *titlebar = reinterpret_cast<ti::titlebar *>(data);
+  titlebar->show_title(titlebar->pending_title);
+  return 0;
+}
+
+void ti::titlebar::show_title(const std::string &title) {
+  last_title_msec = timespec_to_msec(ti::monotonic_now());
+  if (title == shown_title) {
+    return;
+  }
+  shown_title = title;
+  if (view->mapped) {
+    view->damage_whole();
+  }
+}
+
+void ti::titlebar::set_title(const std::string &title) {
+  pending_title = title;
+  int64_t since = timespec_to_msec(ti::monotonic_now()) - last_title_msec;
+  if (since >= TITLEBAR_TITLE_INTERVAL_MSEC) {
+    show_title(title);
+    return;
+  }
+  // the latest title is shown once the interval is over
+  if (title_timer == nullptr) {
+    struct wl_event_loop *loop =
+        wl_display_get_event_loop(view->desktop->server->display);
+    title_timer = wl_event_loop_add_timer(loop, handle_title_timer, this);
+  }
+  wl_event_source_timer_update(
+      title_timer, ti::real_msec(TITLEBAR_TITLE_INTERVAL_MSEC - since));
+}
+
+/// draws the titlebar at its size in pixels into a new texture
+static struct wlr_texture *rasterize(struct wlr_renderer *renderer,
+                                     const std::string &title, int width,
+                                     int height, float scale, bool activated) {
+  cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *cr = cairo_create(surface);
+
+  float color[4];
+  ti::titlebar::background(activated, 1, color);
+  cairo_set_source_rgba(cr, color[0], color[1], color[2], color[3]);
+  cairo_paint(cr);
+
+  cairo_rectangle(cr, 0, 0, width - TITLEBAR_PADDING * scale, height);
+  cairo_clip(cr);
+  cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL,
+                         CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, height * 0.7);
+  cairo_font_extents_t font;
+  cairo_font_extents(cr, &font);
+  double gray = activated ? 1 : 0.6;
+  cairo_set_source_rgba(cr, gray, gray, gray, 1);
+  cairo_move_to(cr, TITLEBAR_PADDING * scale,
+                (height - font.height) / 2 + font.ascent);
+  cairo_show_text(cr, title.c_str());
+
+  cairo_surface_flush(surface);
+  // ARGB32 is premultiplied ARGB8888 in native byte order
+  struct wlr_texture *texture = wlr_texture_from_pixels(
+      renderer, WL_SHM_FORMAT_ARGB8888,
+      cairo_image_surface_get_stride(surface), width, height,
+      cairo_image_surface_get_data(surface));
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+  return texture;
+}
+
+struct wlr_texture *ti::titlebar::texture(struct wlr_renderer *renderer,
+                                          int width, float scale,
+                                          bool activated) {
+  auto it = std::find_if(cache.begin(), cache.end(),
+                         [&](const entry &e) { return e.scale == scale; });
+  if (it != cache.end() && it->width == width &&
+      it->activated == activated && it->title == shown_title) {
+    return it->texture;
+  }
+
+  int pixel_width = std::ceil(width * scale);
+  int pixel_height = std::ceil(view->titlebar_height * scale);
+  if (pixel_width <= 0 || pixel_height <= 0) {
+    return nullptr;
+  }
+  struct wlr_texture *texture = rasterize(renderer, shown_title, pixel_width,
+                                          pixel_height, scale, activated);
+  if (texture == nullptr) {
+    return nullptr;
+  }
+  if (it == cache.end()) {
+    cache.push_back({shown_title, width, scale, activated, texture});
+  } else {
+    wlr_texture_destroy(it->texture);
+    *it = {shown_title, width, scale, activated, texture};
+  }
+  return texture;
+}
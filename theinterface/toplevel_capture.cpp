@@ -0,0 +1,655 @@
+#include <cstring>
+#include <ctime>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+extern "C" {
+#include <wlr/backend.h>
+#include <wlr/render/egl.h>
+#include <wlr/util/log.h>
+#define static
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_matrix.h>
+#undef static
+}
+
+#include "ti-toplevel-capture-unstable-v1-protocol.h"
+
+#include "desktop.hpp"
+#include "render.hpp"
+#include "server.hpp"
+#include "view.hpp"
+
+#include "toplevel_capture.hpp"
+
+#define TOPLEVEL_CAPTURE_MANAGER_VERSION 1
+
+/// above this many damage rectangles, only the extents are sent
+#define TOPLEVEL_CAPTURE_MAX_RECTS 32
+
+/// returns nullptr once the frame is done
+static ti::toplevel_capture_frame *
+frame_from_resource(struct wl_resource *resource) {
+  return reinterpret_cast<ti::toplevel_capture_frame *>(
+      wl_resource_get_user_data(resource));
+}
+
+/// the frame is done (ready or failed), but the resource lives on until the
+/// client destroys it
+static void frame_finish(ti::toplevel_capture_frame *frame) {
+  wl_list_remove(&frame->link);
+  wl_list_init(&frame->link);
+  wl_list_remove(&frame->buffer_destroy.link);
+  wl_list_init(&frame->buffer_destroy.link);
+  wl_resource_set_user_data(frame->resource, NULL);
+  delete frame;
+}
+
+static void frame_fail(ti::toplevel_capture_frame *frame) {
+  zti_toplevel_capture_frame_v1_send_failed(frame->resource);
+  frame_finish(frame);
+}
+
+static void frame_handle_buffer_destroy(struct wl_listener *listener,
+                                        void *data) {
+  ti::toplevel_capture_frame *frame =
+      wl_container_of(listener, frame, buffer_destroy);
+  frame_fail(frame);
+}
+
+static bool make_egl_current(ti::desktop *desktop) {
+  struct wlr_egl *egl = wlr_backend_get_egl(desktop->server->backend);
+  return egl != NULL && wlr_egl_make_current(egl, EGL_NO_SURFACE, NULL);
+}
+
+static void session_destroy(ti::toplevel_capture_manager *manager,
+                            ti::toplevel_capture_session *session) {
+  if (session->fbo && make_egl_current(manager->desktop)) {
+    glDeleteFramebuffers(1, &session->fbo);
+    glDeleteRenderbuffers(1, &session->rbo);
+  }
+  wl_list_remove(&session->link);
+  wl_list_remove(&session->client_destroy.link);
+  delete session;
+}
+
+static void session_handle_client_destroy(struct wl_listener *listener,
+                                          void *data) {
+  ti::toplevel_capture_session *session =
+      wl_container_of(listener, session, client_destroy);
+  session_destroy(session->view->desktop->toplevel_capture, session);
+}
+
+static ti::toplevel_capture_session *
+get_session(ti::toplevel_capture_manager *manager, struct wl_client *client,
+            ti::view *view) {
+  ti::toplevel_capture_session *session;
+  wl_list_for_each(session, &manager->sessions, link) {
+    if (session->client == client && session->view == view) {
+      return session;
+    }
+  }
+
+  session = new ti::toplevel_capture_session{};
+  session->client = client;
+  session->view = view;
+  session->client_destroy.notify = session_handle_client_destroy;
+  wl_client_add_destroy_listener(client, &session->client_destroy);
+  wl_list_insert(&manager->sessions, &session->link);
+  return session;
+}
+
+static void buffer_handle_destroy(struct wl_listener *listener, void *data) {
+  ti::toplevel_capture_buffer *buffer =
+      wl_container_of(listener, buffer, destroy);
+  wl_list_remove(&buffer->link);
+  wl_list_remove(&buffer->destroy.link);
+  pixman_region32_fini(&buffer->damage);
+  delete buffer;
+}
+
+/// returns the state of the wl_buffer resource, creating it if needed
+static ti::toplevel_capture_buffer *
+get_buffer(ti::toplevel_capture_manager *manager,
+           struct wl_resource *resource) {
+  ti::toplevel_capture_buffer *buffer;
+  wl_list_for_each(buffer, &manager->buffers, link) {
+    if (buffer->resource == resource) {
+      return buffer;
+    }
+  }
+
+  buffer = new ti::toplevel_capture_buffer{};
+  buffer->resource = resource;
+  pixman_region32_init(&buffer->damage);
+  buffer->destroy.notify = buffer_handle_destroy;
+  wl_resource_add_destroy_listener(resource, &buffer->destroy);
+  wl_list_insert(&manager->buffers, &buffer->link);
+  return buffer;
+}
+
+bool ti::toplevel_capture_buffer::holds(ti::view *view,
+                                        const struct wlr_box &box) {
+  return this->view == view && memcmp(&this->box, &box, sizeof(wlr_box)) == 0;
+}
+
+/// the framebuffer doesn't need to keep its contents between captures, only
+/// the damaged rectangles are drawn and read back each time
+static bool session_ensure_framebuffer(ti::toplevel_capture_session *session,
+                                       int width, int height) {
+  if (session->fbo && session->fb_width == width &&
+      session->fb_height == height) {
+    return true;
+  }
+
+  if (session->fbo) {
+    glDeleteFramebuffers(1, &session->fbo);
+    glDeleteRenderbuffers(1, &session->rbo);
+    session->fbo = session->rbo = 0;
+  }
+
+  glGenRenderbuffers(1, &session->rbo);
+  glBindRenderbuffer(GL_RENDERBUFFER, session->rbo);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8_OES, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &session->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, session->fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, session->rbo);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    wlr_log(WLR_ERROR, "Toplevel capture framebuffer incomplete: 0x%x",
+            status);
+    glDeleteFramebuffers(1, &session->fbo);
+    glDeleteRenderbuffers(1, &session->rbo);
+    session->fbo = session->rbo = 0;
+    return false;
+  }
+
+  session->fb_width = width;
+  session->fb_height = height;
+  return true;
+}
+
+static void surface_box_iterator(struct wlr_surface *surface, int sx, int sy,
+                                 void *data) {
+  auto *extents = reinterpret_cast<pixman_region32_t *>(data);
+  if (!wlr_surface_has_buffer(surface)) {
+    return;
+  }
+  pixman_region32_union_rect(extents, extents, sx + surface->sx,
+                             sy + surface->sy, surface->current.width,
+                             surface->current.height);
+}
+
+/// bounding box of all the surfaces of the view, including popups
+static struct wlr_box view_surfaces_box(ti::view *view) {
+  pixman_region32_t extents;
+  pixman_region32_init(&extents);
+  view->for_each_surface(surface_box_iterator, &extents);
+  pixman_box32_t *e = pixman_region32_extents(&extents);
+  struct wlr_box box = {
+      .x = e->x1,
+      .y = e->y1,
+      .width = e->x2 - e->x1,
+      .height = e->y2 - e->y1,
+  };
+  pixman_region32_fini(&extents);
+  return box;
+}
+
+struct capture_render_data {
+  struct wlr_renderer *renderer;
+  /// in framebuffer coordinates
+  pixman_region32_t *damage;
+  int ox, oy;
+  float projection[9];
+};
+
+static void capture_render_iterator(struct wlr_surface *surface, int sx,
+                                    int sy, void *_data) {
+  auto *data = reinterpret_cast<capture_render_data *>(_data);
+  struct wlr_texture *texture = wlr_surface_get_texture(surface);
+  if (!texture) {
+    return;
+  }
+
+  struct wlr_box box = {
+      .x = sx + surface->sx + data->ox,
+      .y = sy + surface->sy + data->oy,
+      .width = surface->current.width,
+      .height = surface->current.height,
+  };
+
+  pixman_region32_t damage;
+  pixman_region32_init_rect(&damage, box.x, box.y, box.width, box.height);
+  pixman_region32_intersect(&damage, &damage, data->damage);
+
+  float matrix[9];
+  enum wl_output_transform transform =
+      wlr_output_transform_invert(surface->current.transform);
+  wlr_matrix_project_box(matrix, &box, transform, 0, data->projection);
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+  for (int i = 0; i < nrects; ++i) {
+    struct wlr_box scissor = {
+        .x = rects[i].x1,
+        .y = rects[i].y1,
+        .width = rects[i].x2 - rects[i].x1,
+        .height = rects[i].y2 - rects[i].y1,
+    };
+    wlr_renderer_scissor(data->renderer, &scissor);
+    wlr_render_texture_with_matrix(data->renderer, texture, matrix, 1.0);
+  }
+  pixman_region32_fini(&damage);
+}
+
+/** Renders the parts of the view's surface tree inside region (view-local
+ * coordinates) offscreen, and copies them into the frame's buffer. */
+static bool frame_render_region(ti::toplevel_capture_frame *frame,
+                                ti::toplevel_capture_session *session,
+                                pixman_region32_t *region) {
+  ti::desktop *desktop = frame->manager->desktop;
+  struct wlr_renderer *renderer = desktop->server->renderer;
+  const float transparent[] = {0.0, 0.0, 0.0, 0.0};
+
+  if (!make_egl_current(desktop) ||
+      !session_ensure_framebuffer(session, frame->box.width,
+                                  frame->box.height)) {
+    return false;
+  }
+
+  pixman_region32_t damage;
+  pixman_region32_init(&damage);
+  pixman_region32_copy(&damage, region);
+  pixman_region32_translate(&damage, -frame->box.x, -frame->box.y);
+
+  capture_render_data data = {
+      .renderer = renderer,
+      .damage = &damage,
+      .ox = -frame->box.x,
+      .oy = -frame->box.y,
+      .projection = {},
+  };
+  wlr_matrix_projection(data.projection, frame->box.width, frame->box.height,
+                        WL_OUTPUT_TRANSFORM_NORMAL);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, session->fbo);
+  wlr_renderer_begin(renderer, frame->box.width, frame->box.height);
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+  for (int i = 0; i < nrects; ++i) {
+    struct wlr_box scissor = {
+        .x = rects[i].x1,
+        .y = rects[i].y1,
+        .width = rects[i].x2 - rects[i].x1,
+        .height = rects[i].y2 - rects[i].y1,
+    };
+    wlr_renderer_scissor(renderer, &scissor);
+    wlr_renderer_clear(renderer, transparent);
+  }
+  frame->view->for_each_surface(capture_render_iterator, &data);
+  wlr_renderer_scissor(renderer, NULL);
+
+  bool ok = read_region_to_shm(renderer, frame->buffer, frame->format,
+                               frame->stride, &damage, 0, 0);
+
+  wlr_renderer_end(renderer);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  pixman_region32_fini(&damage);
+  return ok;
+}
+
+static void frame_send_damage(ti::toplevel_capture_frame *frame,
+                              pixman_region32_t *damage) {
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+  if (nrects > TOPLEVEL_CAPTURE_MAX_RECTS) {
+    rects = pixman_region32_extents(damage);
+    nrects = 1;
+  }
+  for (int i = 0; i < nrects; ++i) {
+    zti_toplevel_capture_frame_v1_send_damage(
+        frame->resource, rects[i].x1 - frame->box.x,
+        rects[i].y1 - frame->box.y, rects[i].x2 - rects[i].x1,
+        rects[i].y2 - rects[i].y1);
+  }
+}
+
+/** Copies the frame if there is something to copy. Returns false if the frame
+ * keeps waiting for damage. */
+static bool frame_try_complete(ti::toplevel_capture_frame *frame) {
+  ti::toplevel_capture_session *session =
+      get_session(frame->manager, wl_resource_get_client(frame->resource),
+                  frame->view);
+  ti::toplevel_capture_buffer *buffer =
+      get_buffer(frame->manager, frame->buffer);
+
+  /* If the buffer holds another view or region, e.g. its last copy was of
+   * another view or the view was resized since, all of it is copied. */
+  pixman_region32_t damage;
+  pixman_region32_init_rect(&damage, frame->box.x, frame->box.y,
+                            frame->box.width, frame->box.height);
+  if (buffer->holds(frame->view, frame->box)) {
+    pixman_region32_intersect(&damage, &damage, &buffer->damage);
+  }
+  if (frame->with_damage && !pixman_region32_not_empty(&damage)) {
+    pixman_region32_fini(&damage);
+    return false;
+  }
+
+  // a static window copied into the same buffer costs nothing
+  bool ok = !pixman_region32_not_empty(&damage) ||
+            frame_render_region(frame, session, &damage);
+  if (!ok) {
+    pixman_region32_fini(&damage);
+    frame_fail(frame);
+    return true;
+  }
+
+  buffer->view = frame->view;
+  buffer->box = frame->box;
+  pixman_region32_clear(&buffer->damage);
+
+  if (frame->with_damage) {
+    frame_send_damage(frame, &damage);
+  }
+  pixman_region32_fini(&damage);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t tv_sec = (uint64_t)now.tv_sec;
+  zti_toplevel_capture_frame_v1_send_ready(frame->resource, tv_sec >> 32,
+                                           tv_sec & 0xFFFFFFFF, now.tv_nsec);
+  frame_finish(frame);
+  return true;
+}
+
+static void surface_damage_iterator(struct wlr_surface *surface, int sx,
+                                    int sy, void *data) {
+  auto *damage = reinterpret_cast<pixman_region32_t *>(data);
+  if (!pixman_region32_not_empty(&surface->buffer_damage)) {
+    return;
+  }
+
+  pixman_region32_t surface_damage;
+  pixman_region32_init(&surface_damage);
+  wlr_surface_get_effective_damage(surface, &surface_damage);
+  pixman_region32_translate(&surface_damage, sx + surface->sx,
+                            sy + surface->sy);
+  pixman_region32_union(damage, damage, &surface_damage);
+  pixman_region32_fini(&surface_damage);
+}
+
+struct find_surface_data {
+  struct wlr_surface *surface;
+  pixman_region32_t *damage;
+  bool found;
+};
+
+/// adds the damage of one surface of the view, if it is part of it
+static void find_surface_iterator(struct wlr_surface *surface, int sx, int sy,
+                                  void *data) {
+  auto *find = reinterpret_cast<find_surface_data *>(data);
+  if (surface == find->surface) {
+    surface_damage_iterator(surface, sx, sy, find->damage);
+    find->found = true;
+  }
+}
+
+void ti::toplevel_capture_manager::surface_committed(
+    struct wlr_surface *surface) {
+  if (wl_list_empty(&buffers)) {
+    return;
+  }
+
+  pixman_region32_t damage;
+  pixman_region32_init(&damage);
+  find_surface_data find = {surface, &damage, false};
+
+  // the captured view the surface is part of, if any
+  ti::view *view = nullptr;
+  ti::toplevel_capture_buffer *buffer;
+  wl_list_for_each(buffer, &buffers, link) {
+    if (buffer->view == nullptr) {
+      continue;
+    }
+    buffer->view->for_each_surface(find_surface_iterator, &find);
+    if (find.found) {
+      view = buffer->view;
+      break;
+    }
+  }
+  if (view == nullptr) {
+    pixman_region32_fini(&damage);
+    return;
+  }
+
+  wl_list_for_each(buffer, &buffers, link) {
+    if (buffer->view == view) {
+      pixman_region32_union(&buffer->damage, &buffer->damage, &damage);
+    }
+  }
+  pixman_region32_fini(&damage);
+
+  ti::toplevel_capture_frame *frame, *tmp;
+  wl_list_for_each_safe(frame, tmp, &frames, link) {
+    if (frame->view == view && frame->buffer != nullptr) {
+      frame_try_complete(frame);
+    }
+  }
+}
+
+void ti::toplevel_capture_manager::view_destroyed(ti::view *view) {
+  ti::toplevel_capture_frame *frame, *ftmp;
+  wl_list_for_each_safe(frame, ftmp, &frames, link) {
+    if (frame->view == view) {
+      frame_fail(frame);
+    }
+  }
+
+  ti::toplevel_capture_session *session, *stmp;
+  wl_list_for_each_safe(session, stmp, &sessions, link) {
+    if (session->view == view) {
+      session_destroy(this, session);
+    }
+  }
+
+  // the next copy into their buffers is a full one
+  ti::toplevel_capture_buffer *buffer;
+  wl_list_for_each(buffer, &buffers, link) {
+    if (buffer->view == view) {
+      buffer->view = nullptr;
+      pixman_region32_clear(&buffer->damage);
+    }
+  }
+}
+
+static void frame_handle_copy(struct wl_client *client,
+                              struct wl_resource *resource,
+                              struct wl_resource *buffer_resource,
+                              bool with_damage) {
+  ti::toplevel_capture_frame *frame = frame_from_resource(resource);
+  if (frame == nullptr) {
+    // already done
+    return;
+  }
+
+  if (frame->buffer != nullptr) {
+    wl_resource_post_error(frame->resource,
+                           ZTI_TOPLEVEL_CAPTURE_FRAME_V1_ERROR_ALREADY_USED,
+                           "frame already used");
+    return;
+  }
+
+  struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer_resource);
+  if (shm_buffer == NULL ||
+      wl_shm_buffer_get_format(shm_buffer) != (uint32_t)frame->format ||
+      wl_shm_buffer_get_width(shm_buffer) != frame->box.width ||
+      wl_shm_buffer_get_height(shm_buffer) != frame->box.height ||
+      wl_shm_buffer_get_stride(shm_buffer) != frame->stride) {
+    wl_resource_post_error(frame->resource,
+                           ZTI_TOPLEVEL_CAPTURE_FRAME_V1_ERROR_INVALID_BUFFER,
+                           "invalid buffer attributes");
+    return;
+  }
+
+  frame->buffer = buffer_resource;
+  frame->with_damage = with_damage;
+  frame->buffer_destroy.notify = frame_handle_buffer_destroy;
+  wl_resource_add_destroy_listener(buffer_resource, &frame->buffer_destroy);
+
+  frame_try_complete(frame);
+}
+
+static void frame_handle_copy_without_damage(struct wl_client *client,
+                                             struct wl_resource *resource,
+                                             struct wl_resource *buffer) {
+  frame_handle_copy(client, resource, buffer, false);
+}
+
+static void frame_handle_copy_with_damage(struct wl_client *client,
+                                          struct wl_resource *resource,
+                                          struct wl_resource *buffer) {
+  frame_handle_copy(client, resource, buffer, true);
+}
+
+static void frame_handle_destroy(struct wl_client *client,
+                                 struct wl_resource *resource) {
+  wl_resource_destroy(resource);
+}
+
+static const struct zti_toplevel_capture_frame_v1_interface frame_impl = {
+    .copy = frame_handle_copy_without_damage,
+    .copy_with_damage = frame_handle_copy_with_damage,
+    .destroy = frame_handle_destroy,
+};
+
+static void frame_handle_resource_destroy(struct wl_resource *resource) {
+  ti::toplevel_capture_frame *frame = frame_from_resource(resource);
+  if (frame != nullptr) {
+    frame_finish(frame);
+  }
+}
+
+/// finds the view behind a zwlr_foreign_toplevel_handle_v1 resource
+static ti::view *view_from_toplevel_resource(ti::desktop *desktop,
+                                             struct wl_resource *toplevel) {
+  if (strcmp(wl_resource_get_class(toplevel),
+             "zwlr_foreign_toplevel_handle_v1") != 0) {
+    return nullptr;
+  }
+
+  ti::view *view;
+  wl_list_for_each(view, &desktop->views, link) {
+    if (!view->mapped || !view->toplevel_handle) {
+      continue;
+    }
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &view->toplevel_handle->resources) {
+      if (resource == toplevel) {
+        return view;
+      }
+    }
+  }
+  return nullptr;
+}
+
+static void manager_handle_capture_toplevel(struct wl_client *client,
+                                            struct wl_resource *manager_resource,
+                                            uint32_t id,
+                                            struct wl_resource *toplevel) {
+  auto *manager = reinterpret_cast<ti::toplevel_capture_manager *>(
+      wl_resource_get_user_data(manager_resource));
+
+  auto *frame = new ti::toplevel_capture_frame{};
+  frame->manager = manager;
+  frame->resource =
+      wl_resource_create(client, &zti_toplevel_capture_frame_v1_interface,
+                         wl_resource_get_version(manager_resource), id);
+  if (frame->resource == NULL) {
+    delete frame;
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(frame->resource, &frame_impl, frame,
+                                 frame_handle_resource_destroy);
+  wl_list_init(&frame->link);
+  wl_list_init(&frame->buffer_destroy.link);
+
+  frame->view = view_from_toplevel_resource(manager->desktop, toplevel);
+  if (frame->view == nullptr) {
+    frame_fail(frame);
+    return;
+  }
+
+  frame->box = view_surfaces_box(frame->view);
+  if (frame->box.width <= 0 || frame->box.height <= 0) {
+    frame_fail(frame);
+    return;
+  }
+
+  struct wlr_renderer *renderer = manager->desktop->server->renderer;
+  frame->format = wlr_renderer_preferred_read_format(renderer);
+  frame->stride = 4 * frame->box.width;
+
+  wl_list_insert(&manager->frames, &frame->link);
+  zti_toplevel_capture_frame_v1_send_buffer(frame->resource, frame->format,
+                                            frame->box.width,
+                                            frame->box.height, frame->stride);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+                                   struct wl_resource *manager_resource) {
+  wl_resource_destroy(manager_resource);
+}
+
+static const struct zti_toplevel_capture_manager_v1_interface manager_impl = {
+    .capture_toplevel = manager_handle_capture_toplevel,
+    .destroy = manager_handle_destroy,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+                         uint32_t version, uint32_t id) {
+  auto *manager = reinterpret_cast<ti::toplevel_capture_manager *>(data);
+
+  struct wl_resource *resource = wl_resource_create(
+      client, &zti_toplevel_capture_manager_v1_interface, version, id);
+  if (resource == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(resource, &manager_impl, manager, NULL);
+}
+
+ti::toplevel_capture_manager::toplevel_capture_manager(ti::desktop *d) {
+  this->desktop = d;
+  wl_list_init(&this->frames);
+  wl_list_init(&this->sessions);
+  wl_list_init(&this->buffers);
+
+  this->global = wl_global_create(
+      desktop->server->display, &zti_toplevel_capture_manager_v1_interface,
+      TOPLEVEL_CAPTURE_MANAGER_VERSION, this, manager_bind);
+}
+
+ti::toplevel_capture_manager::~toplevel_capture_manager() {
+  ti::toplevel_capture_frame *frame, *tmp;
+  wl_list_for_each_safe(frame, tmp, &frames, link) { frame_fail(frame); }
+  // the desktop is gone before the clients are, drop their client listeners
+  ti::toplevel_capture_session *session, *session_tmp;
+  wl_list_for_each_safe(session, session_tmp, &sessions, link) {
+    session_destroy(this, session);
+  }
+  ti::toplevel_capture_buffer *buffer, *buffer_tmp;
+  wl_list_for_each_safe(buffer, buffer_tmp, &buffers, link) {
+    buffer_handle_destroy(&buffer->destroy, nullptr);
+  }
+  wl_global_destroy(this->global);
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <ctime>
 #include <fcntl.h> //needed for open
 #include <libudev.h>
 #include <string>
@@ -118,3 +120,44 @@ void fps_counter(const timespec &now) {
     frames_last_second = 0;
   }
 }
+
+static int clock_speed() {
+  static int speed = -1;
+  if (speed < 0) {
+    const char *env = getenv("TI_CLOCK_SPEED");
+    speed = env ? std::max(1, atoi(env)) : 1;
+    if (speed != 1) {
+      wlr_log(WLR_INFO, "Simulated clock running %dx faster", speed);
+    }
+  }
+  return speed;
+}
+
+timespec ti::monotonic_now() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int speed = clock_speed();
+  if (speed == 1) {
+    return now;
+  }
+
+  static timespec start = now;
+  int64_t elapsed_nsec = ((int64_t)(now.tv_sec - start.tv_sec) * 1000000000 +
+                          (now.tv_nsec - start.tv_nsec)) *
+                         speed;
+  timespec simulated = {
+      .tv_sec = start.tv_sec + elapsed_nsec / 1000000000,
+      .tv_nsec = start.tv_nsec + elapsed_nsec % 1000000000,
+  };
+  if (simulated.tv_nsec >= 1000000000) {
+    simulated.tv_sec += 1;
+    simulated.tv_nsec -= 1000000000;
+  }
+  return simulated;
+}
+
+int ti::real_msec(int msec) {
+  int speed = clock_speed();
+  // never return 0, that would disarm the timer
+  return std::max(1, msec / speed);
+}
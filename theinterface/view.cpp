@@ -1,5 +1,8 @@
 extern "C" {
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/edges.h>
 }
 
 #include "desktop.hpp"
@@ -7,6 +10,7 @@ extern "C" {
 #include "render.hpp"
 #include "seat.hpp"
 #include "server.hpp"
+#include "titlebar.hpp"
 #include "xdg_shell.hpp"
 #include "xwayland.hpp"
 
@@ -18,7 +22,7 @@ ti::view::view(enum view_type t, int __x, int __y) : type(t) {
   box.x = __x;
   box.y = __y;
 }
-ti::view::~view() {}
+ti::view::~view() { delete titlebar; }
 
 void ti::view::get_box(wlr_box &_box) {
   _box.x = box.x;
@@ -29,7 +33,7 @@ void ti::view::get_box(wlr_box &_box) {
 
 void ti::view::get_deco_box(wlr_box &_box) {
   ti::view::get_box(_box);
-  if (!decorated) {
+  if (!decorated || fullscreen_output != nullptr) {
     return;
   }
 
@@ -39,6 +43,35 @@ void ti::view::get_deco_box(wlr_box &_box) {
   _box.height += (border_width * 2 + titlebar_height);
 }
 
+bool ti::view::decoration_at(double lx, double ly, unsigned *edges) {
+  if (!decorated || fullscreen_output != nullptr || surface == nullptr) {
+    return false;
+  }
+  struct wlr_box deco_box;
+  get_deco_box(deco_box);
+  if (!wlr_box_contains_point(&deco_box, lx, ly) ||
+      wlr_box_contains_point(&box, lx, ly)) {
+    return false;
+  }
+  if (edges == nullptr) {
+    return true;
+  }
+
+  // the border along the titlebar resizes too
+  *edges = WLR_EDGE_NONE;
+  if (lx < box.x) {
+    *edges |= WLR_EDGE_LEFT;
+  } else if (lx >= box.x + box.width) {
+    *edges |= WLR_EDGE_RIGHT;
+  }
+  if (ly < deco_box.y + (int)border_width) {
+    *edges |= WLR_EDGE_TOP;
+  } else if (ly >= box.y + box.height) {
+    *edges |= WLR_EDGE_BOTTOM;
+  }
+  return true;
+}
+
 void ti::view::update_position(int __x, int __y) {
   if (box.x == __x && box.y == __y) {
     return;
@@ -48,11 +81,78 @@ void ti::view::update_position(int __x, int __y) {
   box.x = __x;
   box.y = __y;
   this->damage_whole();
+  update_primary_output();
+}
+
+/// area of the view visible on the output, in layout coordinates
+static int view_area_on_output(ti::view *view, ti::output *output) {
+  struct wlr_box *output_box = wlr_output_layout_get_box(
+      view->desktop->output_layout, output->wlr_output);
+  if (!output_box) {
+    return 0;
+  }
+
+  struct wlr_box intersection;
+  if (!wlr_box_intersection(&intersection, output_box, &view->box)) {
+    return 0;
+  }
+  return intersection.width * intersection.height;
+}
+
+void ti::view::update_primary_output() {
+  if (!mapped) {
+    primary_output = nullptr;
+    return;
+  }
+
+  ti::output *best = nullptr;
+  int best_area = 0;
+  ti::output *output;
+  wl_list_for_each(output, &desktop->outputs, link) {
+    // hidden beneath another view's fullscreen, it gets no frame callbacks
+    if (!output->wlr_output->enabled ||
+        (output->fullscreen_view != nullptr &&
+         output->fullscreen_view != this)) {
+      continue;
+    }
+    int area = view_area_on_output(this, output);
+    if (area == 0) {
+      continue;
+    }
+    if (best == nullptr || area > best_area ||
+        (area == best_area &&
+         output->wlr_output->refresh > best->wlr_output->refresh)) {
+      best = output;
+      best_area = area;
+    }
+  }
+
+  ti::output *current = primary_output;
+  if (current != nullptr && current != best && best != nullptr &&
+      current->wlr_output->enabled &&
+      (current->fullscreen_view == nullptr ||
+       current->fullscreen_view == this)) {
+    // hysteresis: keep the current output as long as it shows as much of the
+    // view as the best candidate
+    int current_area = view_area_on_output(this, current);
+    if (current_area >= best_area) {
+      return;
+    }
+  }
+
+  if (best != current && best != nullptr) {
+    // the new primary output might have just finished its frame, make sure the
+    // client doesn't wait for a callback until something else damages it
+    wlr_output_schedule_frame(best->wlr_output);
+  }
+  primary_output = best;
 }
 
-void ti::view::begin_interactive(ti::cursor_mode mode, unsigned edges) {
+void ti::view::begin_interactive(ti::cursor_mode mode, unsigned edges,
+                                 bool from_client) {
   ti::seat *seat = this->desktop->seat;
-  if (surface != seat->wlr_seat->pointer_state.focused_surface) {
+  if (from_client &&
+      surface != seat->wlr_seat->pointer_state.focused_surface) {
     /* Deny move/resize requests from unfocused clients. */
     return;
   }
@@ -88,6 +188,112 @@ void ti::view::begin_interactive(ti::cursor_mode mode, unsigned edges) {
   seat->resize_edges = edges;
 }
 
+void ti::view::set_fullscreen(bool fullscreen, struct wlr_output *wlr_output) {
+  ti::output *output = fullscreen_output;
+
+  if (fullscreen) {
+    if (wlr_output == nullptr) {
+      wlr_output = wlr_output_layout_output_at(desktop->output_layout,
+                                               box.x + box.width / 2.0,
+                                               box.y + box.height / 2.0);
+    }
+    output = output_from_wlr_output(wlr_output);
+    if (output != nullptr && !output->mirror_of.empty()) {
+      // a mirror shows its source, go fullscreen there instead
+      output = output->mirror_source;
+    }
+    if (output == nullptr || output == fullscreen_output) {
+      return;
+    }
+    struct wlr_box *output_box =
+        wlr_output_layout_get_box(desktop->output_layout, output->wlr_output);
+    if (output_box == nullptr) {
+      return;
+    }
+    if (fullscreen_output != nullptr) {
+      // moving to another output, restore the old one first
+      set_fullscreen(false, nullptr);
+    }
+    if (output->fullscreen_view != nullptr) {
+      output->fullscreen_view->set_fullscreen(false, nullptr);
+    }
+
+    damage_whole();
+    saved_box = box;
+    box = *output_box;
+    fullscreen_output = output;
+    output->fullscreen_view = this;
+  } else {
+    if (output == nullptr) {
+      return;
+    }
+    output->fullscreen_view = nullptr;
+    fullscreen_output = nullptr;
+    box = saved_box;
+    // views that were hidden beneath need to be drawn again
+    wlr_output_damage_add_whole(output->damage);
+  }
+
+  switch (type) {
+  case ti::XDG_SHELL_VIEW: {
+    auto *v = dynamic_cast<ti::xdg_view *>(this);
+    wlr_xdg_toplevel_set_fullscreen(v->xdg_surface, fullscreen);
+    wlr_xdg_toplevel_set_size(v->xdg_surface, box.width, box.height);
+    break;
+  }
+  case ti::XWAYLAND_VIEW: {
+    auto *v = dynamic_cast<ti::xwayland_view *>(this);
+    wlr_xwayland_surface_set_fullscreen(v->xwayland_surface, fullscreen);
+    wlr_xwayland_surface_configure(v->xwayland_surface, box.x, box.y,
+                                   box.width, box.height);
+    break;
+  }
+  }
+
+  if (toplevel_handle) {
+    wlr_foreign_toplevel_handle_v1_set_fullscreen(toplevel_handle, fullscreen);
+  }
+
+  damage_whole();
+  // views beneath it give the output up, or get it back
+  desktop->update_primary_outputs();
+  if (fullscreen && mapped) {
+    desktop->seat->focus(this);
+  }
+}
+
+/** Raised when a foreign toplevel client (e.g. a taskbar) asks for the view to
+ * enter or leave fullscreen. */
+static void
+handle_toplevel_handle_request_fullscreen(struct wl_listener *listener,
+                                          void *data) {
+  ti::view *view =
+      wl_container_of(listener, view, toplevel_handle_request_fullscreen);
+  auto *event =
+      reinterpret_cast<struct wlr_foreign_toplevel_handle_v1_fullscreen_event *>(
+          data);
+  view->set_fullscreen(event->fullscreen, event->output);
+}
+
+void ti::view::create_toplevel_handle() {
+  toplevel_handle = wlr_foreign_toplevel_handle_v1_create(
+      desktop->foreign_toplevel_manager_v1);
+
+  toplevel_handle_request_fullscreen.notify =
+      handle_toplevel_handle_request_fullscreen;
+  wl_signal_add(&toplevel_handle->events.request_fullscreen,
+                &toplevel_handle_request_fullscreen);
+}
+
+void ti::view::destroy_toplevel_handle() {
+  if (!toplevel_handle) {
+    return;
+  }
+  wl_list_remove(&toplevel_handle_request_fullscreen.link);
+  wlr_foreign_toplevel_handle_v1_destroy(toplevel_handle);
+  toplevel_handle = NULL;
+}
+
 void ti::view::damage_partial() {
   ti::output *output;
   wl_list_for_each(output, &desktop->outputs, link) {
@@ -108,6 +314,7 @@ void ti::view::render(ti::output *output, ti::render_data *data) {
     return;
   }
 
+  data->view = this;
   this->render_decorations(output, data);
   output->view_for_each_surface(this, render_surface_iterator, data);
 }
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <endian.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include <wlr/util/log.h>
+}
+
+#include "xcursor.hpp"
+
+/// "Xcur", little-endian
+#define XCURSOR_MAGIC 0x72756358
+#define XCURSOR_IMAGE_TYPE 0xfffd0002
+#define XCURSOR_FILE_HEADER_SIZE 16
+#define XCURSOR_TOC_ENTRY_SIZE 12
+#define XCURSOR_IMAGE_HEADER_SIZE 36
+#define XCURSOR_IMAGE_MAX_SIZE 0x7fff
+
+/// themes inheriting from themes inheriting from...
+#define XCURSOR_MAX_INHERITANCE 8
+
+/// the libXcursor default, after $XDG_DATA_HOME/icons
+#define XCURSOR_DEFAULT_PATH                                                   \
+  "~/.icons:/usr/share/icons:/usr/share/pixmaps:~/.cursors:"                  \
+  "/usr/share/cursors/xorg-x11"
+
+/// the nominal size the built-in cursor is drawn for
+#define BUILTIN_CURSOR_SIZE 24
+
+/// the built-in left_ptr: X is black, o is white, the rest is transparent
+static const char *const builtin_left_ptr[] = {
+    "X           ",
+    "XX          ",
+    "XoX         ",
+    "XooX        ",
+    "XoooX       ",
+    "XooooX      ",
+    "XoooooX     ",
+    "XooooooX    ",
+    "XoooooooX   ",
+    "XooooooooX  ",
+    "XoooooooooX ",
+    "XooooooXXXXX",
+    "XoooXooX    ",
+    "XooXXooX    ",
+    "XoX  XooX   ",
+    "XX   XooX   ",
+    "      XooX  ",
+    "      XooX  ",
+    "       XX   ",
+};
+#define BUILTIN_LEFT_PTR_WIDTH 12
+#define BUILTIN_LEFT_PTR_HEIGHT 19
+
+static uint32_t read_u32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return le32toh(value);
+}
+
+static bool is_dir(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/// XCURSOR_PATH, or the search path of libXcursor and wlroots, with ~
+/// expanded
+static std::vector<std::string> search_path() {
+  const char *env = getenv("XCURSOR_PATH");
+  const char *home = getenv("HOME");
+  const char *data_home = getenv("XDG_DATA_HOME");
+  std::string default_path =
+      std::string(data_home && *data_home ? data_home : "~/.local/share") +
+      "/icons:" XCURSOR_DEFAULT_PATH;
+  std::istringstream path(env ? env : default_path);
+
+  std::vector<std::string> dirs;
+  std::string dir;
+  while (std::getline(path, dir, ':')) {
+    if (dir.compare(0, 1, "~") == 0) {
+      if (home == nullptr) {
+        continue;
+      }
+      dir = home + dir.substr(1);
+    }
+    if (!dir.empty()) {
+      dirs.push_back(dir);
+    }
+  }
+  return dirs;
+}
+
+ti::cursor_theme &ti::cursor_theme::get() {
+  static ti::cursor_theme theme;
+  return theme;
+}
+
+ti::cursor_theme::cursor_theme() {
+  const char *name = getenv("XCURSOR_THEME");
+  const char *size = getenv("XCURSOR_SIZE");
+  this->theme_name = name ? name : "default";
+  this->size = size && atoi(size) > 0 ? atoi(size) : 24;
+  this->search_dirs = search_path();
+}
+
+ti::cursor_theme::~cursor_theme() {
+  for (auto &entry : files) {
+    if (entry.second != nullptr) {
+      munmap(const_cast<uint8_t *>(entry.second->data), entry.second->size);
+      delete entry.second;
+    }
+  }
+}
+
+void ti::cursor_theme::resolve_dirs(const std::string &theme, int depth) {
+  if (depth > XCURSOR_MAX_INHERITANCE) {
+    return;
+  }
+
+  std::string inherits;
+  for (const std::string &base : search_dirs) {
+    std::string dir = base + "/" + theme;
+    std::string cursors = dir + "/cursors";
+    if (is_dir(cursors) &&
+        std::find(dirs.begin(), dirs.end(), cursors) == dirs.end()) {
+      dirs.push_back(cursors);
+    }
+
+    std::ifstream index(dir + "/index.theme");
+    std::string line;
+    while (inherits.empty() && std::getline(index, line)) {
+      if (line.compare(0, 8, "Inherits") == 0 &&
+          line.find('=') != std::string::npos) {
+        inherits = line.substr(line.find('=') + 1);
+      }
+    }
+  }
+
+  // the separators libXcursor accepts
+  for (char &c : inherits) {
+    if (c == ',' || c == ';') {
+      c = ' ';
+    }
+  }
+  std::istringstream parents(inherits);
+  std::string parent;
+  while (parents >> parent) {
+    resolve_dirs(parent, depth + 1);
+  }
+}
+
+/** Maps the file of cursor name and indexes its images. The images are used
+ * from the mapping as they are: Xcursor pixels are little-endian ARGB, which
+ * is ARGB8888 in memory on the little-endian machines we run on. */
+ti::cursor_theme::cursor_file *
+ti::cursor_theme::load(const std::string &name) {
+  for (const std::string &dir : dirs) {
+    std::string path = dir + "/" + name;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= XCURSOR_FILE_HEADER_SIZE) {
+      data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+      continue;
+    }
+
+    auto *file = new cursor_file;
+    file->data = reinterpret_cast<const uint8_t *>(data);
+    file->size = st.st_size;
+
+    uint32_t header_size = read_u32(file->data + 4);
+    uint32_t ntoc = read_u32(file->data + 12);
+    if (read_u32(file->data) != XCURSOR_MAGIC ||
+        (uint64_t)header_size + (uint64_t)ntoc * XCURSOR_TOC_ENTRY_SIZE >
+            file->size) {
+      ntoc = 0;
+    }
+
+    for (uint32_t i = 0; i < ntoc; ++i) {
+      const uint8_t *entry =
+          file->data + header_size + i * XCURSOR_TOC_ENTRY_SIZE;
+      uint32_t type = read_u32(entry);
+      uint32_t nominal = read_u32(entry + 4);
+      uint32_t position = read_u32(entry + 8);
+      // only the first frame of animated cursors is used
+      if (type != XCURSOR_IMAGE_TYPE || file->images.count(nominal) ||
+          (uint64_t)position + XCURSOR_IMAGE_HEADER_SIZE > file->size) {
+        continue;
+      }
+
+      const uint8_t *chunk = file->data + position;
+      ti::cursor_image image = {
+          .width = read_u32(chunk + 16),
+          .height = read_u32(chunk + 20),
+          .hotspot_x = read_u32(chunk + 24),
+          .hotspot_y = read_u32(chunk + 28),
+          .delay = read_u32(chunk + 32),
+          .pixels = chunk + XCURSOR_IMAGE_HEADER_SIZE,
+      };
+      if (image.width == 0 || image.height == 0 ||
+          image.width > XCURSOR_IMAGE_MAX_SIZE ||
+          image.height > XCURSOR_IMAGE_MAX_SIZE ||
+          (uint64_t)position + XCURSOR_IMAGE_HEADER_SIZE +
+                  (uint64_t)image.width * image.height * 4 >
+              file->size) {
+        continue;
+      }
+      file->images[nominal] = image;
+    }
+
+    if (!file->images.empty()) {
+      wlr_log(WLR_DEBUG, "Loaded cursor %s", path.c_str());
+      return file;
+    }
+    munmap(data, file->size);
+    delete file;
+  }
+  return nullptr;
+}
+
+/** The cursor shown when the theme has none, e.g. when no icon theme is
+ * installed, scaled by whole pixels to about the wanted size. */
+const ti::cursor_image *ti::cursor_theme::builtin_image(uint32_t wanted) {
+  uint32_t factor = std::max<uint32_t>(
+      1, std::lround(wanted / (double)BUILTIN_CURSOR_SIZE));
+  auto it = builtin.find(factor);
+  if (it != builtin.end()) {
+    return &it->second.image;
+  }
+
+  builtin_cursor &cursor = builtin[factor];
+  uint32_t width = BUILTIN_LEFT_PTR_WIDTH * factor;
+  uint32_t height = BUILTIN_LEFT_PTR_HEIGHT * factor;
+  cursor.pixels.resize(width * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      char c = builtin_left_ptr[y / factor][x / factor];
+      cursor.pixels[y * width + x] =
+          c == 'X' ? 0xff000000 : c == 'o' ? 0xffffffff : 0;
+    }
+  }
+  cursor.image = {
+      .width = width,
+      .height = height,
+      .hotspot_x = 0,
+      .hotspot_y = 0,
+      .delay = 0,
+      .pixels = reinterpret_cast<const uint8_t *>(cursor.pixels.data()),
+  };
+  return &cursor.image;
+}
+
+const ti::cursor_image *ti::cursor_theme::image(const std::string &name,
+                                               float scale) {
+  if (!dirs_resolved) {
+    resolve_dirs(theme_name, 0);
+    if (theme_name != "default") {
+      resolve_dirs("default", 0);
+    }
+    dirs_resolved = true;
+  }
+
+  uint32_t wanted = std::lround(size * scale);
+  auto it = files.find(name);
+  if (it == files.end()) {
+    it = files.emplace(name, load(name)).first;
+    if (it->second == nullptr) {
+      wlr_log(WLR_ERROR, "Cursor %s isn't in theme %s", name.c_str(),
+              theme_name.c_str());
+    }
+  }
+  if (it->second == nullptr) {
+    // an arrow is better than no cursor at all
+    return name == "left_ptr" ? builtin_image(wanted)
+                              : image("left_ptr", scale);
+  }
+
+  // the image closest to the wanted size, the larger one on ties
+  const ti::cursor_image *best = nullptr;
+  uint32_t best_nominal = 0;
+  for (auto &entry : it->second->images) {
+    uint32_t nominal = entry.first;
+    uint32_t distance = nominal > wanted ? nominal - wanted : wanted - nominal;
+    uint32_t best_distance = best_nominal > wanted ? best_nominal - wanted
+                                                   : wanted - best_nominal;
+    if (best == nullptr || distance < best_distance ||
+        (distance == best_distance && nominal > best_nominal)) {
+      best = &entry.second;
+      best_nominal = nominal;
+    }
+  }
+  return best;
+}
@@ -5,41 +5,62 @@ extern "C" {
 #include <wlr/util/log.h>
 }
 
+#include "constraints.hpp"
+#include "desktop.hpp"
+#include "latency.hpp"
+#include "launch.hpp"
 #include "seat.hpp"
+#include "toplevel_capture.hpp"
 
 #include "xdg_shell.hpp"
 
 static void handle_xdg_surface_commit(struct wl_listener *listener,
                                       void *data) {
   ti::xdg_view *view = wl_container_of(listener, view, surface_commit);
-  view->damage_partial();
+  if (view->desktop->budget->commit(view)) {
+    view->damage_partial();
+  }
+  view->desktop->latency->view_committed(view);
 }
 
 /** Called when the surface is mapped, or ready to display on-screen. */
 static void handle_xdg_surface_map(struct wl_listener *listener, void *data) {
   ti::xdg_view *view = wl_container_of(listener, view, map);
   view->mapped = true;
+  view->update_primary_output();
 
   if (view->was_ever_mapped == false) {
     view->was_ever_mapped = true;
     wl_list_insert(&view->desktop->wem_views, &view->wem_link);
   }
 
-  view->toplevel_handle = wlr_foreign_toplevel_handle_v1_create(
-      view->desktop->foreign_toplevel_manager_v1);
+  view->create_toplevel_handle();
+  view->desktop->launches->view_mapped(view);
 
   /// TODO: seat could be different
   view->desktop->seat->focus(view);
+
+  // clients may ask for fullscreen before their first commit
+  struct wlr_xdg_toplevel *toplevel = view->xdg_surface->toplevel;
+  if (toplevel->client_pending.fullscreen) {
+    view->set_fullscreen(true, toplevel->client_pending.fullscreen_output);
+  }
 }
 
 /** Called when the surface is unmapped, and should no longer be shown. */
 static void handle_xdg_surface_unmap(struct wl_listener *listener, void *data) {
   ti::xdg_view *view = wl_container_of(listener, view, unmap);
+  if (view->fullscreen_output) {
+    view->set_fullscreen(false, nullptr);
+  }
   view->mapped = false;
-  if (view->toplevel_handle) {
-    wlr_foreign_toplevel_handle_v1_destroy(view->toplevel_handle);
-    view->toplevel_handle = NULL;
+  view->update_primary_output();
+  if (view->desktop->seat->focused_view == view) {
+    // an unmapped view can't hold the pointer
+    view->desktop->constraints->update(view->desktop->seat);
   }
+  view->desktop->toplevel_capture->view_destroyed(view);
+  view->destroy_toplevel_handle();
   view->damage_whole();
 }
 
@@ -56,6 +77,7 @@ static void handle_xdg_surface_destroy(struct wl_listener *listener,
   // we need to tell the desktop that this object doesnt exist anymore
   if (view->desktop->seat->focused_view == view) {
     view->desktop->seat->focused_view = nullptr;
+    view->desktop->constraints->update(view->desktop->seat);
   }
   if (view->desktop->seat->grabbed_view == view) {
     view->desktop->seat->grabbed_view = nullptr;
@@ -93,6 +115,21 @@ static void handle_xdg_toplevel_request_resize(struct wl_listener *listener,
   view->begin_interactive(ti::CURSOR_RESIZE, event->edges);
 }
 
+/** This event is raised when a client would like to enter or leave
+ * fullscreen, e.g. when the user presses F11 in a video player. */
+static void handle_xdg_toplevel_request_fullscreen(struct wl_listener *listener,
+                                                   void *data) {
+  auto *event =
+      reinterpret_cast<struct wlr_xdg_toplevel_set_fullscreen_event *>(data);
+  ti::xdg_view *view = wl_container_of(listener, view, request_fullscreen);
+  if (!view->mapped) {
+    // handled on map, but the client still expects a configure
+    wlr_xdg_surface_schedule_configure(view->xdg_surface);
+    return;
+  }
+  view->set_fullscreen(event->fullscreen, event->output);
+}
+
 void handle_new_xdg_surface(struct wl_listener *listener, void *data) {
   ti::desktop *desktop = wl_container_of(listener, desktop, new_xdg_surface);
   auto *xdg_surface = reinterpret_cast<struct wlr_xdg_surface *>(data);
@@ -133,6 +170,9 @@ void handle_new_xdg_surface(struct wl_listener *listener, void *data) {
   wl_signal_add(&toplevel->events.request_move, &view->request_move);
   view->request_resize.notify = handle_xdg_toplevel_request_resize;
   wl_signal_add(&toplevel->events.request_resize, &view->request_resize);
+  view->request_fullscreen.notify = handle_xdg_toplevel_request_fullscreen;
+  wl_signal_add(&toplevel->events.request_fullscreen,
+                &view->request_fullscreen);
 
   /* Add it to the list of views. */
   wl_list_insert(&desktop->views, &view->link);
@@ -142,6 +182,11 @@ std::string ti::xdg_view::get_title() {
   return this->xdg_surface->toplevel->title;
 }
 
+std::string ti::xdg_view::get_app_id() {
+  const char *app_id = this->xdg_surface->toplevel->app_id;
+  return app_id ? app_id : "";
+}
+
 void ti::xdg_view::for_each_surface(wlr_surface_iterator_func_t iterator,
                                     void *user_data) {
   wlr_xdg_surface_for_each_surface(xdg_surface, iterator, user_data);
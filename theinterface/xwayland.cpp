@@ -1,17 +1,146 @@
+#include <cstdlib>
+
 extern "C" {
+#include <xcb/res.h>
 #include <wlr/config.h>
 #include <wlr/types/wlr_foreign_toplevel_management_v1.h>
 #include <wlr/util/log.h>
 }
 
+#include "constraints.hpp"
 #include "cursor.hpp"
 #include "desktop.hpp"
+#include "latency.hpp"
+#include "launch.hpp"
 #include "seat.hpp"
+#include "server.hpp"
+#include "titlebar.hpp"
+#include "toplevel_capture.hpp"
+#include "util.hpp"
 
 #include "xwayland.hpp"
 
 #ifdef WLR_HAS_XWAYLAND
 
+static bool has_xwayland_views(ti::desktop *desktop) {
+  ti::view *view;
+  wl_list_for_each(view, &desktop->views, link) {
+    if (view->type == ti::XWAYLAND_VIEW) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** The X server itself, the window manager's connection and the one
+ * x11_client_count makes. */
+#define XWAYLAND_OWN_CLIENTS 3
+
+/** Asks the X server how many clients it has, with the X-Resource extension,
+ * or -1. Only call this while Xwayland runs: connecting would start it. */
+static int x11_client_count(ti::desktop *desktop) {
+  xcb_connection_t *xcb =
+      xcb_connect(desktop->xwayland->display_name, nullptr);
+  int count = -1;
+  if (!xcb_connection_has_error(xcb)) {
+    xcb_res_query_clients_reply_t *reply =
+        xcb_res_query_clients_reply(xcb, xcb_res_query_clients(xcb), nullptr);
+    if (reply != nullptr) {
+      count = reply->num_clients;
+      free(reply);
+    }
+  }
+  xcb_disconnect(xcb);
+  return count;
+}
+
+/** Whether X11 clients are connected, with or without windows: a clipboard
+ * manager or a client between two windows must not lose its X server. */
+static bool has_x11_clients(ti::desktop *desktop) {
+  if (desktop->xwayland->xwm == nullptr) {
+    // not started, or starting for a client that just connected
+    return desktop->xwayland->client != nullptr;
+  }
+  // if the count fails, better keep the server
+  int count = x11_client_count(desktop);
+  return count < 0 || count > XWAYLAND_OWN_CLIENTS;
+}
+
+/// arms the idle shutdown once the last X11 window is gone
+static void xwayland_check_idle(ti::desktop *desktop) {
+  if (desktop->xwayland_idle_timer == nullptr || has_xwayland_views(desktop)) {
+    return;
+  }
+  wl_event_source_timer_update(desktop->xwayland_idle_timer,
+                               ti::real_msec(desktop->xwayland_idle_timeout));
+}
+
+static void handle_xwayland_ready(struct wl_listener *listener, void *data) {
+  ti::desktop *desktop = wl_container_of(listener, desktop, xwayland_ready);
+  wlr_log(WLR_INFO, "Xwayland started on %s", desktop->xwayland->display_name);
+  desktop->seat->setup_xwayland_cursor(desktop->xwayland);
+  // the client that started Xwayland may never open a window
+  xwayland_check_idle(desktop);
+}
+
+static void xwayland_create(ti::desktop *desktop) {
+  desktop->xwayland = wlr_xwayland_create(desktop->server->display,
+                                          desktop->compositor, true);
+  if (desktop->xwayland == nullptr) {
+    wlr_log(WLR_ERROR, "Failed to set up Xwayland");
+    return;
+  }
+
+  desktop->new_xwayland_surface.notify = handle_new_xwayland_surface;
+  wl_signal_add(&desktop->xwayland->events.new_surface,
+                &desktop->new_xwayland_surface);
+  desktop->xwayland_ready.notify = handle_xwayland_ready;
+  wl_signal_add(&desktop->xwayland->events.ready, &desktop->xwayland_ready);
+
+  setenv("DISPLAY", desktop->xwayland->display_name, true);
+  wlr_xwayland_set_seat(desktop->xwayland, desktop->seat->wlr_seat);
+}
+
+/** Stops the X server and reserves a DISPLAY again, so the next X11 client
+ * starts a fresh one. wlroots can't stop the server and keep its sockets, so
+ * DISPLAY is only the same if nobody took the display number meanwhile. */
+static int handle_xwayland_idle(void *data) {
+  auto *desktop = reinterpret_cast<ti::desktop *>(data);
+  if (desktop->xwayland == nullptr || has_xwayland_views(desktop)) {
+    return 0;
+  }
+  if (has_x11_clients(desktop)) {
+    // windowless clients: check again later
+    wl_event_source_timer_update(
+        desktop->xwayland_idle_timer,
+        ti::real_msec(desktop->xwayland_idle_timeout));
+    return 0;
+  }
+
+  wlr_log(WLR_INFO, "No X11 client for %d seconds, stopping Xwayland",
+          desktop->xwayland_idle_timeout / 1000);
+  wl_list_remove(&desktop->new_xwayland_surface.link);
+  wl_list_remove(&desktop->xwayland_ready.link);
+  wlr_xwayland_destroy(desktop->xwayland);
+  xwayland_create(desktop);
+  return 0;
+}
+
+void xwayland_init(ti::desktop *desktop) {
+  const char *timeout_env = getenv("TI_XWAYLAND_IDLE_TIMEOUT");
+  if (timeout_env) {
+    desktop->xwayland_idle_timeout = atoi(timeout_env) * 1000;
+  }
+  if (desktop->xwayland_idle_timeout > 0) {
+    struct wl_event_loop *loop =
+        wl_display_get_event_loop(desktop->server->display);
+    desktop->xwayland_idle_timer =
+        wl_event_loop_add_timer(loop, handle_xwayland_idle, desktop);
+  }
+
+  xwayland_create(desktop);
+}
+
 static void handle_request_move(struct wl_listener *listener, void *data) {
   ti::xwayland_view *xwayland_view =
       wl_container_of(listener, xwayland_view, request_move);
@@ -29,7 +158,10 @@ static void handle_request_resize(struct wl_listener *listener, void *data) {
 static void handle_xwayland_surface_commit(struct wl_listener *listener,
                                            void *data) {
   ti::xwayland_view *view = wl_container_of(listener, view, commit);
-  view->damage_partial();
+  if (view->desktop->budget->commit(view)) {
+    view->damage_partial();
+  }
+  view->desktop->latency->view_committed(view);
 }
 
 static void handle_xwayland_surface_map(struct wl_listener *listener,
@@ -58,16 +190,22 @@ static void handle_xwayland_surface_map(struct wl_listener *listener,
 
   view->pid = xwayland_surface->pid;
   view->mapped = true;
+  view->update_primary_output();
+  view->title = xwayland_surface->title ?: "";
 
   if (view->xwayland_surface->decorations ==
       WLR_XWAYLAND_SURFACE_DECORATIONS_ALL) {
     view->decorated = true;
     view->border_width = 4;
-    view->titlebar_height = 12;
+    // room for the title text
+    view->titlebar_height = 18;
+    if (view->titlebar == nullptr) {
+      view->titlebar = new ti::titlebar(view, view->title);
+    }
   }
 
-  view->toplevel_handle = wlr_foreign_toplevel_handle_v1_create(
-      view->desktop->foreign_toplevel_manager_v1);
+  view->create_toplevel_handle();
+  view->desktop->launches->view_mapped(view);
 
   wlr_foreign_toplevel_handle_v1_set_title(
       view->toplevel_handle, view->xwayland_surface->title ?: "none");
@@ -77,7 +215,9 @@ static void handle_xwayland_surface_map(struct wl_listener *listener,
   view->commit.notify = handle_xwayland_surface_commit;
   wl_signal_add(&view->xwayland_surface->surface->events.commit, &view->commit);
 
-  if (wlr_xwayland_or_surface_wants_focus(view->xwayland_surface)) {
+  if (view->xwayland_surface->fullscreen) {
+    view->set_fullscreen(true, nullptr);
+  } else if (wlr_xwayland_or_surface_wants_focus(view->xwayland_surface)) {
     /// TODO: seat could be different
     view->desktop->seat->focus(view);
   } else {
@@ -91,11 +231,17 @@ static void handle_xwayland_surface_map(struct wl_listener *listener,
 static void handle_xwayland_surface_unmap(struct wl_listener *listener,
                                           void *data) {
   ti::xwayland_view *view = wl_container_of(listener, view, unmap);
+  if (view->fullscreen_output) {
+    view->set_fullscreen(false, nullptr);
+  }
   view->mapped = false;
-  if (view->toplevel_handle) {
-    wlr_foreign_toplevel_handle_v1_destroy(view->toplevel_handle);
-    view->toplevel_handle = NULL;
+  view->update_primary_output();
+  if (view->desktop->seat->focused_view == view) {
+    // an unmapped view can't hold the pointer
+    view->desktop->constraints->update(view->desktop->seat);
   }
+  view->desktop->toplevel_capture->view_destroyed(view);
+  view->destroy_toplevel_handle();
   view->damage_whole();
 }
 
@@ -111,6 +257,7 @@ void handle_xwayland_surface_destroy(struct wl_listener *listener, void *data) {
   // we need to tell the desktop that this object doesnt exist anymore
   if (view->desktop->seat->focused_view == view) {
     view->desktop->seat->focused_view = nullptr;
+    view->desktop->constraints->update(view->desktop->seat);
   }
   if (view->desktop->seat->grabbed_view == view) {
     view->desktop->seat->grabbed_view = nullptr;
@@ -121,13 +268,33 @@ void handle_xwayland_surface_destroy(struct wl_listener *listener, void *data) {
   }
   wl_list_remove(&view->link);
 
+  ti::desktop *desktop = view->desktop;
   delete view;
+  xwayland_check_idle(desktop);
 }
 
 /** called on title change */
 static void handle_set_title(struct wl_listener *listener, void *data) {
-  // do nothing...?
-  // ti::xwayland_view *view = wl_container_of(listener, view, destroy);
+  ti::xwayland_view *view = wl_container_of(listener, view, set_title);
+  view->title = view->xwayland_surface->title ?: "";
+  if (view->toplevel_handle != nullptr) {
+    wlr_foreign_toplevel_handle_v1_set_title(view->toplevel_handle,
+                                             view->title.c_str());
+  }
+  if (view->titlebar != nullptr) {
+    view->titlebar->set_title(view->title);
+  }
+}
+
+static void handle_request_fullscreen(struct wl_listener *listener,
+                                      void *data) {
+  ti::xwayland_view *view =
+      wl_container_of(listener, view, request_fullscreen);
+  if (!view->mapped) {
+    // handled on map
+    return;
+  }
+  view->set_fullscreen(view->xwayland_surface->fullscreen, nullptr);
 }
 
 static void handle_request_configure(struct wl_listener *listener, void *data) {
@@ -153,6 +320,9 @@ void handle_new_xwayland_surface(struct wl_listener *listener, void *data) {
 
   wlr_log(WLR_DEBUG, "New xwayland surface title='%s' class='%s'",
           xwayland_surface->title, xwayland_surface->c_class);
+  if (desktop->xwayland_idle_timer) {
+    wl_event_source_timer_update(desktop->xwayland_idle_timer, 0);
+  }
 
   /* Allocate a ti::view for this surface */
   ti::xwayland_view *view = new ti::xwayland_view();
@@ -173,6 +343,10 @@ void handle_new_xwayland_surface(struct wl_listener *listener, void *data) {
   wl_signal_add(&xwayland_surface->events.request_configure,
                 &view->request_configure);
 
+  view->request_fullscreen.notify = handle_request_fullscreen;
+  wl_signal_add(&xwayland_surface->events.request_fullscreen,
+                &view->request_fullscreen);
+
   view->request_move.notify = handle_request_move;
   wl_signal_add(&xwayland_surface->events.request_move, &view->request_move);
   view->request_resize.notify = handle_request_resize;
@@ -187,6 +361,11 @@ std::string ti::xwayland_view::get_title() {
   return this->xwayland_surface->title;
 }
 
+std::string ti::xwayland_view::get_app_id() {
+  const char *c_class = this->xwayland_surface->c_class;
+  return c_class ? c_class : "";
+}
+
 void ti::xwayland_view::for_each_surface(wlr_surface_iterator_func_t iterator,
                                          void *user_data) {
   wlr_surface_for_each_surface(surface, iterator, user_data);
@@ -198,6 +377,10 @@ void ti::xwayland_view::activate() {
 
 void ti::xwayland_view::deactivate() {
   wlr_xwayland_surface_activate(xwayland_surface, false);
+  // the titlebar shows it
+  if (decorated && mapped) {
+    damage_whole();
+  }
 }
 
 ti::xwayland_view::xwayland_view() : view(ti::XWAYLAND_VIEW, 50, 50) {}
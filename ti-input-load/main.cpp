@@ -0,0 +1,350 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <getopt.h>
+#include <linux/input-event-codes.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "virtual-keyboard-unstable-v1-client-protocol.h"
+#include "wlr-virtual-pointer-unstable-v1-client-protocol.h"
+
+/** ti-input-load: synthetic input for the compositor on $WAYLAND_DISPLAY,
+ * through the virtual pointer and keyboard protocols, which the compositor
+ * only offers with TI_VIRTUAL_INPUT=1. It plays a pattern at a fixed event
+ * rate and reports how far behind the schedule the compositor made it fall:
+ * sending blocks once the compositor stops reading. */
+
+/// the extent of absolute motion, which covers the whole layout
+#define EXTENT 65535
+
+enum pattern { PATTERN_MOTION, PATTERN_CLICK, PATTERN_TYPE, PATTERN_MIXED };
+
+struct globals {
+  struct wl_seat *seat = nullptr;
+  struct zwlr_virtual_pointer_manager_v1 *pointer_manager = nullptr;
+  struct zwp_virtual_keyboard_manager_v1 *keyboard_manager = nullptr;
+};
+
+static void handle_global(void *data, struct wl_registry *registry,
+                          uint32_t name, const char *interface,
+                          uint32_t version) {
+  auto *globals = reinterpret_cast<struct globals *>(data);
+  if (strcmp(interface, wl_seat_interface.name) == 0 &&
+      globals->seat == nullptr) {
+    globals->seat = reinterpret_cast<struct wl_seat *>(
+        wl_registry_bind(registry, name, &wl_seat_interface, 1));
+  } else if (strcmp(interface,
+                    zwlr_virtual_pointer_manager_v1_interface.name) == 0) {
+    globals->pointer_manager =
+        reinterpret_cast<struct zwlr_virtual_pointer_manager_v1 *>(
+            wl_registry_bind(registry, name,
+                             &zwlr_virtual_pointer_manager_v1_interface, 1));
+  } else if (strcmp(interface,
+                    zwp_virtual_keyboard_manager_v1_interface.name) == 0) {
+    globals->keyboard_manager =
+        reinterpret_cast<struct zwp_virtual_keyboard_manager_v1 *>(
+            wl_registry_bind(registry, name,
+                             &zwp_virtual_keyboard_manager_v1_interface, 1));
+  }
+}
+
+static void handle_global_remove(void *data, struct wl_registry *registry,
+                                 uint32_t name) {}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = handle_global,
+    .global_remove = handle_global_remove,
+};
+
+/// sends the default keymap, the one the compositor gives its keyboards
+static bool send_keymap(struct zwp_virtual_keyboard_v1 *keyboard) {
+  struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  struct xkb_rule_names rules = {};
+  struct xkb_keymap *keymap =
+      context != nullptr ? xkb_keymap_new_from_names(
+                               context, &rules, XKB_KEYMAP_COMPILE_NO_FLAGS)
+                         : nullptr;
+  char *string = keymap != nullptr
+                     ? xkb_keymap_get_as_string(keymap,
+                                                XKB_KEYMAP_FORMAT_TEXT_V1)
+                     : nullptr;
+  xkb_keymap_unref(keymap);
+  xkb_context_unref(context);
+  if (string == nullptr) {
+    fprintf(stderr, "Unable to compile a keymap\n");
+    return false;
+  }
+
+  size_t size = strlen(string) + 1;
+  int fd = memfd_create("keymap", MFD_CLOEXEC);
+  bool written = fd >= 0 && write(fd, string, size) == (ssize_t)size;
+  free(string);
+  if (!written) {
+    fprintf(stderr, "Unable to share the keymap: %s\n", strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  zwp_virtual_keyboard_v1_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+                                 fd, size);
+  close(fd);
+  return true;
+}
+
+/// reads and dispatches what the compositor sent, without waiting
+static bool dispatch_pending(struct wl_display *display) {
+  while (wl_display_prepare_read(display) != 0) {
+    wl_display_dispatch_pending(display);
+  }
+  struct pollfd pfd = {wl_display_get_fd(display), POLLIN, 0};
+  if (poll(&pfd, 1, 0) > 0) {
+    wl_display_read_events(display);
+  } else {
+    wl_display_cancel_read(display);
+  }
+  return wl_display_dispatch_pending(display) >= 0;
+}
+
+/// sends the requests, waiting for the compositor to read them if needed
+static bool flush(struct wl_display *display) {
+  while (wl_display_flush(display) < 0) {
+    if (errno != EAGAIN) {
+      return false;
+    }
+    struct pollfd pfd = {wl_display_get_fd(display), POLLOUT, 0};
+    poll(&pfd, 1, -1);
+  }
+  return true;
+}
+
+static uint64_t now_nsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/// xorshift, reproducible with -S
+static uint32_t next_random(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static const int letter_keys[26] = {
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I,
+    KEY_J, KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R,
+    KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+};
+
+static const char typed_text[] = "the quick brown fox jumps over the lazy dog ";
+
+/// the input of a pattern, one event (and its frame) per tick
+struct player {
+  struct zwlr_virtual_pointer_v1 *pointer;
+  struct zwp_virtual_keyboard_v1 *keyboard;
+  uint32_t random;
+
+  uint64_t tick = 0;
+  /// the held key or button, released on the next tick of its kind
+  uint32_t held_key = 0;
+  bool button_held = false;
+  size_t text_position = 0;
+  uint64_t events = 0;
+
+  void motion(uint32_t time) {
+    // a circle of radius 200 every 1000 ticks
+    double angle = 2 * M_PI * (tick % 1000) / 1000;
+    double step = 2 * M_PI * 200 / 1000;
+    zwlr_virtual_pointer_v1_motion(pointer, time,
+                                   wl_fixed_from_double(-sin(angle) * step),
+                                   wl_fixed_from_double(cos(angle) * step));
+    zwlr_virtual_pointer_v1_frame(pointer);
+  }
+
+  void click(uint32_t time) {
+    if (button_held) {
+      zwlr_virtual_pointer_v1_button(pointer, time, BTN_LEFT,
+                                     WL_POINTER_BUTTON_STATE_RELEASED);
+      button_held = false;
+    } else {
+      zwlr_virtual_pointer_v1_motion_absolute(
+          pointer, time, next_random(random) % EXTENT,
+          next_random(random) % EXTENT, EXTENT, EXTENT);
+      zwlr_virtual_pointer_v1_button(pointer, time, BTN_LEFT,
+                                     WL_POINTER_BUTTON_STATE_PRESSED);
+      button_held = true;
+    }
+    zwlr_virtual_pointer_v1_frame(pointer);
+  }
+
+  void type(uint32_t time) {
+    if (held_key != 0) {
+      zwp_virtual_keyboard_v1_key(keyboard, time, held_key,
+                                  WL_KEYBOARD_KEY_STATE_RELEASED);
+      held_key = 0;
+      return;
+    }
+    char c = typed_text[text_position];
+    text_position = (text_position + 1) % (sizeof(typed_text) - 1);
+    held_key = c == ' ' ? KEY_SPACE : letter_keys[c - 'a'];
+    zwp_virtual_keyboard_v1_key(keyboard, time, held_key,
+                                WL_KEYBOARD_KEY_STATE_PRESSED);
+  }
+
+  void play(enum pattern pattern, uint32_t time) {
+    switch (pattern) {
+    case PATTERN_MOTION:
+      motion(time);
+      break;
+    case PATTERN_CLICK:
+      click(time);
+      break;
+    case PATTERN_TYPE:
+      type(time);
+      break;
+    case PATTERN_MIXED: {
+      // mostly motion, like a person; presses are finished first
+      uint32_t r = next_random(random) % 100;
+      if (button_held || (held_key == 0 && r < 5)) {
+        click(time);
+      } else if (held_key != 0 || r < 15) {
+        type(time);
+      } else {
+        motion(time);
+      }
+      break;
+    }
+    }
+    ++tick;
+    ++events;
+  }
+
+  /// releases what is held, so the seat isn't left with a button down
+  void release(uint32_t time) {
+    if (button_held) {
+      click(time);
+    }
+    if (held_key != 0) {
+      type(time);
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  enum pattern pattern = PATTERN_MIXED;
+  double rate = 1000;
+  double seconds = 10;
+  uint32_t seed = 1;
+
+  int c;
+  while ((c = getopt(argc, argv, "p:r:t:S:h")) != -1) {
+    switch (c) {
+    case 'p':
+      if (strcmp(optarg, "motion") == 0) {
+        pattern = PATTERN_MOTION;
+      } else if (strcmp(optarg, "click") == 0) {
+        pattern = PATTERN_CLICK;
+      } else if (strcmp(optarg, "type") == 0) {
+        pattern = PATTERN_TYPE;
+      } else {
+        pattern = PATTERN_MIXED;
+      }
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'S':
+      seed = strtoul(optarg, nullptr, 10);
+      break;
+    default:
+      printf("Usage: %s [-p motion|click|type|mixed] [-r events per second] "
+             "[-t seconds] [-S seed]\n",
+             argv[0]);
+      return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (rate <= 0 || seconds <= 0) {
+    fprintf(stderr, "The rate and duration have to be positive\n");
+    return EXIT_FAILURE;
+  }
+
+  struct wl_display *display = wl_display_connect(nullptr);
+  if (display == nullptr) {
+    fprintf(stderr, "Unable to connect to the compositor\n");
+    return EXIT_FAILURE;
+  }
+  struct globals globals;
+  struct wl_registry *registry = wl_display_get_registry(display);
+  wl_registry_add_listener(registry, &registry_listener, &globals);
+  wl_display_roundtrip(display);
+  if (globals.seat == nullptr || globals.pointer_manager == nullptr ||
+      globals.keyboard_manager == nullptr) {
+    fprintf(stderr, "The compositor has no virtual pointer and keyboard, "
+                    "start it with TI_VIRTUAL_INPUT=1\n");
+    return EXIT_FAILURE;
+  }
+
+  player input = {
+      .pointer = zwlr_virtual_pointer_manager_v1_create_virtual_pointer(
+          globals.pointer_manager, globals.seat),
+      .keyboard = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+          globals.keyboard_manager, globals.seat),
+      .random = seed != 0 ? seed : 1,
+  };
+  if (!send_keymap(input.keyboard)) {
+    return EXIT_FAILURE;
+  }
+  zwp_virtual_keyboard_v1_modifiers(input.keyboard, 0, 0, 0, 0);
+  wl_display_roundtrip(display);
+
+  uint64_t interval = 1e9 / rate;
+  uint64_t start = now_nsec();
+  uint64_t end = start + (uint64_t)(seconds * 1e9);
+  uint64_t due = start;
+  uint64_t late_ticks = 0, max_late = 0;
+  bool connected = true;
+  while (connected && due < end) {
+    struct timespec ts = {(time_t)(due / 1000000000),
+                          (long)(due % 1000000000)};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+
+    uint64_t now = now_nsec();
+    uint64_t late = now > due ? now - due : 0;
+    if (late > interval) {
+      ++late_ticks;
+    }
+    if (late > max_late) {
+      max_late = late;
+    }
+    input.play(pattern, now / 1000000);
+    connected = flush(display) && dispatch_pending(display);
+    due += interval;
+  }
+  input.release(now_nsec() / 1000000);
+  zwlr_virtual_pointer_v1_destroy(input.pointer);
+  zwp_virtual_keyboard_v1_destroy(input.keyboard);
+  wl_display_roundtrip(display);
+
+  double elapsed = (now_nsec() - start) / 1e9;
+  printf("%lu events in %.2f s, %.0f per second (asked for %.0f)\n",
+         (unsigned long)input.events, elapsed, input.events / elapsed,
+         rate);
+  printf("%lu ticks late by more than an interval, at most %.2f ms\n",
+         (unsigned long)late_ticks, max_late / 1e6);
+  wl_display_disconnect(display);
+  return connected ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "metrics.hpp"
+
+/** ti-top: a live view of the metrics page of a running compositor, see
+ * ti::metrics. The page is mapped read-only and copied under its seqlock;
+ * nothing here can make the compositor wait. */
+
+/// maps the page at path, and sets inode to its file's
+static const ti::metrics_page *open_page(const char *path, ino_t &inode) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+    return nullptr;
+  }
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ti::metrics_page)) {
+    data = mmap(nullptr, sizeof(ti::metrics_page), PROT_READ, MAP_SHARED, fd,
+                0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "%s is not a metrics page\n", path);
+    return nullptr;
+  }
+  inode = st.st_ino;
+
+  auto *page = reinterpret_cast<const ti::metrics_page *>(data);
+  if (page->magic != TI_METRICS_MAGIC || page->version != TI_METRICS_VERSION ||
+      page->size != sizeof(ti::metrics_data)) {
+    fprintf(stderr, "%s: version %u, ti-top reads version %u\n", path,
+            page->version, TI_METRICS_VERSION);
+    munmap(data, sizeof(ti::metrics_page));
+    return nullptr;
+  }
+  return page;
+}
+
+/// copies the data of page once no update is in progress
+static void read_page(const ti::metrics_page *page, ti::metrics_data &data) {
+  for (;;) {
+    uint32_t before = page->sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    memcpy(&data, &page->data, sizeof(data));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (page->sequence.load(std::memory_order_relaxed) == before) {
+      return;
+    }
+  }
+}
+
+static void print_duration(char *buf, size_t size, int64_t usec) {
+  int64_t s = usec / 1000000;
+  snprintf(buf, size, "%ld:%02ld:%02ld", (long)(s / 3600), (long)(s / 60 % 60),
+           (long)(s % 60));
+}
+
+enum sort_key { SORT_DAMAGE, SORT_COMMITS, SORT_WASTED, SORT_MEMORY };
+
+static uint64_t sort_value(const ti::metrics_client &c, sort_key key) {
+  switch (key) {
+  case SORT_COMMITS:
+    return c.commits_per_sec;
+  case SORT_WASTED:
+    return c.wasted_commits_per_sec;
+  case SORT_MEMORY:
+    return c.shm_bytes + c.texture_bytes;
+  default:
+    return c.damaged_pixels_per_sec;
+  }
+}
+
+static void show(const ti::metrics_page *page, ti::metrics_data &data,
+                 int max_clients, sort_key key) {
+  char uptime[32];
+  print_duration(uptime, sizeof(uptime), data.updated_usec - data.start_usec);
+
+  // home and clear, like top
+  printf("\033[H\033[2J");
+  printf("theinterface pid %d  up %s  views %u (%u mapped)  clients %u\n",
+         page->pid, uptime, data.views, data.mapped_views,
+         data.connected_clients);
+  printf("event loop  %5.1f%% busy  %u dispatches/s  %.3f s busy in total\n",
+         data.loop_busy_percent, data.loop_dispatches_per_sec,
+         data.loop_busy_usec / 1e6);
+  printf("allocations %u/s  %lu live  %lu in total\n",
+         data.allocations_per_sec,
+         (unsigned long)(data.allocations - data.deallocations),
+         (unsigned long)data.allocations);
+  printf("launches    %u  last %u ms  p50 %u ms  max %u ms (spawn to map)\n\n",
+         data.launches, data.launch_last_msec, data.launch_p50_msec,
+         data.launch_max_msec);
+
+  printf("%-12s %11s %7s %4s %8s %8s %8s %8s %6s %6s %6s %6s\n", "OUTPUT",
+         "SIZE", "HZ", "FPS", "FRAME", "AVG", "MAX", "INTERVAL", "DMG%",
+         "AVG%", "MAX%", "RECTS");
+  for (uint32_t i = 0; i < data.output_count && i < TI_METRICS_OUTPUTS; ++i) {
+    const ti::metrics_output &o = data.outputs[i];
+    if (o.name[0] == '\0') {
+      // the output went away
+      continue;
+    }
+    char size[24];
+    snprintf(size, sizeof(size), "%dx%d", o.width, o.height);
+    printf("%-12.12s %11s %7.2f %4u %8.2f %8.2f %8.2f %8.2f %6.1f %6.1f %6.1f "
+           "%6.1f\n",
+           o.name, size, o.refresh_mhz / 1000.0, o.damage_fps,
+           o.frame_usec / 1000.0, o.frame_usec_avg / 1000.0,
+           o.frame_usec_max / 1000.0, o.interval_usec / 1000.0,
+           o.damage_last_percent, o.damage_avg_percent, o.damage_max_percent,
+           o.damage_avg_rects);
+  }
+  printf("(frame times in ms, from the frame event to the commit)\n\n");
+
+  printf("%8s %6s %-16s %9s %9s %9s %8s %10s %8s %8s %11s\n", "PID", "UID",
+         "CLIENT", "COMMITS/S", "DMG MP/S", "WASTED/S", "WASTED%", "CALLBACK/S",
+         "SHM MB", "TEX MB", "THROTTLED/S");
+  uint32_t count = std::min<uint32_t>(data.client_count, TI_METRICS_CLIENTS);
+  std::stable_sort(data.clients, data.clients + count,
+                   [key](const auto &a, const auto &b) {
+                     return sort_value(a, key) > sort_value(b, key);
+                   });
+  for (uint32_t i = 0; i < count && (int)i < max_clients; ++i) {
+    const ti::metrics_client &c = data.clients[i];
+    // flagged clients have been over their commit budget for a while
+    printf("%8d %6u %-16.16s %9u %9.2f %9u %8.1f %10lu %8.1f %8.1f %10u%s\n",
+           c.pid, c.uid, c.name, c.commits_per_sec,
+           c.damaged_pixels_per_sec / 1e6, c.wasted_commits_per_sec,
+           c.commits ? 100.0 * c.wasted_commits / c.commits : 0.0,
+           (unsigned long)c.frame_callbacks_per_sec, c.shm_bytes / 1048576.0,
+           c.texture_bytes / 1048576.0, c.throttled_commits_per_sec,
+           c.flagged ? "!" : " ");
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+  double interval = 1;
+  int iterations = -1;
+  int max_clients = 20;
+  sort_key key = SORT_DAMAGE;
+  const char *path_arg = nullptr;
+
+  int c;
+  while ((c = getopt(argc, argv, "d:n:c:s:h")) != -1) {
+    switch (c) {
+    case 'd':
+      interval = atof(optarg);
+      break;
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    case 'c':
+      max_clients = atoi(optarg);
+      break;
+    case 's':
+      if (strcmp(optarg, "commits") == 0) {
+        key = SORT_COMMITS;
+      } else if (strcmp(optarg, "wasted") == 0) {
+        key = SORT_WASTED;
+      } else if (strcmp(optarg, "memory") == 0) {
+        key = SORT_MEMORY;
+      } else {
+        key = SORT_DAMAGE;
+      }
+      break;
+    default:
+      printf("Usage: %s [-d seconds] [-n iterations] [-c clients] "
+             "[-s damage|commits|wasted|memory] [metrics file]\n",
+             argv[0]);
+      return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind < argc) {
+    path_arg = argv[optind];
+  }
+  std::string path =
+      path_arg ? path_arg : ti::metrics_path(getenv("WAYLAND_DISPLAY"));
+  if (path.empty()) {
+    fprintf(stderr, "No metrics file: XDG_RUNTIME_DIR or WAYLAND_DISPLAY is "
+                    "not set\n");
+    return EXIT_FAILURE;
+  }
+
+  ino_t inode;
+  const ti::metrics_page *page = open_page(path.c_str(), inode);
+  if (page == nullptr) {
+    return EXIT_FAILURE;
+  }
+  ti::metrics_data data;
+  while (iterations != 0) {
+    // a restarted compositor creates a new file
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) {
+      printf("theinterface exited\n");
+      return EXIT_SUCCESS;
+    }
+    if (st.st_ino != inode) {
+      munmap(const_cast<ti::metrics_page *>(page), sizeof(ti::metrics_page));
+      page = open_page(path.c_str(), inode);
+      if (page == nullptr) {
+        return EXIT_FAILURE;
+      }
+    }
+    read_page(page, data);
+    show(page, data, max_clients, key);
+    if (iterations > 0) {
+      --iterations;
+    }
+    if (iterations != 0) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+    }
+  }
+  return EXIT_SUCCESS;
+}